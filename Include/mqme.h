@@ -51,21 +51,57 @@ typedef uint32_t FOURCHARCODE;
 
 /// Initializes the mqme library
 /// initial_idle_packet_count dictates how many packets of initial_packet_size will
-/// be created and waiting to be used. If a larger size is needed, that packet is resized.
+/// be created and waiting to be used. Idle packets are kept in power-of-two size classes
+/// (256 bytes to 16 MB); if a larger size is needed, the packet is moved to a larger class.
 /// If more packets are required, more will be created at that time.
 /// mqme uses a pool of worker threads to process incoming packets - the number of threads
 /// available to mqme is controllable by setting the number of threads per core and an
-/// additive modifier to that number of cores 
-MQME_API bool Initialize(UINT initial_idle_packet_count = 256, UINT initial_packet_size = 4096, UINT threads_per_core = 1, INT core_count_adjustment = -2);
+/// additive modifier to that number of cores. Idle workers take work from busy ones, and
+/// handlers registered with HF_HIGH_PRIORITY are run ahead of everything else
+/// thread_packet_cache_size is the number of idle packets (per size class, up to 64 KB) that
+/// each thread keeps for itself, so that most calls to NewPacket and Release don't contend with
+/// other threads; packets move to and from the shared pool in batches of half that size.
+/// 0 disables the per-thread caches.
+MQME_API bool Initialize(UINT initial_idle_packet_count = 256, UINT initial_packet_size = 4096, UINT threads_per_core = 1, INT core_count_adjustment = -2, UINT thread_packet_cache_size = 64);
 
 
 /// Closes the mqme library
+/// Every server and client must have been released, and no other thread may still be
+/// creating or releasing packets, by the time this is called; threads that have used
+/// packets may keep running, but must not use them again until after the next Initialize.
 MQME_API void Close();
 
 
+/// Packet pool statistics, as reported by GetPoolStats
+typedef struct sPoolStats
+{
+	uint64_t live_packets;			/// packets currently in use
+	uint64_t live_bytes;			/// data bytes held by packets currently in use
+	uint64_t idle_packets;			/// packets waiting in the pool to be reused
+	uint64_t idle_bytes;			/// data bytes held by idle packets
+	uint64_t peak_live_packets;		/// the most packets that have been in use at once
+	uint64_t peak_live_bytes;		/// the most data bytes that have been in use at once
+} SPoolStats;
+
+
+/// Fills out the current packet pool statistics; these can be used to choose
+/// the initial_idle_packet_count and initial_packet_size given to Initialize
+MQME_API bool GetPoolStats(SPoolStats *stats);
+
+
+/// Bounds the memory held by idle packets. When the number of idle packets exceeds
+/// idle_packets_high, or the bytes they hold exceed idle_bytes_high, idle packets are
+/// freed in the background (largest first) until both are at or under their low marks.
+/// A high mark of 0 removes that limit, which is the default.
+/// Packets in the per-thread caches (see Initialize) don't count against these marks;
+/// thread_packet_cache_size already bounds them.
+MQME_API void SetPoolLimits(size_t idle_packets_high, size_t idle_packets_low, uint64_t idle_bytes_high = 0, uint64_t idle_bytes_low = 0);
+
+
 /// ICorePacket interface -- allows user code to safely access arriving data
 /// or to fill out data to be sent.  Notification callbacks will provide a
 /// pointer to this interface type.
+/// Packets are reference counted; the count is safe to change from any thread.
 class ICorePacket
 {
 public:
@@ -97,15 +133,173 @@ public:
 	/// Returns a pointer to the physical data stored in this packet
 	virtual BYTE *GetData() = NULL;
 
-	/// Returns an ICorePacket interface
+	/// NOTE: new methods go after the ones above, so that the existing ones keep their vtable slots
+	/// for applications built against an older header
+
+	/// Adds a reference to the packet; each call must be matched by a call to Release.
+	/// Packets given to a PACKET_HANDLER are only valid until the handler returns,
+	/// so add a reference (or use PacketRef) if you need to keep one longer
+	virtual void AddRef() = NULL;
+
+	/// Starts building the packet's data in place, as an alternative to SetData:
+	/// sets the id, empties the data, and makes room for at least reserve bytes.
+	/// Follow up with Reserve / Commit and Append; the data length is whatever has been committed.
+	virtual void BeginData(FOURCHARCODE id, uint32_t reserve = 0) = NULL;
+
+	/// Returns a pointer to at least len writable bytes following the committed data,
+	/// growing the packet if needed. Nothing is added to the data until Commit is called.
+	/// Note: the pointer is only good until the next Reserve, Append, or SetData
+	virtual BYTE *Reserve(uint32_t len) = NULL;
+
+	/// Adds len bytes, written through the pointer returned by Reserve, to the end of the data
+	virtual void Commit(uint32_t len) = NULL;
+
+	/// Copies len bytes to the end of the data, growing the packet if needed
+	virtual void Append(const BYTE *data, uint32_t len) = NULL;
+
+	/// EXTERNAL_DATA_RELEASE is a callback function provided by the user that is called
+	/// when the library no longer needs a buffer given to SetExternalData
+	typedef void (__cdecl *EXTERNAL_DATA_RELEASE)(const BYTE *data, uint32_t datalen, LPVOID userdata);
+
+	/// Sets the id and points the packet at a caller-owned buffer instead of copying it;
+	/// the data is sent straight from that buffer. release (if not null) is called once the
+	/// last reference to the packet is gone - i.e. after it has been written to every
+	/// recipient - or when the packet's data is replaced, whichever comes first.
+	/// The buffer must stay valid and unmodified until then.
+	virtual void SetExternalData(FOURCHARCODE id, uint32_t datalen, const BYTE *data, EXTERNAL_DATA_RELEASE release, LPVOID userdata = nullptr) = NULL;
+
+	/// Returns an ICorePacket interface, holding one reference that belongs to the caller
 	/// It should be noted that packets are globally managed
 	/// and will be recycled when Released, so
 	/// it is important to fill them out entirely
 	/// before using them!
-	MQME_API static ICorePacket *NewPacket();
+	/// size_hint is the expected data length; 0 uses the initial packet size
+	MQME_API static ICorePacket *NewPacket(uint32_t size_hint = 0);
 };
 
 
+/// PacketRef holds one reference to a packet and releases it when destroyed.
+/// Copying a PacketRef adds a reference; moving one does not.
+class PacketRef
+{
+public:
+	PacketRef() : m_Packet(nullptr) { }
+
+	/// Adopts a reference the caller already owns (e.g. one returned by ICorePacket::NewPacket)
+	explicit PacketRef(ICorePacket *packet) : m_Packet(packet) { }
+
+	PacketRef(const PacketRef &other) : m_Packet(other.m_Packet) { if (m_Packet) m_Packet->AddRef(); }
+
+	PacketRef(PacketRef &&other) noexcept : m_Packet(other.m_Packet) { other.m_Packet = nullptr; }
+
+	~PacketRef() { Reset(); }
+
+	PacketRef &operator =(const PacketRef &other)
+	{
+		if (other.m_Packet)
+			other.m_Packet->AddRef();
+		Reset(other.m_Packet);
+		return *this;
+	}
+
+	PacketRef &operator =(PacketRef &&other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset(other.m_Packet);
+			other.m_Packet = nullptr;
+		}
+		return *this;
+	}
+
+	/// Takes a new reference to a packet the caller doesn't own, such as one given to a PACKET_HANDLER
+	static PacketRef Share(ICorePacket *packet)
+	{
+		if (packet)
+			packet->AddRef();
+		return PacketRef(packet);
+	}
+
+	/// Releases the held packet (if any) and adopts the given reference
+	void Reset(ICorePacket *packet = nullptr)
+	{
+		ICorePacket *old = m_Packet;
+		m_Packet = packet;
+		if (old)
+			old->Release();
+	}
+
+	/// Gives up the reference without releasing it - use this to hand the packet to SendPacket
+	ICorePacket *Detach()
+	{
+		ICorePacket *ret = m_Packet;
+		m_Packet = nullptr;
+		return ret;
+	}
+
+	ICorePacket *Get() const { return m_Packet; }
+
+	ICorePacket *operator ->() const { return m_Packet; }
+
+	explicit operator bool() const { return (m_Packet != nullptr); }
+
+protected:
+	ICorePacket *m_Packet;
+};
+
+
+/// SStreamChunk describes one piece of a large message, as given to a STREAM_HANDLER.
+/// Large messages are sent in pieces when the sender has set a maximum chunk size
+/// (see SetMaxChunkSize); receivers reassemble them for PACKET_HANDLERs automatically, or
+/// hand the pieces over one at a time to a STREAM_HANDLER registered for the message's id.
+/// Messages that arrive whole, or compressed, are handed to a STREAM_HANDLER as a single piece.
+typedef struct sStreamChunk
+{
+	FOURCHARCODE id;			/// the id of the whole message
+	GUID sender;				/// who sent the message
+	GUID context;				/// the context (channel) the message was sent to
+	uint32_t message;			/// identifies the message this piece belongs to (unique per sender)
+	uint32_t total_length;		/// the data length of the whole message
+	uint32_t offset;			/// where this piece goes in the whole message
+	uint32_t length;			/// the length of this piece
+	const BYTE *data;			/// the data in this piece; only valid during the callback
+} SStreamChunk;
+
+
+/// Flags that may be given when a handler is registered. By default, handlers run on any of the
+/// worker threads, as soon as one is free - so two packets may be handled at the same time, and
+/// not necessarily in the order they arrived. Ordering a handler's packets serializes them without
+/// a lock: packets with different senders (or contexts) are still handled in parallel.
+/// Handlers of the same packet id that were registered with different flags run separately
+enum EHandlerFlags
+{
+	HF_ORDER_BY_SENDER = 0x0001,	/// packets from the same sender are handled one at a time, in the order they arrived
+	HF_ORDER_BY_CONTEXT = 0x0002,	/// packets sent to the same context (channel) are handled one at a time, in order; HF_ORDER_BY_SENDER takes precedence
+
+	/// the handler is called right on the thread that received the packet, which saves handing it
+	/// to a worker - but holds up everything else that thread has to read and send until it returns,
+	/// so it's only for handlers that are very quick. A connection's packets are received in order by
+	/// one thread, so the ordering flags don't apply
+	HF_INLINE = 0x0004,
+
+	/// the handler's packets go ahead of all others that are waiting for a worker thread - for control
+	/// messages that shouldn't wait behind a flood of data. An ordered handler's packets still wait for
+	/// those before them in their order
+	HF_HIGH_PRIORITY = 0x0008,
+};
+
+
+/// Handler statistics, as reported by GetHandlerStats. Each count is of packets (or pieces of
+/// large messages) given to the handlers registered for an id with the same flags
+typedef struct sHandlerStats
+{
+	uint64_t pooled;			/// handed to a worker thread
+	uint64_t ordered;			/// handed to a worker thread through a strand (see HF_ORDER_BY_SENDER)
+	uint64_t inlined;			/// handled on the thread that received them (see HF_INLINE)
+	uint64_t batches;			/// batches handed to batch handlers (their packets are counted above)
+} SHandlerStats;
+
+
 /// IGUIDSet is a set of GUIDs that is used for routing packets appropriately. An instance of
 /// ICoreServer will maintain listener data per-channel and it can be modified with this interface.
 class IGUIDSet
@@ -151,10 +345,32 @@ public:
 
 		ET_CONNECT,			/// a new client has connected
 		ET_DISCONNECT,		/// a client has disconnected
+		ET_SLOW_CONSUMER,	/// a client's outbound queue is full (see SetOutboundLimits)
 
 		ET_NUMEVENTS
 	};
 
+	/// What happens to a packet for a client whose outbound queue is full
+	enum EOverflowPolicy
+	{
+		OP_BLOCK = 0,		/// SendPacket waits until there's room, or for 5 seconds (see SetOutboundLimits)
+		OP_DROP_OLDEST,		/// the oldest packets that haven't started going out are thrown away to make room
+		OP_DROP_NEWEST,		/// the new packet is thrown away
+		OP_DISCONNECT,		/// the client is disconnected
+
+		OP_NUMPOLICIES
+	};
+
+	/// Which of a channel's packets go to a listener (see SetListenerFilter)
+	enum EFilterMode
+	{
+		FM_ALL = 0,			/// all of them
+		FM_ALLOW,			/// only those with the given ids
+		FM_DENY,			/// all but those with the given ids
+
+		FM_NUMMODES
+	};
+
 	/// PACKET_HANDLER is a callback function provided by the user
 	/// that will be called when a packet matching the type given in the
 	/// ICoreServer::RegisterHandler arrives.  This callback will be given
@@ -167,6 +383,16 @@ public:
 	/// occurs.
 	typedef bool (__cdecl *EVENT_HANDLER)(ICoreServer *server, EEventType ev, GUID generator, LPVOID userdata);
 
+	/// STREAM_HANDLER is a callback function provided by the user that will be called
+	/// for each piece of a large message whose id was given to ICoreServer::RegisterStreamHandler.
+	/// NOTE: pieces may be handled on different worker threads, so use the offset to place them
+	typedef bool (__cdecl *STREAM_HANDLER)(ICoreServer *server, const SStreamChunk *chunk, LPVOID userdata);
+
+	/// BATCH_HANDLER is a callback function provided by the user that will be called with a number of
+	/// packets at once, all with the id that was given to ICoreServer::RegisterBatchHandler, in the order
+	/// they were received. The packets are only valid until the handler returns
+	typedef bool (__cdecl *BATCH_HANDLER)(ICoreServer *server, ICorePacket **packets, size_t count, LPVOID userdata);
+
 	/// Releases the server, implicitly calling StopListening
 	virtual void Release() = NULL;
 
@@ -179,7 +405,7 @@ public:
 	/// allocated by the server, stopping all threads, etc.
 	virtual bool StopListening() = NULL;
 
-	/// Sends a packet.
+	/// Sends a packet, taking over the caller's reference to it.
 	/// NOTE: once a packet has been sent, it should not be modified
 	virtual bool SendPacket(ICorePacket *packet) = NULL;
 
@@ -191,7 +417,14 @@ public:
 	/// After this is called, packets sent to the channel will be sent to the listener
 	virtual void RemoveListenerFromChannel(GUID channel, GUID listener) = NULL;
 
-	/// Populates a set with the current listeners on a given channel
+	/// Limits which packets on the channel go to the listener, by id; packets it doesn't want
+	/// are never sent to it. This takes the place of whatever the client advertised (see
+	/// ICoreClient::SetAdvertiseHandlers) for this channel. Returns false if the listener isn't
+	/// on the channel
+	virtual bool SetListenerFilter(GUID channel, GUID listener, EFilterMode mode, const FOURCHARCODE *ids = nullptr, size_t count = 0) = NULL;
+
+	/// Populates a set with the current listeners on a given channel. The set is a copy that
+	/// belongs to the calling thread, and is good until that thread calls GetListeners again
 	virtual bool GetListeners(GUID channel, IGUIDSet **listeners) = NULL;
 
 	/// Registers an incoming packet handling callback with the server.
@@ -199,7 +432,76 @@ public:
 	/// will be executed.
 	/// NOTE: packets will still be routed to their given context, even if no
 	/// handler has been registered with the server
-	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr) = NULL;
+	/// NOTE: an id may have several handlers; they're called in the order they were registered
+	/// flags is any combination of EHandlerFlags
+	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Registers a callback that receives large messages with the given id piece by piece,
+	/// instead of having them reassembled and given to a PACKET_HANDLER
+	virtual void RegisterStreamHandler(FOURCHARCODE id, STREAM_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Registers a callback that's given the packets with the given id several at a time, which saves
+	/// handing them over one by one. A batch is everything with that id that one receiving thread has
+	/// read, up to max_count packets (0 for no limit); it's handed over max_delay_us microseconds after
+	/// its first packet arrived, or, if that's 0, as soon as the thread is done with what it has read.
+	/// The ordering flags keep each sender's packets in order, one batch after another
+	virtual void RegisterBatchHandler(FOURCHARCODE id, BATCH_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0, uint32_t max_count = 0, uint32_t max_delay_us = 0) = NULL;
+
+	/// Registers a callback for every packet whose id has no handlers of its own
+	virtual void RegisterDefaultHandler(PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Fills out how received packets have been handled so far
+	virtual void GetHandlerStats(SHandlerStats *stats) = NULL;
+
+	/// Packets with more data than max_chunk_size bytes are sent as a series of pieces
+	/// of at most that size, so that other traffic can go out in between them.
+	/// 0 (the default) sends every packet whole
+	virtual void SetMaxChunkSize(uint32_t max_chunk_size) = NULL;
+
+	/// When allowed (the default), clients that offer compact packet headers are switched to them,
+	/// which replaces the sender and context GUIDs in each header with small per-connection handles.
+	/// Clients that don't offer them keep using the full header
+	virtual void SetCompactHeaders(bool allow) = NULL;
+
+	/// Packets with the given id are compressed before they're sent if they have at least min_size
+	/// bytes of data; 0 turns compression for the id back off. Receivers decompress them before
+	/// handing them to a handler (peers must be running a version that understands compression).
+	/// Worth it for repetitive data (text, serialized state) when bandwidth is scarcer than CPU.
+	/// Compressed packets from clients are routed as they are; the server only decompresses
+	/// the ones it has a handler for
+	virtual void SetCompression(FOURCHARCODE id, uint32_t min_size) = NULL;
+
+	/// Like SetCompression, but for every packet sent to the given channel. When both apply,
+	/// the smaller min_size wins
+	virtual void SetChannelCompression(GUID channel, uint32_t min_size) = NULL;
+
+	/// Sets how many I/O threads the server spreads its connections over (1 by default, 64 at most); each one
+	/// reads from and writes to the connections it has been given. Takes effect on the next
+	/// StartListening. NOTE: with more than one, EVENT_HANDLERs may be called from any of them
+	virtual void SetIOThreads(size_t count) = NULL;
+
+	/// When one packet goes to more than min_members of an I/O thread's clients, that thread splits
+	/// them into pieces of min_members and has the server's own workers (started the first time
+	/// this is set, and separate from the thread pool that runs the handlers) queue the packet to
+	/// the pieces at once, waiting for them all before it goes on (so each client still gets
+	/// everything in order). 0, the default, never splits
+	virtual void SetParallelFanout(size_t min_members) = NULL;
+
+	/// Packets waiting to go out to the same client are gathered into a single write of at most
+	/// max_bytes in max_buffers pieces (64KB in 64 pieces by default; 0 for either sends each
+	/// packet on its own). A partial write normally goes out as soon as the queue is empty;
+	/// a flush_delay_us lets it wait that many microseconds for more, trading latency for fewer calls
+	virtual void SetSendCoalescing(uint32_t max_bytes, uint32_t max_buffers, uint32_t flush_delay_us = 0) = NULL;
+
+	/// Bounds what may be waiting to go out to each client, in bytes and in packets (0 for
+	/// either, the default, means no bound). When a client falls that far behind, ET_SLOW_CONSUMER
+	/// is fired (once, until it catches up) and the policy decides what gives. Pieces of large
+	/// messages are never dropped, since the client couldn't put the message back together.
+	/// With OP_BLOCK, a SendPacket that's still waiting after 5 seconds queues its packet anyway, and
+	/// a handler on the thread pool holds its worker for as long as it waits. Packets relayed from
+	/// one client to others are never held back (that would stall everyone on the same I/O thread),
+	/// so they're queued over the limit: under OP_BLOCK, only the clients' own sending bounds them
+	virtual void SetOutboundLimits(uint64_t max_bytes, size_t max_packets, EOverflowPolicy policy) = NULL;
 
 	/// Registers an event handling callback with the server.
 	virtual void RegisterEventHandler(EEventType ev, EVENT_HANDLER handler, LPVOID userdata = nullptr) = NULL;
@@ -236,6 +538,16 @@ public:
 	/// occurs.
 	typedef bool(__cdecl *EVENT_HANDLER)(ICoreClient *client, EEventType ev, LPVOID userdata);
 
+	/// STREAM_HANDLER is a callback function provided by the user that will be called
+	/// for each piece of a large message whose id was given to ICoreClient::RegisterStreamHandler.
+	/// NOTE: pieces may be handled on different worker threads, so use the offset to place them
+	typedef bool (__cdecl *STREAM_HANDLER)(ICoreClient *client, const SStreamChunk *chunk, LPVOID userdata);
+
+	/// BATCH_HANDLER is a callback function provided by the user that will be called with a number of
+	/// packets at once, all with the id that was given to ICoreClient::RegisterBatchHandler, in the order
+	/// they were received. The packets are only valid until the handler returns
+	typedef bool (__cdecl *BATCH_HANDLER)(ICoreClient *client, ICorePacket **packets, size_t count, LPVOID userdata);
+
 	/// Releases the client, implicitly calling Disconnect
 	/// WARNING: Once the client has been released, do not
 	/// attempt to call any member functions.
@@ -256,14 +568,71 @@ public:
 	/// Returns the state of connection
 	virtual bool IsConnected() = NULL;
 
-	/// Sends a packet.
+	/// Sends a packet, taking over the caller's reference to it.
+	/// Packets sent while Connect is still in progress wait until the connection is up; if it
+	/// can't be made, they're released and ET_DISCONNECTED is sent to the event handler.
 	/// NOTE: once a packet has been sent, it should not be modified
 	virtual bool SendPacket(ICorePacket *packet) = NULL;
 
 	/// Registers an incoming packet handling callback with the client.
 	/// When a packet with the given id arrives, this callback
 	/// will be executed.
-	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr) = NULL;
+	/// NOTE: an id may have several handlers; they're called in the order they were registered
+	/// flags is any combination of EHandlerFlags
+	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Registers a callback that receives large messages with the given id piece by piece,
+	/// instead of having them reassembled and given to a PACKET_HANDLER
+	virtual void RegisterStreamHandler(FOURCHARCODE id, STREAM_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Registers a callback that's given the packets with the given id several at a time, which saves
+	/// handing them over one by one. A batch is everything with that id that one receiving thread has
+	/// read, up to max_count packets (0 for no limit); it's handed over max_delay_us microseconds after
+	/// its first packet arrived, or, if that's 0, as soon as the thread is done with what it has read.
+	/// The ordering flags keep each sender's packets in order, one batch after another
+	virtual void RegisterBatchHandler(FOURCHARCODE id, BATCH_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0, uint32_t max_count = 0, uint32_t max_delay_us = 0) = NULL;
+
+	/// Registers a callback for every packet whose id has no handlers of its own
+	virtual void RegisterDefaultHandler(PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0) = NULL;
+
+	/// Fills out how received packets have been handled so far
+	virtual void GetHandlerStats(SHandlerStats *stats) = NULL;
+
+	/// Packets with more data than max_chunk_size bytes are sent as a series of pieces
+	/// of at most that size, so that other traffic can go out in between them.
+	/// 0 (the default) sends every packet whole
+	virtual void SetMaxChunkSize(uint32_t max_chunk_size) = NULL;
+
+	/// When set (the default), the client offers compact packet headers to the server when it
+	/// connects; they're only used if the server agrees. Takes effect on the next Connect
+	virtual void SetCompactHeaders(bool offer) = NULL;
+
+	/// Packets with the given id are compressed before they're sent if they have at least min_size
+	/// bytes of data; 0 turns compression for the id back off. Receivers decompress them before
+	/// handing them to a handler (peers must be running a version that understands compression).
+	/// Worth it for repetitive data (text, serialized state) when bandwidth is scarcer than CPU
+	virtual void SetCompression(FOURCHARCODE id, uint32_t min_size) = NULL;
+
+	/// Like SetCompression, but for every packet sent to the given channel. When both apply,
+	/// the smaller min_size wins
+	virtual void SetChannelCompression(GUID channel, uint32_t min_size) = NULL;
+
+	/// When set, SendPacket writes a packet to the socket from the calling thread if nothing else
+	/// is waiting to go out, instead of handing it to the send thread. This saves a thread hop
+	/// on latency-sensitive request/response traffic, at the cost of the caller doing the write
+	virtual void SetDirectSend(bool direct) = NULL;
+
+	/// When set, the client tells the server which packet ids it has handlers for when it
+	/// connects (and again whenever another handler is registered), and the server only sends it
+	/// those - except on channels it has been given a filter for (see ICoreServer::SetListenerFilter).
+	/// With a default handler registered, it's sent everything. Off by default; takes effect on the next Connect
+	virtual void SetAdvertiseHandlers(bool advertise) = NULL;
+
+	/// Packets waiting to go out to the server are gathered into a single write of at most
+	/// max_bytes in max_buffers pieces (64KB in 64 pieces by default; 0 for either sends each
+	/// packet on its own). A partial write normally goes out as soon as the queue is empty;
+	/// a flush_delay_us lets it wait that many microseconds for more, trading latency for fewer calls
+	virtual void SetSendCoalescing(uint32_t max_bytes, uint32_t max_buffers, uint32_t flush_delay_us = 0) = NULL;
 
 	/// Registers an event handling callback with the client.
 	virtual void RegisterEventHandler(EEventType ev, EVENT_HANDLER handler, LPVOID userdata = nullptr) = NULL;
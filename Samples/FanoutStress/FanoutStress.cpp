@@ -0,0 +1,230 @@
+// FanoutStress.cpp : Fans packets out to a channel at full rate while other clients join and leave it.
+//
+// Usage: FanoutStress [subscribers] [churners] [seconds] [port]
+//
+// The server publishes to one channel as fast as the subscribers will take it (OP_BLOCK, so
+// nothing is dropped). After a quiet phase, churn threads keep adding and removing the other
+// clients to and from the same channel. Both phases report how fast packets went out and came
+// in, and at the end every subscriber must have received every packet that was published.
+
+#include "stdafx.h"
+#include <mqme.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#define DEFAULT_SUBSCRIBERS		16
+#define DEFAULT_CHURNERS		64
+#define DEFAULT_SECONDS			5
+#define DEFAULT_PORT			12347
+#define PUBLISHER_THREADS		2
+#define CHURN_THREADS			4
+#define PAYLOAD_SIZE			64
+
+static const GUID channel = { 0x6D3A1C52, 0x1F0E, 0x4B7A, { 0x9C, 0x21, 0x5E, 0x8B, 0x40, 0xD7, 0x13, 0xA6 } };
+
+mqme::ICoreServer *pServer;
+std::vector<mqme::ICoreClient *> churners;
+
+std::atomic<bool> stop_publishing, stop_churning;
+std::atomic<uint64_t> published, delivered, churned;
+
+bool HandleData(mqme::ICoreClient *client, mqme::ICorePacket *packet, LPVOID userdata)
+{
+	delivered++;
+
+	return true;
+}
+
+DWORD WINAPI PublishThreadProc(LPVOID param)
+{
+	BYTE payload[PAYLOAD_SIZE];
+	memset(payload, 0, sizeof(payload));
+
+	while (!stop_publishing)
+	{
+		mqme::ICorePacket *pp = mqme::ICorePacket::NewPacket(sizeof(payload));
+		if (!pp)
+			break;
+
+		pp->SetContext(channel);
+		pp->SetData('DATA', sizeof(payload), payload);
+
+		pServer->SendPacket(pp);
+		published++;
+	}
+
+	return 0;
+}
+
+DWORD WINAPI ChurnThreadProc(LPVOID param)
+{
+	size_t first = (size_t)param;
+
+	// each thread keeps to its own clients, so that a join is never undone by another thread's quit
+	while (!stop_churning)
+	{
+		for (size_t i = first; i < churners.size(); i += CHURN_THREADS)
+		{
+			if (pServer->AddListenerToChannel(channel, churners[i]->GetID()))
+				churned++;
+		}
+
+		for (size_t i = first; i < churners.size(); i += CHURN_THREADS)
+		{
+			pServer->RemoveListenerFromChannel(channel, churners[i]->GetID());
+			churned++;
+		}
+	}
+
+	return 0;
+}
+
+mqme::ICoreClient *Connect(uint16_t port, bool subscriber)
+{
+	mqme::ICoreClient *pClient = mqme::ICoreClient::NewClient();
+	if (!pClient)
+		return nullptr;
+
+	if (subscriber)
+		pClient->RegisterPacketHandler('DATA', HandleData, nullptr, mqme::HF_INLINE);
+
+	if (pClient->Connect(_T("127.0.0.1"), port))
+	{
+		for (size_t i = 0; (i < 500) && !pClient->IsConnected(); i++)
+			Sleep(10);
+
+		// the server may not have it indexed quite yet, so keep trying for a bit
+		for (size_t i = 0; subscriber && (i < 500) && pClient->IsConnected(); i++)
+		{
+			if (pServer->AddListenerToChannel(channel, pClient->GetID()))
+				return pClient;
+
+			Sleep(10);
+		}
+
+		if (!subscriber && pClient->IsConnected())
+			return pClient;
+	}
+
+	pClient->Release();
+
+	return nullptr;
+}
+
+void RunPhase(const TCHAR *name, DWORD seconds)
+{
+	uint64_t p0 = published, d0 = delivered, c0 = churned;
+	DWORD t0 = GetTickCount();
+
+	Sleep(seconds * 1000);
+
+	double secs = (double)(GetTickCount() - t0) / 1000.0;
+
+	_tprintf(_T("%-10s published %10.0f/s  delivered %10.0f/s  joins+quits %10.0f/s\n"), name,
+		(double)(published - p0) / secs, (double)(delivered - d0) / secs, (double)(churned - c0) / secs);
+}
+
+int main(int argc, char **argv)
+{
+	size_t num_subscribers = (argc > 1) ? (size_t)std::max<int>(atoi(argv[1]), 1) : DEFAULT_SUBSCRIBERS;
+	size_t num_churners = (argc > 2) ? (size_t)std::max<int>(atoi(argv[2]), 0) : DEFAULT_CHURNERS;
+	DWORD seconds = (argc > 3) ? (DWORD)std::max<int>(atoi(argv[3]), 1) : DEFAULT_SECONDS;
+	uint16_t port = (argc > 4) ? (uint16_t)atoi(argv[4]) : DEFAULT_PORT;
+
+	int ret = 1;
+
+	if (mqme::Initialize())
+	{
+		pServer = mqme::ICoreServer::NewServer();
+		if (pServer)
+		{
+			// publishing waits for the slowest subscriber rather than dropping, so that every
+			// packet can be accounted for at the end
+			pServer->SetOutboundLimits(1 << 20, 0, mqme::ICoreServer::OP_BLOCK);
+
+			if (pServer->StartListening(port))
+			{
+				std::vector<mqme::ICoreClient *> subscribers;
+
+				for (size_t i = 0; i < num_subscribers; i++)
+				{
+					mqme::ICoreClient *pClient = Connect(port, true);
+					if (pClient)
+						subscribers.push_back(pClient);
+				}
+
+				for (size_t i = 0; i < num_churners; i++)
+				{
+					mqme::ICoreClient *pClient = Connect(port, false);
+					if (pClient)
+						churners.push_back(pClient);
+				}
+
+				_tprintf(_T("%zu subscribers, %zu churning clients\n"), subscribers.size(), churners.size());
+
+				if (subscribers.size() == num_subscribers)
+				{
+					HANDLE publishers[PUBLISHER_THREADS];
+					for (size_t i = 0; i < PUBLISHER_THREADS; i++)
+						publishers[i] = CreateThread(NULL, 0, PublishThreadProc, nullptr, 0, NULL);
+
+					RunPhase(_T("steady"), seconds);
+
+					HANDLE churn[CHURN_THREADS];
+					for (size_t i = 0; i < CHURN_THREADS; i++)
+						churn[i] = CreateThread(NULL, 0, ChurnThreadProc, (LPVOID)i, 0, NULL);
+
+					RunPhase(_T("churning"), seconds);
+
+					stop_churning = true;
+					WaitForMultipleObjects(CHURN_THREADS, churn, TRUE, INFINITE);
+					for (size_t i = 0; i < CHURN_THREADS; i++)
+						CloseHandle(churn[i]);
+
+					stop_publishing = true;
+					WaitForMultipleObjects(PUBLISHER_THREADS, publishers, TRUE, INFINITE);
+					for (size_t i = 0; i < PUBLISHER_THREADS; i++)
+						CloseHandle(publishers[i]);
+
+					// let what's still in flight arrive
+					uint64_t expected = published * subscribers.size();
+					for (size_t i = 0; (i < 1000) && (delivered < expected); i++)
+						Sleep(10);
+
+					if (delivered == expected)
+					{
+						_tprintf(_T("PASSED: all %llu packets reached all %zu subscribers\n"), (unsigned long long)published.load(), subscribers.size());
+						ret = 0;
+					}
+					else
+					{
+						_tprintf(_T("FAILED: %llu of %llu deliveries arrived\n"), (unsigned long long)delivered.load(), (unsigned long long)expected);
+					}
+				}
+				else
+				{
+					_tprintf(_T("FAILED: couldn't connect all of the subscribers\n"));
+				}
+
+				for (auto c : churners)
+					c->Release();
+
+				for (auto s : subscribers)
+					s->Release();
+
+				pServer->StopListening();
+			}
+			else
+			{
+				_tprintf(_T("couldn't listen on port %u\n"), port);
+			}
+
+			pServer->Release();
+		}
+
+		mqme::Close();
+	}
+
+	return ret;
+}
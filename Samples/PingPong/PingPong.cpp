@@ -0,0 +1,169 @@
+// PingPong.cpp : Measures request/response latency between a client and a server over loopback.
+//
+// Usage: PingPong [rounds] [port]
+//
+// The client sends a 'PING', the server sends the same bytes straight back as a 'PONG', and the
+// round trip is timed - first with the client's send thread doing the writes, then with
+// SetDirectSend writing from the caller - so the two can be compared.
+
+#include "stdafx.h"
+#include <mqme.h>
+#include <vector>
+#include <algorithm>
+
+#define DEFAULT_ROUNDS		100000
+#define WARMUP_ROUNDS		1000
+#define DEFAULT_PORT		12346
+#define PAYLOAD_SIZE		32
+
+HANDLE hPong;
+LARGE_INTEGER freq;
+
+bool HandlePing(mqme::ICoreServer *server, mqme::ICorePacket *packet, LPVOID userdata)
+{
+	mqme::ICorePacket *pp = mqme::ICorePacket::NewPacket(packet->GetDataLength());
+	if (pp)
+	{
+		pp->SetContext(packet->GetSender());
+		pp->SetData('PONG', packet->GetDataLength(), packet->GetData());
+		server->SendPacket(pp);
+	}
+
+	return true;
+}
+
+bool HandlePong(mqme::ICoreClient *client, mqme::ICorePacket *packet, LPVOID userdata)
+{
+	SetEvent(hPong);
+
+	return true;
+}
+
+// runs the given number of round trips, returning how long each took in microseconds
+void RunRounds(mqme::ICoreClient *client, size_t rounds, std::vector<double> &times)
+{
+	BYTE payload[PAYLOAD_SIZE];
+	memset(payload, 0, sizeof(payload));
+
+	times.clear();
+	times.reserve(rounds);
+
+	for (size_t i = 0; i < rounds; i++)
+	{
+		mqme::ICorePacket *pp = mqme::ICorePacket::NewPacket(sizeof(payload));
+		if (!pp)
+			break;
+
+		memcpy(payload, &i, sizeof(i));
+		pp->SetData('PING', sizeof(payload), payload);
+
+		LARGE_INTEGER t0, t1;
+		QueryPerformanceCounter(&t0);
+
+		if (!client->SendPacket(pp))
+			break;
+
+		WaitForSingleObject(hPong, INFINITE);
+
+		QueryPerformanceCounter(&t1);
+
+		times.push_back((double)(t1.QuadPart - t0.QuadPart) * 1000000.0 / (double)freq.QuadPart);
+	}
+}
+
+void Report(const TCHAR *name, std::vector<double> &times)
+{
+	if (times.empty())
+	{
+		_tprintf(_T("%-12s no round trips completed\n"), name);
+		return;
+	}
+
+	std::sort(times.begin(), times.end());
+
+	double total = 0;
+	for (auto t : times)
+		total += t;
+
+	size_t n = times.size();
+
+	_tprintf(_T("%-12s %8zu rounds  avg %8.2f  min %8.2f  p50 %8.2f  p99 %8.2f  p99.9 %8.2f  max %8.2f us\n"), name, n,
+		total / (double)n, times[0], times[n / 2], times[std::min<size_t>((n * 99) / 100, n - 1)],
+		times[std::min<size_t>((n * 999) / 1000, n - 1)], times[n - 1]);
+}
+
+bool Measure(const TCHAR *name, bool direct, uint16_t port, size_t rounds)
+{
+	mqme::ICoreClient *pClient = mqme::ICoreClient::NewClient();
+	if (!pClient)
+		return false;
+
+	pClient->RegisterPacketHandler('PONG', HandlePong, nullptr, mqme::HF_INLINE);
+	pClient->SetDirectSend(direct);
+
+	bool ret = false;
+
+	if (pClient->Connect(_T("127.0.0.1"), port))
+	{
+		for (size_t i = 0; (i < 500) && !pClient->IsConnected(); i++)
+			Sleep(10);
+
+		if (pClient->IsConnected())
+		{
+			std::vector<double> times;
+
+			RunRounds(pClient, WARMUP_ROUNDS, times);
+			RunRounds(pClient, rounds, times);
+
+			Report(name, times);
+
+			ret = true;
+		}
+
+		pClient->Disconnect();
+	}
+
+	pClient->Release();
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t rounds = (argc > 1) ? (size_t)std::max<int>(atoi(argv[1]), 1) : DEFAULT_ROUNDS;
+	uint16_t port = (argc > 2) ? (uint16_t)atoi(argv[2]) : DEFAULT_PORT;
+
+	QueryPerformanceFrequency(&freq);
+	hPong = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	if (mqme::Initialize())
+	{
+		mqme::ICoreServer *pServer = mqme::ICoreServer::NewServer();
+		if (pServer)
+		{
+			// the reply goes out right from the thread that read the request, so that what's
+			// measured is the trip through the library rather than a worker hand-off
+			pServer->RegisterPacketHandler('PING', HandlePing, nullptr, mqme::HF_INLINE);
+
+			if (pServer->StartListening(port))
+			{
+				if (!Measure(_T("queued"), false, port, rounds) || !Measure(_T("direct"), true, port, rounds))
+					_tprintf(_T("couldn't connect to the server on port %u\n"), port);
+
+				pServer->StopListening();
+			}
+			else
+			{
+				_tprintf(_T("couldn't listen on port %u\n"), port);
+			}
+
+			pServer->Release();
+		}
+
+		mqme::Close();
+	}
+
+	CloseHandle(hPong);
+
+	return 0;
+}
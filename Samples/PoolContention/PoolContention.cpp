@@ -0,0 +1,116 @@
+// PoolContention.cpp : Measures how fast threads can get packets from, and give them back to, the pool.
+//
+// Usage: PoolContention [max threads] [milliseconds per run]
+//
+// Each thread repeatedly takes a burst of packets with NewPacket and then releases them all, the
+// way a receive thread or a worker does. This is timed for 1, 2, 4... threads, once with the
+// per-thread packet caches turned off (every call goes to the shared pool) and once with them on.
+
+#include "stdafx.h"
+#include <mqme.h>
+#include <atomic>
+#include <algorithm>
+
+#define DEFAULT_DURATION_MS		2000
+#define BURST_SIZE				16
+#define PACKET_SIZE				256
+#define MAX_THREADS				64
+
+std::atomic<bool> go, stop;
+
+DWORD WINAPI PacketThreadProc(LPVOID param)
+{
+	uint64_t *count = (uint64_t *)param;
+	mqme::ICorePacket *burst[BURST_SIZE];
+
+	while (!go)
+		SwitchToThread();
+
+	uint64_t n = 0;
+	while (!stop)
+	{
+		for (size_t i = 0; i < BURST_SIZE; i++)
+			burst[i] = mqme::ICorePacket::NewPacket(PACKET_SIZE);
+
+		for (size_t i = 0; i < BURST_SIZE; i++)
+		{
+			if (burst[i])
+				burst[i]->Release();
+		}
+
+		n += BURST_SIZE;
+	}
+
+	*count = n;
+
+	return 0;
+}
+
+// returns how many packets per second the given number of threads got through, between them
+double Measure(size_t threads, DWORD duration_ms)
+{
+	HANDLE th[MAX_THREADS];
+	uint64_t counts[MAX_THREADS];
+
+	go = false;
+	stop = false;
+
+	for (size_t i = 0; i < threads; i++)
+	{
+		counts[i] = 0;
+		th[i] = CreateThread(NULL, 0, PacketThreadProc, &counts[i], 0, NULL);
+	}
+
+	LARGE_INTEGER freq, t0, t1;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t0);
+
+	go = true;
+	Sleep(duration_ms);
+	stop = true;
+
+	WaitForMultipleObjects((DWORD)threads, th, TRUE, INFINITE);
+
+	QueryPerformanceCounter(&t1);
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < threads; i++)
+	{
+		total += counts[i];
+		CloseHandle(th[i]);
+	}
+
+	return (double)total * (double)freq.QuadPart / (double)(t1.QuadPart - t0.QuadPart);
+}
+
+int main(int argc, char **argv)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+
+	size_t max_threads = (argc > 1) ? (size_t)std::max<int>(atoi(argv[1]), 1) : (size_t)si.dwNumberOfProcessors;
+	max_threads = std::min<size_t>(max_threads, MAX_THREADS);
+	DWORD duration_ms = (argc > 2) ? (DWORD)std::max<int>(atoi(argv[2]), 1) : DEFAULT_DURATION_MS;
+
+	_tprintf(_T("threads   shared pool (packets/s)   per-thread caches (packets/s)   speedup\n"));
+
+	for (size_t threads = 1; threads <= max_threads; threads = (threads < max_threads) ? std::min<size_t>(threads * 2, max_threads) : (max_threads + 1))
+	{
+		double rate[2] = { 0, 0 };
+
+		// each run gets a fresh pool, so that one doesn't start out with the other's leftovers
+		for (size_t cached = 0; cached < 2; cached++)
+		{
+			if (!mqme::Initialize(256, PACKET_SIZE, 1, -2, cached ? 64 : 0))
+				return 1;
+
+			rate[cached] = Measure(threads, duration_ms);
+
+			mqme::Close();
+		}
+
+		_tprintf(_T("%7zu   %23.0f   %29.0f   %6.2fx\n"), threads, rate[0], rate[1], rate[0] ? (rate[1] / rate[0]) : 0.0);
+	}
+
+	return 0;
+}
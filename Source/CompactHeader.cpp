@@ -0,0 +1,178 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "CompactHeader.h"
+
+
+uint32_t WriteVarint(uint32_t val, BYTE *out)
+{
+	uint32_t ret = 0;
+
+	while (val >= 0x80)
+	{
+		out[ret++] = (BYTE)(val | 0x80);
+		val >>= 7;
+	}
+
+	out[ret++] = (BYTE)val;
+
+	return ret;
+}
+
+
+bool ReadVarint(const BYTE *&in, const BYTE *end, uint32_t *val)
+{
+	uint32_t ret = 0;
+
+	for (uint32_t shift = 0; shift < 35; shift += 7)
+	{
+		if (in >= end)
+			return false;
+
+		BYTE b = *(in++);
+		ret |= (uint32_t)(b & 0x7F) << shift;
+
+		if (!(b & 0x80))
+		{
+			*val = ret;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+uint32_t CCompactHeaderEncoder::Encode(const SPacketHeader *hdr, BYTE *out, bool *defined)
+{
+	uint32_t len = 1;
+	bool def = false;
+
+	memcpy(out + len, &hdr->m_ID, sizeof(FOURCHARCODE));
+	len += sizeof(FOURCHARCODE);
+
+	len += EncodeGUID(hdr->m_Sender, out + len, def);
+	len += EncodeGUID(hdr->m_Context, out + len, def);
+	len += WriteVarint(hdr->m_DataLength, out + len);
+
+	out[0] = (BYTE)(len - 1);
+
+	if (defined)
+		*defined = def;
+
+	return len;
+}
+
+
+uint32_t CCompactHeaderEncoder::EncodeGUID(const GUID &id, BYTE *out, bool &defined)
+{
+	uint32_t known = m_Handles.Find(id);
+	if (known != GUIDINDEX_NONE)
+		return WriteVarint(known << 1, out);
+
+	// first time we've seen this GUID, so give it a handle - taking one back from an older
+	// GUID if we've run out
+	uint32_t h;
+	if (m_GUIDs.size() < MAX_COMPACT_HANDLES)
+	{
+		h = (uint32_t)m_GUIDs.size();
+		m_GUIDs.push_back(id);
+	}
+	else
+	{
+		h = m_NextEvict;
+		m_NextEvict = (m_NextEvict + 1) % MAX_COMPACT_HANDLES;
+
+		m_Handles.Erase(m_GUIDs[h]);
+		m_GUIDs[h] = id;
+	}
+
+	m_Handles.Insert(id, h);
+
+	defined = true;
+
+	uint32_t ret = WriteVarint((h << 1) | 1, out);
+	memcpy(out + ret, &id, sizeof(GUID));
+
+	return ret + sizeof(GUID);
+}
+
+
+bool CCompactHeaderDecoder::Decode(const BYTE *in, uint32_t len, SPacketHeader *hdr)
+{
+	const BYTE *end = in + len;
+
+	if (len < sizeof(FOURCHARCODE))
+		return false;
+
+	memcpy(&hdr->m_ID, in, sizeof(FOURCHARCODE));
+	in += sizeof(FOURCHARCODE);
+
+	if (!DecodeGUID(in, end, &hdr->m_Sender) || !DecodeGUID(in, end, &hdr->m_Context))
+		return false;
+
+	return ReadVarint(in, end, &hdr->m_DataLength) && (in == end);
+}
+
+
+bool CCompactHeaderDecoder::DecodeGUID(const BYTE *&in, const BYTE *end, GUID *id)
+{
+	uint32_t ref;
+	if (!ReadVarint(in, end, &ref))
+		return false;
+
+	uint32_t h = ref >> 1;
+	if (h >= MAX_COMPACT_HANDLES)
+		return false;
+
+	if (ref & 1)
+	{
+		if ((end - in) < (ptrdiff_t)sizeof(GUID))
+			return false;
+
+		if (h >= m_GUIDs.size())
+			m_GUIDs.resize(h + 1);
+
+		memcpy(&m_GUIDs[h], in, sizeof(GUID));
+		in += sizeof(GUID);
+	}
+	else if (h >= m_GUIDs.size())
+	{
+		return false;
+	}
+
+	*id = m_GUIDs[h];
+
+	return true;
+}
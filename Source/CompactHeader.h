@@ -0,0 +1,117 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "GUIDIndex.h"
+#include <vector>
+
+// Compact headers are negotiated per connection and per direction with PACKETID_HEADERMODE
+// packets, which are always sent in the full header format. Their data is a single byte of
+// HEADERMODE_ flags:
+//
+//	HEADERMODE_COMPACT		the sender understands compact headers
+//	HEADERMODE_SWITCHING	every packet the sender sends after this one has a compact header
+//
+// The client offers (COMPACT); a server that agrees answers with (COMPACT | SWITCHING), and the
+// client then follows with (COMPACT | SWITCHING) of its own. Peers that don't know about
+// compact headers never answer, so both sides keep using the full format.
+//
+// A compact header is:
+//
+//	BYTE		the number of header bytes that follow
+//	FOURCC		packet id
+//	varint		sender reference
+//	varint		context reference
+//	varint		data length
+//
+// A GUID reference is (handle << 1) | define. If define is set, the 16 byte GUID follows and
+// is bound to the handle from then on; otherwise the handle refers to an earlier definition.
+
+// reserved packet id ('\1HDR') for header format negotiation
+#define PACKETID_HEADERMODE		0x01484452
+
+#define HEADERMODE_COMPACT		0x01
+#define HEADERMODE_SWITCHING	0x02
+
+// the most bytes a compact header can take, including the leading length byte
+#define MAX_COMPACT_HEADER		(1 + sizeof(FOURCHARCODE) + ((5 + sizeof(GUID)) * 2) + 5)
+
+// the most GUIDs that are interned per connection and direction; after that, handles are reused
+#define MAX_COMPACT_HANDLES		4096
+
+// how many GUIDs an encoder has room for before its index has to grow; there's one per connection,
+// so they start small
+#define COMPACT_INDEX_SIZE		64
+
+
+// writes the compact headers for one connection's outgoing packets
+class CCompactHeaderEncoder
+{
+public:
+	CCompactHeaderEncoder() : m_Handles(COMPACT_INDEX_SIZE) { m_NextEvict = 0; }
+
+	// writes the compact form of hdr to out, which must have room for MAX_COMPACT_HEADER bytes;
+	// returns the number of bytes written. defined is set if the header binds a new handle, in which
+	// case the headers after it can't be understood without it
+	uint32_t Encode(const SPacketHeader *hdr, BYTE *out, bool *defined = nullptr);
+
+protected:
+	uint32_t EncodeGUID(const GUID &id, BYTE *out, bool &defined);
+
+	// GUID -> handle
+	CGUIDIndex m_Handles;
+
+	std::vector<GUID> m_GUIDs;
+
+	uint32_t m_NextEvict;
+};
+
+
+// reads the compact headers of one connection's incoming packets
+class CCompactHeaderDecoder
+{
+public:
+	// parses the header bytes that follow the length byte into hdr; returns false if they're malformed
+	bool Decode(const BYTE *in, uint32_t len, SPacketHeader *hdr);
+
+protected:
+	bool DecodeGUID(const BYTE *&in, const BYTE *end, GUID *id);
+
+	std::vector<GUID> m_GUIDs;
+};
+
+
+// little-endian base 128 encoding, 7 bits per byte
+uint32_t WriteVarint(uint32_t val, BYTE *out);
+bool ReadVarint(const BYTE *&in, const BYTE *end, uint32_t *val);
@@ -0,0 +1,357 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "Compression.h"
+#include "CompactHeader.h"
+
+#define LZ_MIN_MATCH		4
+#define LZ_MAX_OFFSET		0xFFFF
+#define LZ_HASH_BITS		12
+
+
+static inline uint32_t Read32(const BYTE *p)
+{
+	uint32_t ret;
+	memcpy(&ret, p, sizeof(uint32_t));
+	return ret;
+}
+
+
+static inline uint32_t Hash32(uint32_t seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+
+// writes a nibble's overflow as 255s followed by the remainder
+static inline bool WriteLength(uint32_t len, BYTE *dst, uint32_t dstcap, uint32_t &out)
+{
+	while (len >= 255)
+	{
+		if (out >= dstcap)
+			return false;
+
+		dst[out++] = 255;
+		len -= 255;
+	}
+
+	if (out >= dstcap)
+		return false;
+
+	dst[out++] = (BYTE)len;
+
+	return true;
+}
+
+
+static inline bool ReadLength(const BYTE *src, uint32_t srclen, uint32_t &in, uint32_t &len, uint32_t limit)
+{
+	BYTE b;
+	do
+	{
+		if (in >= srclen)
+			return false;
+
+		b = src[in++];
+		len += b;
+
+		// no valid stream has a length longer than the output
+		if (len > limit)
+			return false;
+	}
+	while (b == 255);
+
+	return true;
+}
+
+
+static bool EmitSequence(BYTE *dst, uint32_t dstcap, uint32_t &out, const BYTE *lit, uint32_t litlen, uint32_t offset, uint32_t matchlen)
+{
+	if (out >= dstcap)
+		return false;
+
+	uint32_t m = matchlen ? (matchlen - LZ_MIN_MATCH) : 0;
+
+	dst[out++] = (BYTE)((std::min<uint32_t>(litlen, 15) << 4) | std::min<uint32_t>(m, 15));
+
+	if ((litlen >= 15) && !WriteLength(litlen - 15, dst, dstcap, out))
+		return false;
+
+	if ((dstcap - out) < litlen)
+		return false;
+
+	memcpy(dst + out, lit, litlen);
+	out += litlen;
+
+	// the last sequence is literals only
+	if (!matchlen)
+		return true;
+
+	if ((dstcap - out) < sizeof(uint16_t))
+		return false;
+
+	dst[out++] = (BYTE)(offset & 0xFF);
+	dst[out++] = (BYTE)(offset >> 8);
+
+	if ((m >= 15) && !WriteLength(m - 15, dst, dstcap, out))
+		return false;
+
+	return true;
+}
+
+
+uint32_t LZCompress(const BYTE *src, uint32_t srclen, BYTE *dst, uint32_t dstcap)
+{
+	// positions (plus one, so that zero means empty) of recently seen 4 byte sequences
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint32_t ip = 0, anchor = 0, out = 0;
+
+	while ((srclen >= LZ_MIN_MATCH) && (ip <= (srclen - LZ_MIN_MATCH)))
+	{
+		uint32_t seq = Read32(src + ip);
+		uint32_t h = Hash32(seq);
+
+		uint32_t cand = table[h];
+		table[h] = ip + 1;
+
+		if (cand && ((ip - (cand - 1)) <= LZ_MAX_OFFSET) && (Read32(src + cand - 1) == seq))
+		{
+			uint32_t mpos = cand - 1;
+			uint32_t mlen = LZ_MIN_MATCH;
+			while (((ip + mlen) < srclen) && (src[mpos + mlen] == src[ip + mlen]))
+				mlen++;
+
+			if (!EmitSequence(dst, dstcap, out, src + anchor, ip - anchor, ip - mpos, mlen))
+				return 0;
+
+			ip += mlen;
+			anchor = ip;
+		}
+		else
+		{
+			ip++;
+		}
+	}
+
+	if (!EmitSequence(dst, dstcap, out, src + anchor, srclen - anchor, 0, 0))
+		return 0;
+
+	return out;
+}
+
+
+bool LZDecompress(const BYTE *src, uint32_t srclen, BYTE *dst, uint32_t dstlen)
+{
+	uint32_t in = 0, out = 0;
+
+	while (in < srclen)
+	{
+		BYTE token = src[in++];
+
+		uint32_t litlen = token >> 4;
+		if ((litlen == 15) && !ReadLength(src, srclen, in, litlen, dstlen))
+			return false;
+
+		if (((srclen - in) < litlen) || ((dstlen - out) < litlen))
+			return false;
+
+		memcpy(dst + out, src + in, litlen);
+		in += litlen;
+		out += litlen;
+
+		// the last sequence has no match
+		if (in == srclen)
+			break;
+
+		if ((srclen - in) < sizeof(uint16_t))
+			return false;
+
+		uint32_t offset = (uint32_t)src[in] | ((uint32_t)src[in + 1] << 8);
+		in += sizeof(uint16_t);
+
+		if (!offset || (offset > out))
+			return false;
+
+		uint32_t mlen = token & 0xF;
+		if ((mlen == 15) && !ReadLength(src, srclen, in, mlen, dstlen))
+			return false;
+		mlen += LZ_MIN_MATCH;
+
+		if ((dstlen - out) < mlen)
+			return false;
+
+		// matches may overlap what they're writing, so this goes a byte at a time
+		const BYTE *m = dst + out - offset;
+		for (uint32_t i = 0; i < mlen; i++)
+			dst[out + i] = m[i];
+		out += mlen;
+	}
+
+	return (out == dstlen);
+}
+
+
+CPacket *CompressPacket(CPacket *ppkt)
+{
+	uint32_t len = ppkt->GetDataLength();
+	if (ppkt->IsCompressed() || (len <= sizeof(uint32_t)))
+		return nullptr;
+
+	// it's only worth it if the result, length prefix included, is smaller than what we started with
+	CPacket *ret = (CPacket *)ICorePacket::NewPacket(len);
+	if (!ret)
+		return nullptr;
+
+	ret->BeginData(ppkt->GetID(), len);
+
+	BYTE *out = ret->Reserve(len);
+	memcpy(out, &len, sizeof(uint32_t));
+
+	uint32_t clen = LZCompress(ppkt->GetData(), len, out + sizeof(uint32_t), len - sizeof(uint32_t) - 1);
+	if (!clen)
+	{
+		ret->Release();
+		return nullptr;
+	}
+
+	ret->Commit(sizeof(uint32_t) + clen);
+	ret->SetContext(ppkt->GetContext());
+	ret->SetSender(ppkt->GetSender());
+	ret->SetCompressed(true);
+
+	return ret;
+}
+
+
+CPacket *DecompressPacket(CPacket *ppkt)
+{
+	if (!ppkt || !ppkt->IsCompressed())
+		return ppkt;
+
+	CPacket *ret = nullptr;
+
+	uint32_t clen = ppkt->GetDataLength();
+	if (clen >= sizeof(uint32_t))
+	{
+		uint32_t len;
+		memcpy(&len, ppkt->GetData(), sizeof(uint32_t));
+
+		// a few bytes can't honestly claim to be a few gigabytes
+		uint64_t most = (uint64_t)(clen - sizeof(uint32_t)) * LZ_MAX_EXPANSION;
+
+		ret = ((len <= COMPRESSION_MAX_LENGTH) && (len <= most)) ? (CPacket *)ICorePacket::NewPacket(len) : nullptr;
+		if (ret)
+		{
+			ret->SetData(ppkt->GetID(), len, NULL);
+			ret->SetContext(ppkt->GetContext());
+			ret->SetSender(ppkt->GetSender());
+
+			if (!LZDecompress(ppkt->GetData() + sizeof(uint32_t), clen - sizeof(uint32_t), ret->GetData(), len))
+			{
+				ret->Release();
+				ret = nullptr;
+			}
+		}
+	}
+
+	ppkt->Release();
+
+	return ret;
+}
+
+
+void CCompressionRules::SetForID(FOURCHARCODE id, uint32_t min_size)
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	if (min_size)
+		m_IDRules[id] = min_size;
+	else
+		m_IDRules.erase(id);
+
+	m_RuleCount = m_IDRules.size() + m_ChannelRules.size();
+}
+
+
+void CCompressionRules::SetForChannel(GUID channel, uint32_t min_size)
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	if (min_size)
+		m_ChannelRules[channel] = min_size;
+	else
+		m_ChannelRules.erase(channel);
+
+	m_RuleCount = m_IDRules.size() + m_ChannelRules.size();
+}
+
+
+CPacket *CCompressionRules::Apply(CPacket *ppkt)
+{
+	if (!m_RuleCount || !ppkt || ppkt->IsCompressed())
+		return ppkt;
+
+	// pieces of large messages were compressed (or not) as a whole, and header negotiation
+	// has to stay readable by peers that don't know about any of this
+	FOURCHARCODE id = ppkt->GetID();
+	if ((id == PACKETID_FRAGMENT) || (id == PACKETID_HEADERMODE))
+		return ppkt;
+
+	uint32_t min_size = UINT32_MAX;
+
+	{
+		std::lock_guard<std::mutex> l(m_Lock);
+
+		TIDRuleMap::const_iterator iit = m_IDRules.find(id);
+		if (iit != m_IDRules.end())
+			min_size = iit->second;
+
+		TChannelRuleMap::const_iterator cit = m_ChannelRules.find(ppkt->GetContext());
+		if (cit != m_ChannelRules.end())
+			min_size = std::min<uint32_t>(min_size, cit->second);
+	}
+
+	if (ppkt->GetDataLength() < min_size)
+		return ppkt;
+
+	CPacket *ret = CompressPacket(ppkt);
+	if (!ret)
+		return ppkt;
+
+	ppkt->Release();
+
+	return ret;
+}
@@ -0,0 +1,100 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "Fragment.h"
+#include <map>
+#include <mutex>
+#include <atomic>
+
+// Compressed packets have PACKETFLAG_COMPRESSED set in their data length. Their data is the
+// uncompressed length (uint32_t) followed by an LZ77 stream in the style of LZ4: a series of
+// sequences, each of which is
+//
+//	BYTE		token; the high nibble is the literal count, the low nibble the match length - 4
+//	BYTE[]		more literal count, if the nibble was 15 (255s, then the remainder)
+//	BYTE[]		the literals
+//	uint16_t	how far back the match starts
+//	BYTE[]		more match length, if the nibble was 15
+//
+// The last sequence has only literals; the stream ends after them.
+
+// no stream decompresses to more than LZ_MAX_EXPANSION times its own length (each byte of a match's
+// length adds at most 255), and no compressed packet may hold more than a message sent in pieces
+// could; since the uncompressed length comes off the wire, both are checked before it's allocated
+#define LZ_MAX_EXPANSION			255
+#define COMPRESSION_MAX_LENGTH		FRAGMENT_MAX_MESSAGE_SIZE
+
+// compresses src into dst; returns the compressed length, or 0 if it wouldn't fit in dstcap bytes
+uint32_t LZCompress(const BYTE *src, uint32_t srclen, BYTE *dst, uint32_t dstcap);
+
+// decompresses src into dst, which must be exactly dstlen bytes; returns false if src is malformed
+bool LZDecompress(const BYTE *src, uint32_t srclen, BYTE *dst, uint32_t dstlen);
+
+// returns a compressed copy of ppkt (holding one reference that belongs to the caller), or
+// nullptr if compressing wouldn't make it any smaller
+CPacket *CompressPacket(CPacket *ppkt);
+
+// takes the caller's reference to ppkt and returns a reference to its decompressed copy instead,
+// or nullptr if it's malformed or claims to be too big. Packets that aren't compressed are returned as they are
+CPacket *DecompressPacket(CPacket *ppkt);
+
+
+// CCompressionRules decides which outgoing packets are worth compressing, by id and by channel
+class CCompressionRules
+{
+public:
+	CCompressionRules() { m_RuleCount = 0; }
+
+	// packets with the given id and at least min_size bytes of data are compressed; 0 removes the rule
+	void SetForID(FOURCHARCODE id, uint32_t min_size);
+
+	// packets sent to the given channel with at least min_size bytes of data are compressed; 0 removes the rule
+	void SetForChannel(GUID channel, uint32_t min_size);
+
+	// takes the caller's reference to ppkt and returns the packet that should be sent in its place
+	CPacket *Apply(CPacket *ppkt);
+
+protected:
+	typedef std::map<FOURCHARCODE, uint32_t> TIDRuleMap;
+	TIDRuleMap m_IDRules;
+
+	typedef std::map<GUID, uint32_t, GUIDComparer> TChannelRuleMap;
+	TChannelRuleMap m_ChannelRules;
+
+	std::mutex m_Lock;
+
+	// lets the send threads skip the lock entirely when compression isn't being used
+	std::atomic<size_t> m_RuleCount;
+};
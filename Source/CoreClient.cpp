@@ -39,9 +39,15 @@
 
 #include "Packet.h"
 #include "PacketQueue.h"
-#include <Pool.h>
-
-extern pool::IThreadPool *g_ThreadPool;
+#include "Fragment.h"
+#include "CompactHeader.h"
+#include "Compression.h"
+#include "SendBatch.h"
+#include "FrameReader.h"
+#include "DispatchTable.h"
+#include "Executor.h"
+
+extern CExecutor *g_ThreadPool;
 extern bool g_Initialized;
 
 class CCoreClient: public mqme::ICoreClient
@@ -57,26 +63,27 @@ protected:
 	HANDLE m_WSEvent;
 	HANDLE m_QuitEvent;
 
+	// set whenever there's something for the send thread to do
+	HANDLE m_SendEvent;
+
+	// held by whoever is writing to the socket - the send thread, or a caller sending directly
+	std::mutex m_SendLock;
+	bool m_DirectSend;
+
 	tstring m_ServerAddr;
 	uint16_t m_ServerPort;
 
 	CPacketQueue m_InPackets;
 	CPacketQueue m_OutPackets;
 
-	bool m_Connected;
-
-	typedef struct sPacketHandlerCallInfo
-	{
-		sPacketHandlerCallInfo(PACKET_HANDLER _func, LPVOID _userdata) { func = _func; userdata = _userdata; }
-
-		PACKET_HANDLER func;
-		LPVOID userdata;
-	} SPacketHandlerCallInfo;
+	// set by PrivateConnect once the server has our GUID; until then, everything sent waits in m_OutPackets
+	std::atomic<bool> m_Connected;
 
-	typedef std::map< FOURCHARCODE, SPacketHandlerCallInfo > TPacketHandlerMap;
-	typedef std::pair< FOURCHARCODE, SPacketHandlerCallInfo > TPacketHandlerPair;
+	// packet and stream handlers; what's found for a packet goes to the worker along with it
+	CDispatchTable m_Handlers;
 
-	TPacketHandlerMap m_PacketHandlerMap;
+	// what the receive thread has read for batch handlers
+	SBatches m_Batches;
 
 	typedef struct sEventHandlerCallInfo
 	{
@@ -93,8 +100,39 @@ protected:
 
 	GUID m_GUID;
 
+	// pieces of large messages coming in
+	CFragmentAssembler m_Assembler;
+
+	uint32_t m_MaxChunkSize;
+	uint32_t m_NextMessageID;
+
+	// whether we offer compact headers to the server, and the state for each direction once
+	// they've been negotiated
+	bool m_CompactHeaders;
+	CCompactHeaderEncoder *m_Encoder;
+	CCompactHeaderDecoder *m_Decoder;
+
+	// which of the packets we send get compressed
+	CCompressionRules m_Compression;
+
+	// whether we tell the server which packet ids we have handlers for when we connect, and
+	// whether we have on this connection (so that it's told again when there are more)
+	bool m_AdvertiseHandlers;
+	bool m_Advertised;
+
+	// what has arrived from the server that hasn't been made into packets yet
+	CFrameReader m_Reader;
+
+	// packets waiting to go out in one write, and how long a partial batch may wait for more
+	CSendBatch m_Batch;
+	uint32_t m_FlushDelay;
+
+	// set when the socket wouldn't take everything; the receive thread wakes the send thread to try
+	// again once it has room
+	std::atomic<bool> m_SendBlocked;
+
 public:
-	CCoreClient()
+	CCoreClient() : m_Handlers(this), m_Batches(0, ProcessBatch)
 	{
 		m_Socket = INVALID_SOCKET;
 		m_ServerAddr = _T("127.0.0.1");
@@ -102,6 +140,8 @@ public:
 
 		m_WSEvent = WSACreateEvent();
 		m_QuitEvent = WSACreateEvent();
+		m_SendEvent = WSACreateEvent();
+		m_DirectSend = false;
 
 		m_RecvThread = NULL;
 		m_RecvThreadId = 0;
@@ -111,6 +151,19 @@ public:
 
 		m_Connected = false;
 
+		m_MaxChunkSize = 0;
+		m_NextMessageID = 0;
+
+		m_CompactHeaders = true;
+		m_Encoder = NULL;
+		m_Decoder = NULL;
+
+		m_AdvertiseHandlers = false;
+		m_Advertised = false;
+
+		m_FlushDelay = 0;
+		m_SendBlocked = false;
+
 		CoCreateGuid(&m_GUID);
 	}
 
@@ -120,6 +173,7 @@ public:
 		Disconnect();
 		CloseHandle(m_WSEvent);
 		CloseHandle(m_QuitEvent);
+		CloseHandle(m_SendEvent);
 	}
 
 	// Releases the client, implicitly calling Disconnect
@@ -196,7 +250,7 @@ public:
 					}
 				}
 
-				WSAEventSelect(m_Socket, m_WSEvent, FD_CLOSE | FD_READ | FD_CONNECT);
+				WSAEventSelect(m_Socket, m_WSEvent, FD_CLOSE | FD_READ | FD_CONNECT | FD_WRITE);
 
 				if (!m_SendThread)
 				{
@@ -246,6 +300,18 @@ public:
 
 		FlushOutgoingPackets();
 
+		m_Assembler.Clear();
+		m_Reader.Clear();
+		m_Advertised = false;
+		m_Batch.Clear();
+		m_SendBlocked = false;
+
+		// the next connection starts over with full headers
+		delete m_Encoder;
+		m_Encoder = NULL;
+		delete m_Decoder;
+		m_Decoder = NULL;
+
 		m_Connected = false;
 	}
 
@@ -262,8 +328,20 @@ public:
 		CPacket *p = dynamic_cast<CPacket *>(packet);
 		if (p)
 		{
-			p->IncRef();
+			// if nothing is waiting ahead of it and nobody else is writing, send it from here
+			if (m_DirectSend && m_Connected && m_OutPackets.Empty() && m_SendLock.try_lock())
+			{
+				bool sent = m_OutPackets.Empty() && SendDirect(p);
+
+				m_SendLock.unlock();
+
+				if (sent)
+					return true;
+			}
+
+			// the caller's reference is handed over to the send thread
 			m_OutPackets.Enque(p);
+			WSASetEvent(m_SendEvent);
 
 			return true;
 		}
@@ -275,13 +353,89 @@ public:
 	// Registers an incoming packet handling callback with the client.
 	// When a packet with the given id arrives, this callback
 	// will be executed.
-	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr)
+	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0)
 	{
-		TPacketHandlerMap::const_iterator cit = m_PacketHandlerMap.find(id);
-		if (cit == m_PacketHandlerMap.end())
-		{
-			m_PacketHandlerMap.insert(TPacketHandlerPair(id, SPacketHandlerCallInfo(handler, userdata)));
-		}
+		m_Handlers.AddPacketHandler(id, (void *)handler, userdata, flags);
+
+		if (m_Advertised)
+			AdvertiseHandlers();
+	}
+
+	// Registers a callback that receives large messages with the given id piece by piece
+	virtual void RegisterStreamHandler(FOURCHARCODE id, STREAM_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0)
+	{
+		m_Handlers.AddStreamHandler(id, (void *)handler, userdata, flags);
+
+		if (m_Advertised)
+			AdvertiseHandlers();
+	}
+
+	// Registers a callback that's given the packets with the given id several at a time
+	virtual void RegisterBatchHandler(FOURCHARCODE id, BATCH_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0, uint32_t max_count = 0, uint32_t max_delay_us = 0)
+	{
+		m_Handlers.AddBatchHandler(id, (void *)handler, userdata, flags, max_count, max_delay_us);
+
+		if (m_Advertised)
+			AdvertiseHandlers();
+	}
+
+	// Registers a callback for every packet whose id has no handlers of its own
+	virtual void RegisterDefaultHandler(PACKET_HANDLER handler, LPVOID userdata = nullptr, uint32_t flags = 0)
+	{
+		m_Handlers.AddDefaultHandler((void *)handler, userdata, flags);
+
+		if (m_Advertised)
+			AdvertiseHandlers();
+	}
+
+	// Fills out how received packets have been handled so far
+	virtual void GetHandlerStats(SHandlerStats *stats)
+	{
+		if (stats)
+			m_Handlers.GetStats(stats);
+	}
+
+	// Packets with more data than this are sent in pieces
+	virtual void SetMaxChunkSize(uint32_t max_chunk_size)
+	{
+		m_MaxChunkSize = max_chunk_size;
+	}
+
+	// Offers compact headers to the server on the next Connect
+	virtual void SetCompactHeaders(bool offer)
+	{
+		m_CompactHeaders = offer;
+	}
+
+	// Compresses outgoing packets with the given id that have at least min_size bytes of data
+	virtual void SetCompression(FOURCHARCODE id, uint32_t min_size)
+	{
+		m_Compression.SetForID(id, min_size);
+	}
+
+	// Compresses outgoing packets to the given channel that have at least min_size bytes of data
+	virtual void SetChannelCompression(GUID channel, uint32_t min_size)
+	{
+		m_Compression.SetForChannel(channel, min_size);
+	}
+
+	// Sends packets from the calling thread when nothing else is waiting to go out
+	virtual void SetDirectSend(bool direct)
+	{
+		m_DirectSend = direct;
+	}
+
+	// Tells the server which packet ids we have handlers for on the next Connect
+	virtual void SetAdvertiseHandlers(bool advertise)
+	{
+		m_AdvertiseHandlers = advertise;
+	}
+
+	// Limits how much goes out in one write, and how long a partial write may wait for more
+	virtual void SetSendCoalescing(uint32_t max_bytes, uint32_t max_buffers, uint32_t flush_delay_us)
+	{
+		m_Batch.SetLimits(max_bytes, max_buffers);
+		m_FlushDelay = flush_delay_us;
 	}
 
 	// Registers an event handling callback with the client.
@@ -295,24 +449,93 @@ public:
 	}
 
 private:
-	static pool::IThreadPool::TASK_RETURN __cdecl ProcessPacket(void *param0, void *param1, size_t task_number)
+	// param0 is the SDispatchGroup whose handlers get the packet
+	static CExecutor::TASK_RETURN __cdecl ProcessPacket(void *param0, void *param1, size_t task_number)
 	{
-		CCoreClient *_this = (CCoreClient *)param0;
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreClient *_this = (CCoreClient *)g->m_Owner;
+
+		CPacket *ppkt = DecompressPacket((CPacket *)param1);
+		if (!ppkt)
+		{
+			CDispatchTable::Done(g);
+			return CExecutor::TR_OK;
+		}
+
+		for (const auto &h : g->m_Packet)
+			((PACKET_HANDLER)h.m_Func)(_this, ppkt, h.m_UserData);
+
+		// a message that arrived whole goes to the stream handlers as its only piece
+		if (g->m_Whole && !g->m_Stream.empty())
+		{
+			SStreamChunk chunk;
+			CFragmentAssembler::Describe(ppkt, &chunk);
+
+			for (const auto &h : g->m_Stream)
+				((STREAM_HANDLER)h.m_Func)(_this, &chunk, h.m_UserData);
+		}
+
+		ppkt->Release();
+
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
+	}
+
+	// param0 is the SDispatchGroup whose handlers get the piece
+	static CExecutor::TASK_RETURN __cdecl ProcessStreamChunk(void *param0, void *param1, size_t task_number)
+	{
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreClient *_this = (CCoreClient *)g->m_Owner;
 		CPacket *ppkt = (CPacket *)param1;
 
-		// look up the packet handler and call it with the appropriate parameters
-		TPacketHandlerMap::iterator it = _this->m_PacketHandlerMap.find(ppkt->GetID());
-		if (it != _this->m_PacketHandlerMap.end())
+		SStreamChunk chunk;
+		if (CFragmentAssembler::Parse(ppkt, &chunk))
 		{
-			it->second.func(_this, ppkt, it->second.userdata);
+			for (const auto &h : g->m_Stream)
+				((STREAM_HANDLER)h.m_Func)(_this, &chunk, h.m_UserData);
 		}
 
 		ppkt->Release();
 
-		return pool::IThreadPool::TR_OK;
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
 	}
 
-	static pool::IThreadPool::TASK_RETURN __cdecl PrivateDisconnect(void *param0, void *param1, size_t task_number)
+	// param0 is the SDispatchGroup of batch handlers, param1 the SBatch they get
+	static CExecutor::TASK_RETURN __cdecl ProcessBatch(void *param0, void *param1, size_t task_number)
+	{
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreClient *_this = (CCoreClient *)g->m_Owner;
+		SBatch *b = (SBatch *)param1;
+
+		// handlers always see the original data
+		size_t count = 0;
+		for (size_t i = 0; i < b->m_Packets.size(); i++)
+		{
+			CPacket *ppkt = DecompressPacket((CPacket *)b->m_Packets[i]);
+			if (ppkt)
+				b->m_Packets[count++] = ppkt;
+		}
+
+		if (count)
+		{
+			for (const auto &h : g->m_Batch)
+				((BATCH_HANDLER)h.m_Func)(_this, b->m_Packets.data(), count, h.m_UserData);
+		}
+
+		for (size_t i = 0; i < count; i++)
+			b->m_Packets[i]->Release();
+
+		delete b;
+
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
+	}
+
+	static CExecutor::TASK_RETURN __cdecl PrivateDisconnect(void *param0, void *param1, size_t task_number)
 	{
 		CCoreClient *_this = (CCoreClient *)param0;
 
@@ -327,10 +550,10 @@ private:
 			func(_this, ET_DISCONNECTED, param);
 		}
 
-		return pool::IThreadPool::TR_OK;
+		return CExecutor::TR_OK;
 	}
 
-	static pool::IThreadPool::TASK_RETURN __cdecl PrivateConnect(void *param0, void *param1, size_t task_number)
+	static CExecutor::TASK_RETURN __cdecl PrivateConnect(void *param0, void *param1, size_t task_number)
 	{
 		CCoreClient *_this = (CCoreClient *)param0;
 
@@ -344,6 +567,37 @@ private:
 		buf.len = sizeof(GUID);
 		q = WSASend(_this->m_Socket, &buf, 1, &ct, 0, NULL, NULL);
 
+		// then it offers compact headers; a server that doesn't know about them will just ignore this
+		if (_this->m_CompactHeaders)
+		{
+			SPacketHeader hdr;
+			memset(&hdr, 0, sizeof(SPacketHeader));
+			hdr.m_ID = PACKETID_HEADERMODE;
+			hdr.m_Sender = _this->m_GUID;
+			hdr.m_DataLength = 1;
+
+			BYTE mode = HEADERMODE_COMPACT;
+
+			WSABUF offer[2];
+			offer[0].buf = (char *)&hdr;
+			offer[0].len = sizeof(SPacketHeader);
+			offer[1].buf = (char *)&mode;
+			offer[1].len = 1;
+			q = WSASend(_this->m_Socket, offer, 2, &ct, 0, NULL, NULL);
+		}
+
+		// packets sent from the handler have to go out, so we're connected before it's called -
+		// and whatever was sent while we were connecting can go now
+		_this->m_Connected = true;
+		WSASetEvent(_this->m_SendEvent);
+
+		// a server that doesn't know about these ignores them too
+		if (_this->m_AdvertiseHandlers)
+		{
+			_this->m_Advertised = true;
+			_this->AdvertiseHandlers();
+		}
+
 		TEventHandlerMap::const_iterator it = _this->m_EventHandlerMap.find(ET_CONNECTED);
 		if (it != _this->m_EventHandlerMap.cend())
 		{
@@ -353,9 +607,105 @@ private:
 			func(_this, ET_CONNECTED, param);
 		}
 
-		_this->m_Connected = true;
+		return CExecutor::TR_OK;
+	}
+
+	// sends the server the ids of all our packet and stream handlers, so that it only sends us those;
+	// with a default handler, we want everything, which is an empty list
+	void AdvertiseHandlers()
+	{
+		std::vector<FOURCHARCODE> ids;
+		if (m_Handlers.GetIDs(ids))
+			ids.clear();
+
+		uint32_t len = (uint32_t)(ids.size() * sizeof(FOURCHARCODE));
+
+		CPacket *ppkt = (CPacket *)ICorePacket::NewPacket(len);
+		if (!ppkt)
+			return;
+
+		// the context is blank, so it's only for the server
+		GUID serverguid = { 0 };
+		ppkt->SetData(PACKETID_INTEREST, len, ids.empty() ? nullptr : (const BYTE *)ids.data());
+		ppkt->SetContext(serverguid);
+		SendPacket(ppkt);
+	}
+
+	// reads what the server has sent and handles every complete packet in it; returns false if the
+	// connection is closed or broken, or the server sent something malformed
+	bool ReadPackets()
+	{
+		if (!m_Reader.Read(m_Socket))
+			return false;
+
+		bool malformed = false;
+		CPacket *ppkt;
+
+		// the decoder is looked at for every packet, since the server can switch part way through
+		while ((ppkt = m_Reader.Next(m_Decoder, malformed)) != nullptr)
+		{
+			if (ppkt->GetID() == PACKETID_HEADERMODE)
+			{
+				// the server is switching to compact headers; everything after this is compact,
+				// so switch to reading them and tell the server we're switching too
+				BYTE mode = ppkt->GetDataLength() ? *ppkt->GetData() : 0;
+				if ((mode & HEADERMODE_SWITCHING) && m_CompactHeaders && !m_Decoder)
+				{
+					m_Decoder = new CCompactHeaderDecoder();
+
+					CPacket *reply = (CPacket *)mqme::ICorePacket::NewPacket(1);
+					if (reply)
+					{
+						BYTE replymode = HEADERMODE_COMPACT | HEADERMODE_SWITCHING;
+						reply->SetData(PACKETID_HEADERMODE, 1, &replymode);
+						SendPacket(reply);
+					}
+				}
+
+				ppkt->Release();
+			}
+			else if (ppkt->GetID() == PACKETID_FRAGMENT)
+			{
+				// a piece of a large message goes to its stream handler, if there is one;
+				// otherwise the message is put back together and handled once it's complete.
+				// Compressed pieces can't be used on their own, so those are always put back together
+				SStreamChunk chunk;
+				bool compressed = false;
+				CDispatchTable::CReader hr(m_Handlers);
+				const SDispatchEntry *e = nullptr;
+				if (CFragmentAssembler::Parse(ppkt, &chunk, &compressed))
+					e = hr.Find(chunk.id);
+
+				if (e && e->m_Stream && !compressed)
+				{
+					m_Handlers.Dispatch(e, ppkt, true, ProcessStreamChunk, m_Batches);
+				}
+				else
+				{
+					// nothing's registered for it, so there's no point putting it back together
+					if (e)
+					{
+						CPacket *whole = m_Assembler.Add(ppkt);
+						if (whole)
+							m_Handlers.Dispatch(e, whole, false, ProcessPacket, m_Batches);
+					}
 
-		return pool::IThreadPool::TR_OK;
+					ppkt->Release();
+				}
+			}
+			else
+			{
+				// the handlers are found once, here, and go with the packet
+				CDispatchTable::CReader hr(m_Handlers);
+				const SDispatchEntry *e = hr.Find(ppkt->GetID());
+				if (e)
+					m_Handlers.Dispatch(e, ppkt, false, ProcessPacket, m_Batches);
+				else
+					ppkt->Release();
+			}
+		}
+
+		return !malformed;
 	}
 
 	static DWORD WINAPI RecvThreadProc(LPVOID param)
@@ -367,9 +717,12 @@ private:
 			evs[0] = _this->m_QuitEvent;
 			evs[1] = _this->m_WSEvent;
 
+			// only wakes up without anything to read when there's a batch that's due
+			DWORD timeout = INFINITE;
+
 			while (true)
 			{
-				if (WSAWaitForMultipleEvents(2, evs, false, INFINITE, false) == WSA_WAIT_EVENT_0)
+				if (WSAWaitForMultipleEvents(2, evs, false, timeout, false) == WSA_WAIT_EVENT_0)
 				{
 					break;
 				}
@@ -377,74 +730,133 @@ private:
 				WSANETWORKEVENTS ne;
 				if (WSAEnumNetworkEvents(_this->m_Socket, _this->m_WSEvent, &ne) == 0)
 				{
+					// keep going once we're connected - there may be data arriving already
 					if (ne.lNetworkEvents & FD_CONNECT)
 					{
+						// the connection couldn't be made, so what was waiting for it is thrown away
+						// and the application hears that we're disconnected
+						if (ne.iErrorCode[FD_CONNECT_BIT])
+						{
+							g_ThreadPool->RunTask(PrivateDisconnect, (void *)_this);
+							break;
+						}
+
 						g_ThreadPool->RunTask(PrivateConnect, (void *)_this);
-						break;
 					}
 
-					if (ne.lNetworkEvents & FD_CLOSE)
+					// the socket has room again for what the send thread couldn't get into it
+					if (ne.lNetworkEvents & FD_WRITE)
+						WSASetEvent(_this->m_SendEvent);
+
+					// read whatever is still there before noticing that it's closed
+					bool open = true;
+					if (ne.lNetworkEvents & FD_READ)
+						open = _this->ReadPackets();
+
+					if ((ne.lNetworkEvents & FD_CLOSE) || !open)
 					{
 						g_ThreadPool->RunTask(PrivateDisconnect, (void *)_this);
 						break;
 					}
-
-					if (!(ne.lNetworkEvents & FD_READ))
-						continue;
 				}
 
-				CPacket *ppkt = (CPacket *)mqme::ICorePacket::NewPacket();
+				// batch handlers get what's been read for them, unless they're waiting for more
+				timeout = _this->m_Handlers.Flush(_this->m_Batches);
+			}
+
+			_this->m_Handlers.Flush(_this->m_Batches, true);
+		}
+
+		return 0;
+	}
 
-				SPacketHeader pkthdr;
-				memset(&pkthdr, 0, sizeof(SPacketHeader));
 
-				WSABUF buf;
-				buf.buf = (char *)&pkthdr;
-				buf.len = sizeof(SPacketHeader);
+	// adds a packet whose full header is in buf[0] to the batch, swapping in a compact header if
+	// we've switched to them; the batch is sent right away if it's full
+	void SendBuffers(CPacket *ppkt, WSABUF *buf, DWORD bufct)
+	{
+		const SPacketHeader *hdr = (const SPacketHeader *)buf[0].buf;
+		bool switching = (hdr->m_ID == PACKETID_HEADERMODE) && (bufct > 1) && buf[1].len && (*(BYTE *)buf[1].buf & HEADERMODE_SWITCHING);
 
-				DWORD flags = 0;
-				DWORD rct = 0;
+		if (m_Batch.Add(ppkt, buf, bufct, m_Encoder) && !m_SendBlocked)
+			FlushBatch();
 
-				int q = WSARecv(_this->m_Socket, &buf, 1, &rct, &flags, NULL, NULL);
+		// everything after our switch marker has to be compact
+		if (switching && !m_Encoder)
+			m_Encoder = new CCompactHeaderEncoder();
+	}
 
-				if (q != SOCKET_ERROR)
-				{
-					// allocate space in the packet
-					ppkt->SetData(pkthdr.m_ID, pkthdr.m_DataLength, NULL);
-					ppkt->SetContext(pkthdr.m_Context);
-					ppkt->SetSender(pkthdr.m_Sender);
-
-					buf.buf = (char *)ppkt->GetData();
-					buf.len = ppkt->GetDataLength();
-					if (buf.len > 0)
-					{
-						q = WSARecv(_this->m_Socket, &buf, 1, &rct, &flags, NULL, NULL);
-					}
-				}
+	// sends a packet right away from the calling thread, which holds m_SendLock. Returns false
+	// if it needs to go out in pieces instead, leaving ppkt (possibly now compressed) with the caller
+	bool SendDirect(CPacket *&ppkt)
+	{
+		ppkt->SetSender(m_GUID);
+		ppkt = m_Compression.Apply(ppkt);
 
-				if (q != SOCKET_ERROR)
-				{
-					g_ThreadPool->RunTask(ProcessPacket, (void *)_this, (void *)ppkt);
-				}
-			}
-		}
+		if (m_MaxChunkSize && (ppkt->GetDataLength() > m_MaxChunkSize))
+			return false;
 
-		return 0;
+		WSABUF buf[2];
+		buf[0].buf = (char *)ppkt->GetHeader();
+		buf[0].len = ppkt->GetHeaderLength();
+		buf[1].buf = (char *)ppkt->GetData();
+		buf[1].len = ppkt->GetDataLength();
+
+		// anything still sitting in the batch goes out first, in the same write
+		SendBuffers(ppkt, buf, 2);
+		FlushBatch();
+
+		ppkt->Release();
+
+		// whatever the socket wouldn't take is left for the send thread
+		if (m_SendBlocked)
+			WSASetEvent(m_SendEvent);
+
+		return true;
 	}
 
+	void FlushBatch()
+	{
+		m_SendBlocked = (m_Batch.Flush(m_Socket) == SENDBATCH_BLOCKED);
+	}
 
 	static DWORD WINAPI SendThreadProc(LPVOID param)
 	{
 		CCoreClient *_this = (CCoreClient *)param;
 		if (_this)
 		{
+			// large packets that are going out a piece at a time
+			std::deque<SLargeSend> large;
+
+			HANDLE evs[2];
+			evs[0] = _this->m_QuitEvent;
+			evs[1] = _this->m_SendEvent;
+
 			while (true)
 			{
-				if (WSAWaitForMultipleEvents(1, &_this->m_QuitEvent, true, 75, false) == WSA_WAIT_EVENT_0)
+				// sleep until SendPacket wakes us up - but don't wait around if we're in the middle of
+				// sending something large, and only until it's time to flush if there's a batch waiting.
+				// If the socket is full, nothing more goes out until it says it has room
+				DWORD timeout = (large.empty() || _this->m_SendBlocked) ? INFINITE : 0;
+				if (!_this->m_SendBlocked && !_this->m_Batch.Empty())
+				{
+					uint64_t age = _this->m_Batch.Age();
+					timeout = std::min<DWORD>(timeout, (age < _this->m_FlushDelay) ? (DWORD)((_this->m_FlushDelay - age + 999) / 1000) : 0);
+				}
+
+				if (WSAWaitForMultipleEvents(2, evs, false, timeout, false) == WSA_WAIT_EVENT_0)
 				{
 					break;
 				}
 
+				WSAResetEvent(_this->m_SendEvent);
+
+				// anything sent before the connection is up waits for it; PrivateConnect wakes us then
+				if (!_this->m_Connected)
+					continue;
+
+				std::lock_guard<std::mutex> sl(_this->m_SendLock);
+
 				while (!_this->m_OutPackets.Empty())
 				{
 					CPacket *ppkt = _this->m_OutPackets.Deque();
@@ -452,30 +864,64 @@ private:
 					{
 						ppkt->SetSender(_this->m_GUID);
 
-						if (_this->m_Connected)
-						{
-							WSABUF buf[2];
-							buf[0].buf = (char *)ppkt->GetHeader();
-							buf[0].len = ppkt->GetHeaderLength();
-							buf[1].buf = (char *)ppkt->GetData();
-							buf[1].len = ppkt->GetDataLength();
+						// compress first, so that a large message might not need to go out in pieces after all
+						ppkt = _this->m_Compression.Apply(ppkt);
 
-							DWORD sct = 0;
+						// too big to go out whole, so set it aside to be sent in pieces
+						if (_this->m_MaxChunkSize && (ppkt->GetDataLength() > _this->m_MaxChunkSize))
+						{
+							large.push_back(SLargeSend(ppkt, _this->m_NextMessageID++ & 0x7FFFFFFF));
+							continue;
+						}
 
-							int q = WSASend(_this->m_Socket, buf, 2, &sct, 0, NULL, NULL);
+						WSABUF buf[2];
+						buf[0].buf = (char *)ppkt->GetHeader();
+						buf[0].len = ppkt->GetHeaderLength();
+						buf[1].buf = (char *)ppkt->GetData();
+						buf[1].len = ppkt->GetDataLength();
 
-							if (q == SOCKET_ERROR)
-							{
-								DWORD err = WSAGetLastError();
-							}
-						}
+						_this->SendBuffers(ppkt, buf, 2);
 
 						ppkt->Release();
 					}
+				}
 
-					Sleep(0);
+				// one piece of each large packet, then go back and see if anything else is waiting
+				std::deque<SLargeSend>::iterator lit = large.begin();
+				while (lit != large.end())
+				{
+					SPacketHeader hdr;
+					SFragmentHeader fh;
+					WSABUF buf[3];
+					bool last = lit->NextChunk(_this->m_MaxChunkSize ? _this->m_MaxChunkSize : UINT32_MAX, &hdr, &fh, buf);
+
+					_this->SendBuffers(lit->m_Packet, buf, 3);
+
+					if (last)
+					{
+						lit->m_Packet->Release();
+						lit = large.erase(lit);
+					}
+					else
+					{
+						++lit;
+					}
 				}
+
+				// everything that was queued has been batched up, so now it goes out
+				if (!_this->m_Batch.Empty() && (_this->m_SendBlocked || !_this->m_FlushDelay || (_this->m_Batch.Age() >= _this->m_FlushDelay)))
+					_this->FlushBatch();
 			}
+
+			_this->m_SendLock.lock();
+
+			if (_this->m_Connected)
+				_this->FlushBatch();
+
+			_this->m_SendLock.unlock();
+
+			for (auto &it : large)
+				it.m_Packet->Release();
 		}
 
 		return 0;
@@ -36,23 +36,33 @@
 #include <ObjBase.h>
 #include <set>
 #include <mutex>
+#include <condition_variable>
 
 #include "Packet.h"
 #include "PacketQueue.h"
-#include <Pool.h>
+#include "Fragment.h"
+#include "Compression.h"
+#include "SendBatch.h"
+#include "Poller.h"
+#include "FrameReader.h"
+#include "RoutingTable.h"
+#include "GUIDIndex.h"
+#include "CompactHeader.h"
+#include "DispatchTable.h"
+#include "Executor.h"
 
-extern pool::IThreadPool *g_ThreadPool;
 extern bool g_Initialized;
 
+// set on the server's I/O threads, which must never wait for a slow consumer's queue to drain
+static thread_local bool t_IsReactor = false;
+
+// the most I/O threads a server can have; Route keeps one bit for each
+#define MAX_REACTORS		64
+
+// the longest SendPacket waits for a slow listener under OP_BLOCK before queueing the packet
+// anyway, over the limit
+#define ROOM_WAIT_MS		5000
 
-// In order to make TGUIDSet work, a Compare must be provided
-struct GUIDComparer
-{
-	bool operator()(const GUID &a, const GUID &b) const
-	{
-		return (memcmp(&a, &b, sizeof(GUID)) < 0) ? true : false;
-	}
-};
 
 typedef std::set< GUID, GUIDComparer > TGUIDSet;
 
@@ -108,40 +118,131 @@ protected:
 	HANDLE m_ListenThread;
 	DWORD m_ListenThreadId;
 
-	HANDLE m_RecvThread;
-	DWORD m_RecvThreadId;
-
-	HANDLE m_SendThread;
-	DWORD m_SendThreadId;
+	struct sReactor;
 
 	typedef struct sConnectionInfo
 	{
-		sConnectionInfo() { ZeroMemory(&addr, sizeof(sockaddr_in)); sock = NULL; ev = NULL; }
+		sConnectionInfo() { ZeroMemory(&id, sizeof(GUID)); index = GUIDINDEX_NONE; ZeroMemory(&addr, sizeof(sockaddr_in)); sock = NULL; reactor = NULL; enc = NULL; dec = NULL; reader = NULL; batch = NULL; writing = false; interests = nullptr; }
+
+		GUID id;
+
+		// where it is in m_Connections; the routing table knows it by this
+		uint32_t index;
 
 		sockaddr_in addr;
 		SOCKET sock;
-		HANDLE ev;
+
+		// the I/O thread that reads from and writes to this connection
+		struct sReactor *reactor;
+
+		// set once compact headers have been negotiated in each direction
+		CCompactHeaderEncoder *enc;
+		CCompactHeaderDecoder *dec;
+
+		// what has arrived from this connection that hasn't been made into packets yet
+		CFrameReader *reader;
+
+		// packets waiting to go out to this connection
+		CSendBatch *batch;
+
+		// set while the socket is full, so that the reactor is told when it can take more
+		bool writing;
+
+		// the packet ids the client has handlers for, if it has said; channels it has been given its
+		// own filter for use that instead. Replaced (and the old one retired) by the connection's reactor
+		std::atomic<const SInterestFilter *> interests;
 	} SConnectionInfo;
 
-	typedef std::map<GUID, SConnectionInfo, GUIDComparer> TConnectionMap;
-	TConnectionMap m_ConnectionMap;
+	// connections by index, and the index of each one's GUID; a closed connection leaves an empty
+	// slot, which is filled again once nothing routing a packet can still be looking for it there.
+	// The channels have their own copies of what they need to know about their members, so packets
+	// are routed without looking at these
+	typedef std::vector<SConnectionInfo *> TConnectionArray;
+	TConnectionArray m_Connections;
+	std::vector<uint32_t> m_FreeConnections;
+	CGUIDIndex m_ConnectionIndex;
 	std::mutex m_ConnectionLock;
 
+	// part of queueing one packet to a reactor's listeners, which may be done on the thread pool;
+	// what it turns up for the reactor to deal with afterwards is collected here
+	typedef struct sFanout
+	{
+		CPacket *ppkt;
+		WSABUF *buf;
+		DWORD bufct;
+		uint64_t len;
+
+		// the listeners to queue it to, if they want packets with this id
+		const SMember *begin, *end;
+		uint32_t sender;
+		FOURCHARCODE id;
+
+		bool required;
+		bool switching;
+
+		std::vector<SConnectionInfo *> pending;
+		std::vector<GUID> slow;
+		std::vector<SConnectionInfo *> doomed;
+	} SFanout;
+
+	// a reactor is an I/O thread that owns some of the connections, reading from them and
+	// writing to them; packets for its connections are handed to it through its queue
+	typedef struct sReactor
+	{
+		sReactor(CCoreServer *_server, size_t _index) : batches(_index, ProcessBatch) { server = _server; index = _index; thread = NULL; threadid = 0; waiting = false; connections = 0; }
 
-	HANDLE m_QuitEvent;
-	uint16_t m_Port;
+		CCoreServer *server;
 
-	typedef struct sPacketHandlerCallInfo
-	{
-		sPacketHandlerCallInfo(PACKET_HANDLER _func, void *_userdata) { func = _func; userdata = _userdata; }
+		// where it is in m_Reactors
+		size_t index;
 
-		PACKET_HANDLER func;
-		void *userdata;
-	} SPacketHandlerCallInfo;
+		HANDLE thread;
+		DWORD threadid;
+
+		// wakes the thread when its connections have data, or when it's handed packets to send
+		CPoller poller;
+		std::atomic<bool> waiting;
+
+		CPacketQueue outgoing;
+
+		// connections with a partially filled batch, oldest first; only touched by the reactor's thread
+		std::deque<SConnectionInfo *> pending;
+
+		// connections whose queues overflowed while packets were being queued, to be reported and/or
+		// disconnected afterwards; only touched by the reactor's thread. The doomed ones are all its
+		// own, and come off the list if they're closed some other way first
+		std::vector<GUID> slow;
+		std::vector<SConnectionInfo *> doomed;
+
+		// the pieces of the packet it's queueing, kept for their buffers
+		std::vector<SFanout> fanout;
+
+		// what it has read for batch handlers; only touched by the reactor's thread
+		SBatches batches;
+
+		std::atomic<size_t> connections;
+	} SReactor;
+
+	typedef std::vector<SReactor *> TReactorArray;
+	TReactorArray m_Reactors;
+
+	// how many reactors to start with on the next StartListening
+	size_t m_ReactorCount;
+
+	// how many of a reactor's listeners it takes to split queueing a packet over m_FanoutPool
+	size_t m_FanoutThreshold;
 
-	typedef std::map< FOURCHARCODE, SPacketHandlerCallInfo > TPacketHandlerMap;
+	// the workers that queue the pieces. They're our own rather than the thread pool's: a handler
+	// on the thread pool may be waiting in SendPacket for a reactor to make room, so a reactor
+	// that waited on the thread pool in turn could wait forever
+	std::atomic<CExecutor *> m_FanoutPool;
 
-	TPacketHandlerMap m_PacketHandlerMap;
+
+	HANDLE m_QuitEvent;
+	uint16_t m_Port;
+
+	// packet and stream handlers; what's found for a packet goes to the worker along with it
+	CDispatchTable m_Handlers;
 
 	typedef struct sEventHandlerCallInfo
 	{
@@ -157,16 +258,46 @@ protected:
 
 	typedef std::map< GUID, CGUIDSet, GUIDComparer > TGUIDSetMap;
 
-	TGUIDSetMap m_RoutingTable;
-	std::mutex m_RoutingLock;
+	// channel -> members; read without locking by everything that routes packets
+	CRoutingTable m_RoutingTable;
 
 	TGUIDSetMap m_ListeningTable;
 	std::mutex m_ListeningLock;
 
-	CPacketQueue m_Outgoing;
+	// pieces of large messages coming in, for handlers on this server
+	CFragmentAssembler m_Assembler;
+
+	uint32_t m_MaxChunkSize;
+
+	// whether clients may switch to compact headers
+	bool m_CompactHeaders;
+
+	// which of the packets we send get compressed
+	CCompressionRules m_Compression;
+
+	// how much goes out to a connection in one write, and how long a partial batch may wait for more
+	uint32_t m_CoalesceBytes;
+	uint32_t m_CoalesceBuffers;
+	uint32_t m_FlushDelay;
+
+	// how far behind a connection may fall, and what happens when it does
+	uint64_t m_QueueBytes;
+	size_t m_QueuePackets;
+	EOverflowPolicy m_OverflowPolicy;
+
+	// SendPacket calls waiting for room (OP_BLOCK) sleep on m_RoomFreed until m_RoomGeneration
+	// moves on, which the reactors see to after each pass that finds someone waiting
+	std::mutex m_RoomLock;
+	std::condition_variable m_RoomFreed;
+	std::atomic<uint64_t> m_RoomGeneration;
+	std::atomic<size_t> m_RoomWaiters;
+
+	// ids for large messages the server sends in pieces; the high bit keeps them apart
+	// from ids the clients choose when they send their own messages in pieces
+	std::atomic<uint32_t> m_NextMessageID;
 
 public:
-	CCoreServer()
+	CCoreServer() : m_Handlers(this)
 	{
 		// 8080 is the default port we're on
 		m_Port = 8080;
@@ -174,11 +305,24 @@ public:
 		m_ListenThread = NULL;
 		m_ListenThreadId = 0;
 
-		m_SendThread = NULL;
-		m_SendThreadId = 0;
+		m_ReactorCount = 1;
+		m_FanoutThreshold = 0;
+		m_FanoutPool = nullptr;
+
+		m_MaxChunkSize = 0;
+		m_NextMessageID = 0;
 
-		m_RecvThread = NULL;
-		m_RecvThreadId = 0;
+		m_CompactHeaders = true;
+
+		m_CoalesceBytes = SENDBATCH_DEFAULT_BYTES;
+		m_CoalesceBuffers = SENDBATCH_DEFAULT_BUFFERS;
+		m_FlushDelay = 0;
+
+		m_QueueBytes = 0;
+		m_QueuePackets = 0;
+		m_OverflowPolicy = OP_BLOCK;
+		m_RoomGeneration = 0;
+		m_RoomWaiters = 0;
 
 		m_QuitEvent = WSACreateEvent();
 	}
@@ -186,6 +330,10 @@ public:
 	~CCoreServer()
 	{
 		StopListening();
+
+		CExecutor *pool = m_FanoutPool;
+		if (pool)
+			pool->Release();
 	}
 
 	virtual void Release()
@@ -195,10 +343,10 @@ public:
 
 	void FlushOutgoingPackets()
 	{
-		while (!m_Outgoing.Empty())
+		for (auto r : m_Reactors)
 		{
-			CPacket *ppkt = m_Outgoing.Deque();
-			if (ppkt)
+			CPacket *ppkt;
+			while ((ppkt = r->outgoing.Deque()) != nullptr)
 				ppkt->Release();
 		}
 	}
@@ -214,31 +362,96 @@ public:
 
 		m_Port = port;
 
-		if (!m_ListenThread)
-		{
-			m_ListenThread = CreateThread(NULL, 1 << 17, ListenThreadProc, this, 0, &m_ListenThreadId);
-		}
+		bool ret = true;
 
-		if (!m_RecvThread)
+		// the reactors have to be there before any connections are accepted
+		if (m_Reactors.empty())
 		{
-			m_RecvThread = CreateThread(NULL, 1 << 17, RecvThreadProc, this, 0, &m_RecvThreadId);
+			for (size_t i = 0; i < std::max<size_t>(m_ReactorCount, 1); i++)
+			{
+				SReactor *r = new SReactor(this, i);
+				r->thread = CreateThread(NULL, 1 << 17, ReactorThreadProc, r, 0, &r->threadid);
+				m_Reactors.push_back(r);
+
+				if (!r->threadid)
+					ret = false;
+			}
 		}
 
-		if (!m_SendThread)
+		if (!m_ListenThread)
 		{
-			m_SendThread = CreateThread(NULL, 1 << 17, SendThreadProc, this, 0, &m_SendThreadId);
+			m_ListenThread = CreateThread(NULL, 1 << 17, ListenThreadProc, this, 0, &m_ListenThreadId);
 		}
 
-		return (m_ListenThreadId && m_RecvThreadId && m_SendThreadId) ? true : false;
+		return (ret && m_ListenThreadId) ? true : false;
 	}
 
 	virtual bool StopListening()
 	{
 		FlushOutgoingPackets();
 
-		SignalObjectAndWait(m_QuitEvent, m_ListenThread, INFINITE, false);
-		SignalObjectAndWait(m_QuitEvent, m_SendThread, INFINITE, false);
-		SignalObjectAndWait(m_QuitEvent, m_RecvThread, INFINITE, false);
+		if (m_ListenThread)
+		{
+			HANDLE h = m_ListenThread;
+			SignalObjectAndWait(m_QuitEvent, h, INFINITE, false);
+			CloseHandle(h);
+		}
+
+		// the reactors are waiting on their sockets, not the quit event, so they need a nudge; so
+		// does anyone waiting for them to make room
+		WSASetEvent(m_QuitEvent);
+		for (auto r : m_Reactors)
+			r->poller.Wake();
+
+		WakeRoomWaiters();
+
+		for (auto r : m_Reactors)
+		{
+			if (r->thread)
+			{
+				WaitForSingleObject(r->thread, INFINITE);
+				CloseHandle(r->thread);
+			}
+		}
+
+		FlushOutgoingPackets();
+
+		// whatever connections are left are closed along with the reactors
+		m_ConnectionLock.lock();
+		TConnectionArray remaining;
+		for (auto &cinf : m_Connections)
+		{
+			if (!cinf)
+				continue;
+
+			remaining.push_back(cinf);
+			m_ConnectionIndex.Erase(cinf->id);
+			cinf = nullptr;
+		}
+		m_ConnectionLock.unlock();
+
+		// the channels are only ever made up of connections, so they go too
+		m_RoutingTable.Clear();
+
+		m_ListeningLock.lock();
+		m_ListeningTable.clear();
+		m_ListeningLock.unlock();
+
+		for (auto cinf : remaining)
+		{
+			closesocket(cinf->sock);
+			delete cinf->reader;
+			delete cinf->enc;
+			delete cinf->dec;
+
+			m_RoutingTable.Defer(FreeConnection, this, (uintptr_t)cinf);
+		}
+
+		for (auto r : m_Reactors)
+			delete r;
+		m_Reactors.clear();
+
+		WSAResetEvent(m_QuitEvent);
 
 		return true;
 	}
@@ -247,8 +460,8 @@ public:
 	{
 		if (packet)
 		{
-			((CPacket *)packet)->IncRef();
-			m_Outgoing.Enque((CPacket *)packet);
+			// the caller's reference is handed over to the reactors
+			Route((CPacket *)packet);
 
 			return true;
 		}
@@ -258,15 +471,21 @@ public:
 
 	virtual bool AddListenerToChannel(GUID channel, GUID listener)
 	{
-		bool ret = true;
+		// held throughout, so that the listener can't go between being found and being added to the
+		// channel (closing takes it out of the index first, then out of its channels under this)
+		std::lock_guard<std::mutex> ll(m_ListeningLock);
+
+		m_ConnectionLock.lock();
+		uint32_t index = FindConnection(listener);
+		SMember member;
+		if (index != GUIDINDEX_NONE)
+			member = MemberOf(m_Connections[index]);
+		m_ConnectionLock.unlock();
 
-		TConnectionMap::const_iterator cit = m_ConnectionMap.find(listener);
-		if (cit == m_ConnectionMap.end())
-			ret = false;
+		bool ret = (index != GUIDINDEX_NONE);
 
 		if (ret)
 		{
-			m_ListeningLock.lock();
 			TGUIDSetMap::iterator lit = m_ListeningTable.find(listener);
 			if (lit == m_ListeningTable.end())
 			{
@@ -277,20 +496,8 @@ public:
 
 			if (lit != m_ListeningTable.end())
 				lit->second.Add(channel);
-			m_ListeningLock.unlock();
 
-			m_RoutingLock.lock();
-			TGUIDSetMap::iterator rit = m_RoutingTable.find(channel);
-			if (rit == m_RoutingTable.end())
-			{
-				std::pair<TGUIDSetMap::iterator, bool> insres = m_RoutingTable.insert(TGUIDSetMap::value_type(channel, CGUIDSet()));
-				if (insres.second)
-					rit = insres.first;
-			}
-
-			if (rit != m_RoutingTable.end())
-				rit->second.Add(listener);
-			m_RoutingLock.unlock();
+			m_RoutingTable.Add(channel, member);
 		}
 
 		return ret;
@@ -298,47 +505,154 @@ public:
 
 	virtual void RemoveListenerFromChannel(GUID channel, GUID listener)
 	{
-		m_ListeningLock.lock();
+		std::lock_guard<std::mutex> ll(m_ListeningLock);
+
 		TGUIDSetMap::iterator lit = m_ListeningTable.find(listener);
-		if (lit != m_ListeningTable.end())
-		{
-			lit->second.Remove(channel);
-			if (lit->second.Empty())
-				m_ListeningTable.erase(lit);
-		}
-		m_ListeningLock.unlock();
+		if ((lit == m_ListeningTable.end()) || !lit->second.Contains(channel))
+			return;
 
-		m_RoutingLock.lock();
-		TGUIDSetMap::iterator rit = m_RoutingTable.find(channel);
-		if (rit != m_RoutingTable.end())
-		{
-			rit->second.Remove(listener);
-			if (rit->second.Empty())
-				m_RoutingTable.erase(rit);
-		}
-		m_RoutingLock.unlock();
+		lit->second.Remove(channel);
+		if (lit->second.Empty())
+			m_ListeningTable.erase(lit);
+
+		// it's in the listening table, so it's still connected
+		m_ConnectionLock.lock();
+		uint32_t index = FindConnection(listener);
+		m_ConnectionLock.unlock();
+
+		if (index != GUIDINDEX_NONE)
+			m_RoutingTable.Remove(channel, index);
+	}
+
+	virtual bool SetListenerFilter(GUID channel, GUID listener, EFilterMode mode, const FOURCHARCODE *ids, size_t count)
+	{
+		// joining and leaving are done under this too, so the listener stays on the channel
+		std::lock_guard<std::mutex> ll(m_ListeningLock);
+
+		m_ConnectionLock.lock();
+		uint32_t index = FindConnection(listener);
+		m_ConnectionLock.unlock();
+
+		if (index == GUIDINDEX_NONE)
+			return false;
+
+		// everything passes a deny-list of nothing
+		SInterestFilter *filter = new SInterestFilter(mode == FM_ALLOW, (mode == FM_ALL) ? nullptr : ids, count);
+
+		return m_RoutingTable.SetFilter(channel, index, filter);
 	}
 
 	virtual bool GetListeners(GUID channel, IGUIDSet **listeners)
 	{
-		bool ret = false;
+		// the table only has snapshots, so the caller gets a copy of the current one
+		static thread_local CGUIDSet s_Listeners;
 
-		TGUIDSetMap::iterator rit = m_RoutingTable.find(channel);
-		if (rit != m_RoutingTable.end())
+		s_Listeners.m_GUIDSet.clear();
+
+		CRoutingTable::CReader rr(m_RoutingTable);
+		const SMemberList *members = rr.Find(channel);
+		if (!members)
+			return false;
+
+		for (auto &m : members->m_Members)
+			s_Listeners.m_GUIDSet.insert(((const SConnectionInfo *)m.m_Context)->id);
+
+		*listeners = &s_Listeners;
+
+		return true;
+	}
+
+	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, void *userdata = nullptr, uint32_t flags = 0)
+	{
+		m_Handlers.AddPacketHandler(id, (void *)handler, userdata, flags);
+	}
+
+	virtual void RegisterStreamHandler(FOURCHARCODE id, STREAM_HANDLER handler, void *userdata = nullptr, uint32_t flags = 0)
+	{
+		m_Handlers.AddStreamHandler(id, (void *)handler, userdata, flags);
+	}
+
+	virtual void RegisterBatchHandler(FOURCHARCODE id, BATCH_HANDLER handler, void *userdata = nullptr, uint32_t flags = 0, uint32_t max_count = 0, uint32_t max_delay_us = 0)
+	{
+		m_Handlers.AddBatchHandler(id, (void *)handler, userdata, flags, max_count, max_delay_us);
+	}
+
+	virtual void RegisterDefaultHandler(PACKET_HANDLER handler, void *userdata = nullptr, uint32_t flags = 0)
+	{
+		m_Handlers.AddDefaultHandler((void *)handler, userdata, flags);
+	}
+
+	virtual void GetHandlerStats(SHandlerStats *stats)
+	{
+		if (stats)
+			m_Handlers.GetStats(stats);
+	}
+
+	virtual void SetMaxChunkSize(uint32_t max_chunk_size)
+	{
+		m_MaxChunkSize = max_chunk_size;
+	}
+
+	virtual void SetCompactHeaders(bool allow)
+	{
+		m_CompactHeaders = allow;
+	}
+
+	virtual void SetCompression(FOURCHARCODE id, uint32_t min_size)
+	{
+		m_Compression.SetForID(id, min_size);
+	}
+
+	virtual void SetChannelCompression(GUID channel, uint32_t min_size)
+	{
+		m_Compression.SetForChannel(channel, min_size);
+	}
+
+	virtual void SetIOThreads(size_t count)
+	{
+		m_ReactorCount = std::min<size_t>(std::max<size_t>(count, 1), MAX_REACTORS);
+	}
+
+	virtual void SetParallelFanout(size_t min_members)
+	{
+		// the workers are started the first time they're wanted, and kept from then on
+		if (min_members && !m_FanoutPool)
 		{
-			*listeners = &(rit->second);
-			ret = true;
+			CExecutor *pool = CExecutor::Create();
+
+			CExecutor *none = nullptr;
+			if (!m_FanoutPool.compare_exchange_strong(none, pool))
+				pool->Release();
 		}
 
-		return false;
+		m_FanoutThreshold = min_members;
 	}
 
-	virtual void RegisterPacketHandler(FOURCHARCODE id, PACKET_HANDLER handler, void *userdata = nullptr)
+	virtual void SetSendCoalescing(uint32_t max_bytes, uint32_t max_buffers, uint32_t flush_delay_us)
 	{
-		TPacketHandlerMap::const_iterator cit = m_PacketHandlerMap.find(id);
-		if (cit == m_PacketHandlerMap.end())
+		m_CoalesceBytes = max_bytes;
+		m_CoalesceBuffers = max_buffers;
+		m_FlushDelay = flush_delay_us;
+
+		std::lock_guard<std::mutex> l(m_ConnectionLock);
+		for (auto cinf : m_Connections)
 		{
-			m_PacketHandlerMap.insert(TPacketHandlerMap::value_type(id, SPacketHandlerCallInfo(handler, userdata)));
+			if (cinf && cinf->batch)
+				cinf->batch->SetLimits(max_bytes, max_buffers);
+		}
+	}
+
+	virtual void SetOutboundLimits(uint64_t max_bytes, size_t max_packets, EOverflowPolicy policy)
+	{
+		m_QueueBytes = max_bytes;
+		m_QueuePackets = max_packets;
+		m_OverflowPolicy = policy;
+
+		std::lock_guard<std::mutex> l(m_ConnectionLock);
+		for (auto cinf : m_Connections)
+		{
+			if (cinf && cinf->batch)
+				cinf->batch->SetQueueLimits(max_bytes, max_packets);
 		}
 	}
 
@@ -424,31 +738,54 @@ private:
 							buf.len = sizeof(GUID);
 							q = WSARecv(client_socket, &buf, 1, &ct, &flags, NULL, NULL);
 
-							SConnectionInfo cinf;
-							cinf.addr = clientaddr;
-							cinf.sock = client_socket;
-							cinf.ev = WSACreateEvent();
+							SConnectionInfo *cinf = new SConnectionInfo();
+							cinf->id = client_guid;
+							cinf->addr = clientaddr;
+							cinf->sock = client_socket;
+							cinf->batch = new CSendBatch();
+							cinf->batch->SetLimits(_this->m_CoalesceBytes, _this->m_CoalesceBuffers);
+							cinf->batch->SetQueueLimits(_this->m_QueueBytes, _this->m_QueuePackets);
+							cinf->reader = new CFrameReader();
+
+							// hand the connection to the reactor with the fewest
+							cinf->reactor = _this->m_Reactors[0];
+							for (auto r : _this->m_Reactors)
+							{
+								if (r->connections < cinf->reactor->connections)
+									cinf->reactor = r;
+							}
+							cinf->reactor->connections++;
 
-							// have the new connection notify us if there's data available or it is closed/lost
-							WSAEventSelect(client_socket, cinf.ev, FD_CLOSE | FD_READ);
+							// the new socket inherited the listening socket's event selection; the poller
+							// watches it from here on (it stays non-blocking)
+							WSAEventSelect(client_socket, NULL, 0);
 
 							// set up our connectioon mapping
-							_this->m_ConnectionMap.insert(TConnectionMap::value_type(client_guid, cinf));
-
-							_this->m_RoutingLock.lock();
-							std::pair<TGUIDSetMap::iterator, bool> rins = _this->m_RoutingTable.insert(TGUIDSetMap::value_type(client_guid, CGUIDSet()));
-							rins.first->second.Add(client_guid);
-							_this->m_RoutingLock.unlock();
-
-							_this->m_ListeningLock.lock();
-							std::pair<TGUIDSetMap::iterator, bool> lins = _this->m_ListeningTable.insert(TGUIDSetMap::value_type(client_guid, CGUIDSet()));
-							lins.first->second.Add(client_guid);
-							_this->m_ListeningLock.unlock();
-
-							// if we have a registered packet handler, then schedule it to run
-							TEventHandlerMap::iterator peit = _this->m_EventHandlerMap.find(ICoreServer::ET_CONNECT);
-							if (peit != _this->m_EventHandlerMap.end())
-								peit->second.func(_this, ICoreServer::ET_CONNECT, client_guid, peit->second.userdata);
+							if (!_this->InsertConnection(cinf))
+							{
+								// a client with this GUID is already connected, so this one is turned away
+								cinf->reactor->connections--;
+								delete cinf->batch;
+								delete cinf->reader;
+								delete cinf;
+								closesocket(client_socket);
+							}
+							else
+							{
+								_this->m_RoutingTable.Add(client_guid, _this->MemberOf(cinf));
+
+								_this->m_ListeningLock.lock();
+								std::pair<TGUIDSetMap::iterator, bool> lins = _this->m_ListeningTable.insert(TGUIDSetMap::value_type(client_guid, CGUIDSet()));
+								lins.first->second.Add(client_guid);
+								_this->m_ListeningLock.unlock();
+
+								// if we have a registered packet handler, then schedule it to run
+								_this->FireEvent(ICoreServer::ET_CONNECT, client_guid);
+
+								// now that it's all set up, have the reactor told if there's data available
+								// or the connection is closed/lost
+								cinf->reactor->poller.Add(client_socket, (void *)cinf);
+							}
 						}
 					}
 					else if (ne.lNetworkEvents & FD_CLOSE)
@@ -474,245 +811,854 @@ private:
 	}
 
 
-	static  pool::IThreadPool::TASK_RETURN __cdecl ProcessPacket(void *param0, void *param1, size_t task_number)
+	// param0 is the SDispatchGroup whose handlers get the packet
+	static  CExecutor::TASK_RETURN __cdecl ProcessPacket(void *param0, void *param1, size_t task_number)
 	{
-		CCoreServer *_this = (CCoreServer *)param0;
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreServer *_this = (CCoreServer *)g->m_Owner;
+
+		// handlers always see the original data; the copy that's being routed stays compressed
+		CPacket *ppkt = DecompressPacket((CPacket *)param1);
+		if (!ppkt)
+		{
+			CDispatchTable::Done(g);
+			return CExecutor::TR_OK;
+		}
+
+		for (const auto &h : g->m_Packet)
+			((PACKET_HANDLER)h.m_Func)(_this, ppkt, h.m_UserData);
+
+		// a message that arrived whole goes to the stream handlers as its only piece
+		if (g->m_Whole && !g->m_Stream.empty())
+		{
+			SStreamChunk chunk;
+			CFragmentAssembler::Describe(ppkt, &chunk);
+
+			for (const auto &h : g->m_Stream)
+				((STREAM_HANDLER)h.m_Func)(_this, &chunk, h.m_UserData);
+		}
+
+		ppkt->Release();
+
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
+	}
+
+	// param0 is the SDispatchGroup whose handlers get the piece
+	static  CExecutor::TASK_RETURN __cdecl ProcessStreamChunk(void *param0, void *param1, size_t task_number)
+	{
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreServer *_this = (CCoreServer *)g->m_Owner;
 		CPacket *ppkt = (CPacket *)param1;
 
-		// look up the packet handler and call it with the appropriate parameters
-		TPacketHandlerMap::iterator it = _this->m_PacketHandlerMap.find(ppkt->GetID());
-		if (it != _this->m_PacketHandlerMap.end())
+		SStreamChunk chunk;
+		if (CFragmentAssembler::Parse(ppkt, &chunk))
 		{
-			it->second.func(_this, ppkt, it->second.userdata);
+			for (const auto &h : g->m_Stream)
+				((STREAM_HANDLER)h.m_Func)(_this, &chunk, h.m_UserData);
 		}
 
 		ppkt->Release();
 
-		return pool::IThreadPool::TR_OK;
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
 	}
 
-	static DWORD WINAPI RecvThreadProc(void *param)
+	// param0 is the SDispatchGroup of batch handlers, param1 the SBatch they get
+	static CExecutor::TASK_RETURN __cdecl ProcessBatch(void *param0, void *param1, size_t task_number)
 	{
-		CCoreServer *_this = (CCoreServer *)param;
+		const SDispatchGroup *g = (const SDispatchGroup *)param0;
+		CCoreServer *_this = (CCoreServer *)g->m_Owner;
+		SBatch *b = (SBatch *)param1;
 
-		// traverse the connection map and see if data is available
-		TConnectionMap::const_iterator it = _this->m_ConnectionMap.begin();
-		while (true)
+		// handlers always see the original data
+		size_t count = 0;
+		for (size_t i = 0; i < b->m_Packets.size(); i++)
 		{
-			// is it time to quit?
-			DWORD waitret = WaitForSingleObject(_this->m_QuitEvent, 0);
-			if (waitret == WAIT_OBJECT_0)
-				break;
+			CPacket *ppkt = DecompressPacket((CPacket *)b->m_Packets[i]);
+			if (ppkt)
+				b->m_Packets[count++] = ppkt;
+		}
+
+		if (count)
+		{
+			for (const auto &h : g->m_Batch)
+				((BATCH_HANDLER)h.m_Func)(_this, b->m_Packets.data(), count, h.m_UserData);
+		}
+
+		for (size_t i = 0; i < count; i++)
+			b->m_Packets[i]->Release();
+
+		delete b;
+
+		CDispatchTable::Done(g);
+
+		return CExecutor::TR_OK;
+	}
+
+	// hands a received piece of a large message to a stream handler, or adds it to its message
+	// and hands the message to a packet handler once it's complete. Takes the caller's reference
+	void DispatchFragment(SReactor *r, CPacket *ppkt)
+	{
+		SStreamChunk chunk;
+		bool compressed;
+		if (CFragmentAssembler::Parse(ppkt, &chunk, &compressed))
+		{
+			CDispatchTable::CReader hr(m_Handlers);
+			const SDispatchEntry *e = hr.Find(chunk.id);
 
-			// if no connections, move on
-			if (_this->m_ConnectionMap.empty())
+			// compressed pieces can't be decompressed on their own, so those messages are always put
+			// back together first
+			if (e && e->m_Stream && !compressed)
 			{
-				Sleep(0);
-				continue;
+				m_Handlers.Dispatch(e, ppkt, true, ProcessStreamChunk, r->batches);
+				return;
+			}
+
+			if (e)
+			{
+				CPacket *whole = m_Assembler.Add(ppkt);
+				if (whole)
+					m_Handlers.Dispatch(e, whole, false, ProcessPacket, r->batches);
 			}
+		}
+
+		ppkt->Release();
+	}
+
+	// gives a new connection an index and makes it findable by its GUID; returns false if there's
+	// already a connection with that GUID
+	bool InsertConnection(SConnectionInfo *cinf)
+	{
+		m_ConnectionLock.lock();
+
+		if (m_ConnectionIndex.Find(cinf->id) != GUIDINDEX_NONE)
+		{
+			m_ConnectionLock.unlock();
+			return false;
+		}
+
+		if (!m_FreeConnections.empty())
+		{
+			cinf->index = m_FreeConnections.back();
+			m_FreeConnections.pop_back();
+			m_Connections[cinf->index] = cinf;
+		}
+		else
+		{
+			cinf->index = (uint32_t)m_Connections.size();
+			m_Connections.push_back(cinf);
+		}
+
+		// packets are routed without the lock, so an outgrown index is kept until they're done with it
+		CGUIDIndex::STable *retired;
+		m_ConnectionIndex.Insert(cinf->id, cinf->index, &retired);
+
+		m_ConnectionLock.unlock();
+
+		if (retired)
+			m_RoutingTable.Defer(FreeIndexTable, nullptr, (uintptr_t)retired);
+
+		return true;
+	}
+
+	// what the channels a connection joins need to know about it
+	SMember MemberOf(SConnectionInfo *cinf)
+	{
+		SMember m;
+		m.m_Index = cinf->index;
+		m.m_Reactor = (uint32_t)cinf->reactor->index;
+		m.m_Socket = cinf->sock;
+		m.m_Queue = cinf->batch;
+		m.m_Context = cinf;
+		m.m_Filter = nullptr;
+
+		return m;
+	}
+
+	// called by the routing table once a closed connection can't be seen by anyone routing a packet;
+	// only then are its record and queue freed, and its index handed out again
+	static void FreeConnection(void *context, uintptr_t value)
+	{
+		CCoreServer *_this = (CCoreServer *)context;
+		SConnectionInfo *cinf = (SConnectionInfo *)value;
 
-			// time to start over?
-			if (it == _this->m_ConnectionMap.end())
-				it = _this->m_ConnectionMap.begin();
+		_this->m_ConnectionLock.lock();
+		_this->m_FreeConnections.push_back(cinf->index);
+		_this->m_ConnectionLock.unlock();
 
-			HANDLE event = it->second.ev;
-			SOCKET sock = it->second.sock;
+		delete cinf->batch;
+		delete cinf->interests.load();
+		delete cinf;
+	}
+
+	static void FreeFilter(void *context, uintptr_t value)
+	{
+		delete (const SInterestFilter *)value;
+	}
+
+	// returns the id that filters judge a packet by: a fragment's is the message's
+	static FOURCHARCODE FilterID(CPacket *ppkt)
+	{
+		FOURCHARCODE id = ppkt->GetID();
+
+		if ((id == PACKETID_FRAGMENT) && (ppkt->GetDataLength() >= sizeof(SFragmentHeader)))
+			memcpy(&id, ppkt->GetData() + offsetof(SFragmentHeader, m_ID), sizeof(FOURCHARCODE));
+
+		return id;
+	}
+
+	// returns true if the member wants packets with the given id from the channel
+	static bool Wants(const SMember &m, FOURCHARCODE id)
+	{
+		// negotiation always gets through
+		if (id == PACKETID_HEADERMODE)
+			return true;
+
+		const SInterestFilter *filter = m.m_Filter ? m.m_Filter : ((const SConnectionInfo *)m.m_Context)->interests.load(std::memory_order_acquire);
+
+		return !filter || filter->Passes(id);
+	}
 
-			// there's no data... go to the next connection
-			waitret = WSAWaitForMultipleEvents(1, &event, false, 0, true);
-			if (waitret == WSA_WAIT_TIMEOUT)
+	// takes the client's list of the ids it has handlers for
+	void SetInterests(SConnectionInfo &cinf, CPacket *ppkt)
+	{
+		// an empty list means it wants everything
+		SInterestFilter *filter = nullptr;
+		if (ppkt->GetDataLength() >= sizeof(FOURCHARCODE))
+			filter = new SInterestFilter(true, (const FOURCHARCODE *)ppkt->GetData(), ppkt->GetDataLength() / sizeof(FOURCHARCODE));
+
+		// whoever is queueing to it may still be looking at the old one
+		const SInterestFilter *old = cinf.interests.exchange(filter);
+		if (old)
+			m_RoutingTable.Defer(FreeFilter, nullptr, (uintptr_t)old);
+	}
+
+	static void FreeIndexTable(void *context, uintptr_t value)
+	{
+		CGUIDIndex::FreeTable((CGUIDIndex::STable *)value);
+	}
+
+	// returns the index of the connection with the given GUID, or GUIDINDEX_NONE; either hold
+	// m_ConnectionLock or a routing table reader
+	uint32_t FindConnection(const GUID &id) const
+	{
+		return m_ConnectionIndex.Find(id);
+	}
+
+	// answers a client's PACKETID_HEADERMODE packet
+	void NegotiateHeaders(GUID client, SConnectionInfo &cinf, CPacket *ppkt)
+	{
+		if (!m_CompactHeaders || !ppkt->GetDataLength())
+			return;
+
+		BYTE mode = *ppkt->GetData();
+
+		if (mode & HEADERMODE_SWITCHING)
+		{
+			// everything from the client after this is compact
+			if (!cinf.dec)
+				cinf.dec = new CCompactHeaderDecoder();
+		}
+		else if (mode & HEADERMODE_COMPACT)
+		{
+			// the client understands compact headers, so tell it that we're switching; the send
+			// thread switches our side once this has gone out
+			CPacket *reply = (CPacket *)ICorePacket::NewPacket(1);
+			if (reply)
 			{
-				Sleep(0);
-				++it;
-				continue;
+				BYTE replymode = HEADERMODE_COMPACT | HEADERMODE_SWITCHING;
+				reply->SetData(PACKETID_HEADERMODE, 1, &replymode);
+				reply->SetContext(client);
+				SendPacket(reply);
 			}
+		}
+	}
+
+	// hands a packet to the reactors that own at least one listener on its channel (other than
+	// the packet's sender). Takes the caller's reference
+	void Route(CPacket *ppkt)
+	{
+		// compress once here, rather than in every reactor
+		ppkt = m_Compression.Apply(ppkt);
+
+		// the reactors can't wait for a queue to drain (they're the ones draining them), so only
+		// the application's own packets are held back
+		if ((m_OverflowPolicy == OP_BLOCK) && (m_QueueBytes || m_QueuePackets) && !t_IsReactor)
+			WaitForRoom(ppkt);
 
-			WSANETWORKEVENTS ne;
-			if (WSAEnumNetworkEvents(sock, event, &ne) == 0)
+		// one bit for each reactor that gets it
+		uint64_t targets = 0;
+
+		// search the routing table for the channel given in the packet
+		CRoutingTable::CReader rr(m_RoutingTable);
+		const SMemberList *members = rr.Find(ppkt->GetContext());
+		if (members)
+		{
+			uint32_t sender = FindConnection(ppkt->GetSender());
+
+			// each reactor's members are together, so only the first of each needs looking at
+			size_t b = 0, e;
+			while (b < members->m_Members.size())
 			{
-				// is there data to read?
-				if (ne.lNetworkEvents & FD_READ)
-				{
-					SPacketHeader pkthdr;
-					memset(&pkthdr, 0, sizeof(SPacketHeader));
+				uint32_t ri = members->m_Members[b].m_Reactor;
+				members->ForReactor(ri, &b, &e);
 
-					WSABUF buf;
-					DWORD flags = 0;
-					DWORD rct = 0;
+				// the sender alone doesn't need it back
+				if (((e - b) > 1) || (members->m_Members[b].m_Index != sender))
+					targets |= (uint64_t)1 << ri;
 
-					// receive the packet header
-					buf.buf = (char *)&pkthdr;
-					buf.len = sizeof(SPacketHeader);
-					int recvres = WSARecv(it->second.sock, &buf, 1, &rct, &flags, NULL, NULL);
+				b = e;
+			}
+		}
 
-					if (recvres != SOCKET_ERROR)
-					{
-						CPacket *ppkt = (CPacket *)mqme::ICorePacket::NewPacket();
+		for (size_t i = 0; targets; i++, targets >>= 1)
+		{
+			if (targets & 1)
+			{
+				SReactor *r = m_Reactors[i];
 
-						// allocate space in the packet
-						ppkt->SetData(pkthdr.m_ID, pkthdr.m_DataLength, NULL);
-						ppkt->SetContext(pkthdr.m_Context);
-						ppkt->SetSender(it->first);
+				ppkt->IncRef();
+				r->outgoing.Enque(ppkt);
 
-						// receive the rest of the packet if size was > 0
-						buf.buf = (char *)ppkt->GetData();
-						buf.len = ppkt->GetDataLength();
-						if (buf.len > 0)
-						{
-							recvres = WSARecv(it->second.sock, &buf, 1, &rct, &flags, NULL, NULL);
-						}
+				// only bother waking it if it's asleep (or about to be)
+				if (r->waiting)
+					r->poller.Wake();
+			}
+		}
 
-						if (recvres != SOCKET_ERROR)
-						{
-							GUID serverguid = { 0 };
+		ppkt->Release();
+	}
 
-							if (pkthdr.m_Context != serverguid)
-							{
-								// if the context exists
-								TGUIDSetMap::iterator rit = _this->m_RoutingTable.find(pkthdr.m_Context);
-								if (rit != _this->m_RoutingTable.end())
-								{
-									size_t num_listeners = rit->second.Size();
-
-									// want to make sure that there's at least one client to route to,
-									// but also that we're not re-transmitting to a single client - the sender
-									if ((num_listeners > 1) || (!rit->second.Contains(ppkt->GetSender())))
-									{
-										// increment the ref count if we re-transmit to other listeners
-										ppkt->IncRef();
-
-										_this->m_Outgoing.Enque(ppkt);
-									}
-								}
-							}
+	// waits until every listener the packet is going to has room for it in its queue, the server
+	// is stopping, or ROOM_WAIT_MS has gone by (when it goes anyway). Only the reactors make room,
+	// so it sleeps until one has been round again rather than looking all the time
+	void WaitForRoom(CPacket *ppkt)
+	{
+		uint64_t len = ppkt->GetHeaderLength() + ppkt->GetDataLength();
 
-							// if we have a registered packet handler, then schedule it to run
-							TPacketHandlerMap::iterator phit = _this->m_PacketHandlerMap.find(ppkt->GetID());
-							if (phit != _this->m_PacketHandlerMap.end())
-								g_ThreadPool->RunTask(ProcessPacket, (void *)_this, (void *)ppkt);
-						}
-					}
-					else switch (WSAGetLastError())
-					{
-						case WSAENOTCONN:
-						case WSAESHUTDOWN:
-						case WSAECONNABORTED:
-						case WSAECONNRESET:
-						{
-							break;
-						}
-					}
+		uint32_t sender = FindConnection(ppkt->GetSender());
+		FOURCHARCODE id = FilterID(ppkt);
+
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ROOM_WAIT_MS);
+
+		// counted before anything is looked at, so that a reactor that makes room after we've
+		// looked is sure to see us and wake us
+		m_RoomWaiters++;
+
+		// the listeners before the one we stopped at had room when we looked, so rather than go over
+		// them all again, the next look starts where this one stopped (unless the channel has changed
+		// since). One that fills up again meanwhile takes the packet over its limit, as it would a
+		// relayed one
+		const SMemberList *last = nullptr;
+		size_t next = 0;
+
+		while (true)
+		{
+			// read before the quit event, which is set before the waiters are woken for the last time
+			uint64_t generation = m_RoomGeneration;
+			if (WaitForSingleObject(m_QuitEvent, 0) == WAIT_OBJECT_0)
+				break;
 
-					WSAResetEvent(event);
+			bool full = false, report = false;
+			GUID slow;
+
+			{
+				CRoutingTable::CReader rr(m_RoutingTable);
+				const SMemberList *members = rr.Find(ppkt->GetContext());
+
+				if (members != last)
+				{
+					last = members;
+					next = 0;
 				}
-				else if (ne.lNetworkEvents & FD_CLOSE)
+
+				for (; members && (next < members->m_Members.size()); next++)
 				{
-					_this->m_ListeningLock.lock();
-					_this->m_RoutingLock.lock();
+					// listeners that won't be sent it don't hold it up
+					const SMember &m = members->m_Members[next];
+					if ((m.m_Index == sender) || !Wants(m, id) || !m.m_Queue->Overflows(len))
+						continue;
 
-					// find all the channels that this connection is listening to and remove it
-					// from the routing table
-					TGUIDSetMap::iterator lit = _this->m_ListeningTable.find(it->first);
-					if (lit != _this->m_ListeningTable.end())
-					{
-						for (auto &elit : lit->second.m_GUIDSet)
-						{
-							TGUIDSetMap::iterator rit = _this->m_RoutingTable.find(elit);
-							rit->second.Remove(it->first);
-						}
+					full = true;
 
-						_this->m_ListeningTable.erase(lit);
+					// only report it the first time
+					if (m.m_Queue->MarkSlow())
+					{
+						slow = ((const SConnectionInfo *)m.m_Context)->id;
+						report = true;
 					}
 
-					_this->m_RoutingLock.unlock();
-					_this->m_ListeningLock.unlock();
+					break;
+				}
+			}
 
-					closesocket(it->second.sock);
-					CloseHandle(it->second.ev);
+			if (!full)
+				break;
 
-					// if we have a registered packet handler, then schedule it to run
-					auto &peit = _this->m_EventHandlerMap.find(ICoreServer::ET_DISCONNECT);
-					if (peit != _this->m_EventHandlerMap.end())
-						peit->second.func(_this, ICoreServer::ET_DISCONNECT, it->first, peit->second.userdata);
+			if (report)
+				FireEvent(ICoreServer::ET_SLOW_CONSUMER, slow);
 
-					it = _this->m_ConnectionMap.erase(it);
+			// until a reactor has been round, or it's time to give up on it
+			bool timedout = false;
+			{
+				std::unique_lock<std::mutex> l(m_RoomLock);
+				while (!timedout && (m_RoomGeneration == generation))
+					timedout = (m_RoomFreed.wait_until(l, deadline) == std::cv_status::timeout);
+			}
 
-					continue;
+			if (timedout)
+				break;
+		}
+
+		m_RoomWaiters--;
+	}
+
+	// has the SendPacket calls that are waiting for room look again
+	void WakeRoomWaiters()
+	{
+		{
+			std::lock_guard<std::mutex> l(m_RoomLock);
+			m_RoomGeneration++;
+		}
+
+		m_RoomFreed.notify_all();
+	}
+
+	void FireEvent(EEventType ev, GUID generator)
+	{
+		TEventHandlerMap::iterator peit = m_EventHandlerMap.find(ev);
+		if (peit != m_EventHandlerMap.end())
+			peit->second.func(this, ev, generator, peit->second.userdata);
+	}
+
+	// adds the buffers to the queue of every listener on the packet's channel that the reactor
+	// owns, except the packet's sender; queues that fill up are sent right away, the rest by FlushBatches.
+	// A listener whose queue is full gets the overflow policy instead. If there are enough listeners,
+	// they're split into pieces that m_FanoutPool queues to in parallel
+	void SendToListeners(SReactor *r, CPacket *ppkt, WSABUF *buf, DWORD bufct)
+	{
+		const SPacketHeader *hdr = (const SPacketHeader *)buf[0].buf;
+
+		uint64_t len = 0;
+		for (DWORD i = 0; i < bufct; i++)
+			len += buf[i].len;
+
+		// search the routing table for the channel given in the packet
+		CRoutingTable::CReader rr(m_RoutingTable);
+		const SMemberList *members = rr.Find(ppkt->GetHeader()->m_Context);
+		if (!members)
+			return;
+
+		// other reactors take care of their own connections
+		size_t b, e;
+		members->ForReactor((uint32_t)r->index, &b, &e);
+		if (b == e)
+			return;
+
+		CExecutor *pool = m_FanoutPool.load(std::memory_order_acquire);
+
+		size_t count = e - b;
+		size_t chunk = (pool && m_FanoutThreshold && (count > m_FanoutThreshold)) ? m_FanoutThreshold : count;
+		size_t pieces = (count + chunk - 1) / chunk;
+
+		if (r->fanout.size() < pieces)
+			r->fanout.resize(pieces);
+
+		uint32_t sender = FindConnection(ppkt->GetSender());
+		FOURCHARCODE id = FilterID(ppkt);
+
+		for (size_t i = 0; i < pieces; i++)
+		{
+			SFanout &f = r->fanout[i];
+			f.ppkt = ppkt;
+			f.buf = buf;
+			f.bufct = bufct;
+			f.len = len;
+			f.begin = members->m_Members.data() + b + (i * chunk);
+			f.end = members->m_Members.data() + std::min<size_t>(b + ((i + 1) * chunk), e);
+			f.sender = sender;
+			f.id = id;
+
+			// these can't be left out without breaking things for the listener
+			f.required = (hdr->m_ID == PACKETID_FRAGMENT) || (hdr->m_ID == PACKETID_HEADERMODE);
+			f.switching = (hdr->m_ID == PACKETID_HEADERMODE) && (bufct > 1) && buf[1].len && (*(BYTE *)buf[1].buf & HEADERMODE_SWITCHING);
+		}
+
+		// each listener is in exactly one piece, and we don't go on until they're all done, so
+		// everyone's packets still go into their queues in order. The pieces share our reference
+		// to the packet (and the routing table reader), which outlast them; the queues take their own.
+		// Queueing never waits, so neither do we for long
+		if (pieces > 1)
+			pool->RunTask(ProcessFanout, (void *)this, (void *)r->fanout.data(), pieces, true);
+		else
+			QueueToListeners(r->fanout[0]);
+
+		for (size_t i = 0; i < pieces; i++)
+		{
+			SFanout &f = r->fanout[i];
+
+			r->pending.insert(r->pending.end(), f.pending.begin(), f.pending.end());
+			r->slow.insert(r->slow.end(), f.slow.begin(), f.slow.end());
+			r->doomed.insert(r->doomed.end(), f.doomed.begin(), f.doomed.end());
+
+			f.pending.clear();
+			f.slow.clear();
+			f.doomed.clear();
+		}
+	}
+
+	static CExecutor::TASK_RETURN __cdecl ProcessFanout(void *param0, void *param1, size_t task_number)
+	{
+		CCoreServer *_this = (CCoreServer *)param0;
+		SFanout *f = (SFanout *)param1;
+
+		_this->QueueToListeners(f[task_number]);
+
+		return CExecutor::TR_OK;
+	}
+
+	// queues one piece of a packet's fan-out; the listeners' connections are all owned by one reactor,
+	// and only touched by whoever is doing this for it
+	void QueueToListeners(SFanout &f)
+	{
+		for (const SMember *m = f.begin; m != f.end; m++)
+		{
+			if ((m->m_Index == f.sender) || !Wants(*m, f.id))
+				continue;
+
+			SConnectionInfo &cinf = *(SConnectionInfo *)m->m_Context;
+			CSendBatch *batch = m->m_Queue;
+
+			if (batch->Overflows(f.len))
+			{
+				if (batch->MarkSlow())
+					f.slow.push_back(cinf.id);
+
+				bool admit = f.required;
+				switch (m_OverflowPolicy)
+				{
+					// SendPacket has already waited (as long as it would) for room; packets relayed
+					// from clients can't be held back, since that would mean the reactor waiting
+					case OP_BLOCK:
+						admit = true;
+						break;
+
+					case OP_DROP_OLDEST:
+						admit |= batch->DropOldest(f.len);
+						break;
+
+					case OP_DROP_NEWEST:
+						break;
+
+					case OP_DISCONNECT:
+						f.doomed.push_back(&cinf);
+						admit = false;
+						break;
 				}
+
+				if (!admit)
+					continue;
 			}
 
-			it++;
+			if (batch->Empty())
+				f.pending.push_back(&cinf);
+
+			// the header is made compact as it goes into the queue, if this connection has switched to them;
+			// a connection that's waiting for its socket to take more gets written to when it can
+			if (batch->Add(f.ppkt, f.buf, f.bufct, cinf.enc) && !cinf.writing)
+				FlushBatch(cinf);
 
-			Sleep(0);
+			// everything after our switch marker has to be compact
+			if (f.switching && !cinf.enc)
+				cinf.enc = new CCompactHeaderEncoder();
 		}
+	}
 
-		return 0;
+	// sends what the connection's queue holds; if the socket won't take it all, the reactor is
+	// told when it can. A broken connection is left for the reactor to notice as closed
+	void FlushBatch(SConnectionInfo &cinf)
+	{
+		bool blocked = (cinf.batch->Flush(cinf.sock) == SENDBATCH_BLOCKED);
+
+		if (blocked != cinf.writing)
+		{
+			cinf.writing = blocked;
+			cinf.reactor->poller.WatchWrite(cinf.sock, blocked);
+		}
 	}
 
-	static DWORD WINAPI SendThreadProc(void *param)
+	// reports the connections whose queues overflowed, and disconnects the ones the policy says to
+	void HandleOverflows(SReactor *r)
 	{
-		CCoreServer *_this = (CCoreServer *)param;
+		for (auto &id : r->slow)
+			FireEvent(ICoreServer::ET_SLOW_CONSUMER, id);
+		r->slow.clear();
 
-		HANDLE events[1];
-		events[0] = _this->m_QuitEvent;
+		// closing one takes it (and any other mentions of it) off the list
+		while (!r->doomed.empty())
+			CloseConnection(r->doomed.back());
+	}
+
+	// sends the reactor's batches that have waited long enough (all of them if there's no flush
+	// delay, or if forced); returns how many milliseconds until the next one is due, or INFINITE
+	DWORD FlushBatches(SReactor *r, bool force = false)
+	{
+		while (!r->pending.empty())
+		{
+			SConnectionInfo *cinf = r->pending.front();
+
+			// it may have been flushed already because it filled up
+			if (!cinf->batch->Empty())
+			{
+				uint64_t age = cinf->batch->Age();
+				if (!force && m_FlushDelay && (age < m_FlushDelay))
+					return (DWORD)((m_FlushDelay - age + 999) / 1000);
+
+				FlushBatch(*cinf);
+			}
+
+			r->pending.pop_front();
+		}
+
+		return INFINITE;
+	}
+
+	// reads what a connection has waiting and routes and/or handles every complete packet in it;
+	// returns false if the connection turned out to be closed, or sent something malformed
+	bool ReadPackets(SConnectionInfo &cinf)
+	{
+		const GUID &id = cinf.id;
+
+		if (!cinf.reader->Read(cinf.sock))
+			return false;
+
+		bool malformed = false;
+		CPacket *ppkt;
+
+		// the decoder is looked at for every packet, since negotiation can switch it on part way through
+		while ((ppkt = cinf.reader->Next(cinf.dec, malformed)) != nullptr)
+		{
+			ppkt->SetSender(id);
+
+			if (ppkt->GetID() == PACKETID_HEADERMODE)
+			{
+				// header negotiation is between us and the client; it's never routed or handled
+				NegotiateHeaders(id, cinf, ppkt);
+
+				ppkt->Release();
+				continue;
+			}
+
+			if (ppkt->GetID() == PACKETID_INTEREST)
+			{
+				// so is what the client wants to be sent
+				SetInterests(cinf, ppkt);
+
+				ppkt->Release();
+				continue;
+			}
+
+			GUID serverguid = { 0 };
+
+			// re-transmit to the other listeners on the channel, if there are any; routing gets
+			// its own reference
+			if (ppkt->GetContext() != serverguid)
+			{
+				ppkt->IncRef();
+				Route(ppkt);
+			}
+
+			// if we have registered handlers, then schedule them to run; our reference
+			// goes with them, otherwise we're done with the packet
+			if (ppkt->GetID() == PACKETID_FRAGMENT)
+			{
+				DispatchFragment(cinf.reactor, ppkt);
+			}
+			else
+			{
+				CDispatchTable::CReader hr(m_Handlers);
+				const SDispatchEntry *e = hr.Find(ppkt->GetID());
+				if (e)
+					m_Handlers.Dispatch(e, ppkt, false, ProcessPacket, cinf.reactor->batches);
+				else
+					ppkt->Release();
+			}
+		}
+
+		return !malformed;
+	}
+
+	// forgets about a connection that has been closed or lost; only called by the connection's reactor
+	void CloseConnection(SConnectionInfo *cinf)
+	{
+		// once it can't be found, it can't join any more channels
+		m_ConnectionLock.lock();
+		m_ConnectionIndex.Erase(cinf->id);
+		m_Connections[cinf->index] = nullptr;
+		m_ConnectionLock.unlock();
+
+		m_ListeningLock.lock();
+
+		// find all the channels that this connection is listening to and remove it
+		// from the routing table
+		TGUIDSetMap::iterator lit = m_ListeningTable.find(cinf->id);
+		if (lit != m_ListeningTable.end())
+		{
+			for (auto &elit : lit->second.m_GUIDSet)
+				m_RoutingTable.Remove(elit, cinf->index);
+
+			m_ListeningTable.erase(lit);
+		}
+
+		m_ListeningLock.unlock();
+
+		// any large messages it was in the middle of sending will never be finished
+		m_Assembler.Discard(cinf->id);
+
+		SReactor *r = cinf->reactor;
+		r->pending.erase(std::remove(r->pending.begin(), r->pending.end(), cinf), r->pending.end());
+		r->doomed.erase(std::remove(r->doomed.begin(), r->doomed.end(), cinf), r->doomed.end());
+		r->connections--;
+
+		r->poller.Remove(cinf->sock);
+		closesocket(cinf->sock);
+
+		// what's waiting to go out never will
+		cinf->batch->Clear();
+
+		delete cinf->reader;
+		delete cinf->enc;
+		delete cinf->dec;
+
+		// if we have a registered packet handler, then schedule it to run
+		FireEvent(ICoreServer::ET_DISCONNECT, cinf->id);
+
+		// other threads may still be looking at it (e.g. to see whether its queue is full) through
+		// the channels it was in, so the rest waits until they can't be
+		m_RoutingTable.Defer(FreeConnection, this, (uintptr_t)cinf);
+	}
+
+	static DWORD WINAPI ReactorThreadProc(void *param)
+	{
+		SReactor *r = (SReactor *)param;
+		CCoreServer *_this = r->server;
+
+		t_IsReactor = true;
+
+		SPollEvent ready[POLL_BATCH_SIZE];
+
+		// large packets that are going out a piece at a time
+		std::deque<SLargeSend> large;
+
+		DWORD flushtime = INFINITE;
 
 		while (true)
 		{
-			DWORD waitret = WSAWaitForMultipleEvents(1, events, false, 0, true);
-			if (waitret == WSA_WAIT_EVENT_0)
+			// is it time to quit?
+			DWORD waitret = WaitForSingleObject(_this->m_QuitEvent, 0);
+			if (waitret == WAIT_OBJECT_0)
 				break;
 
-			CPacket *ppkt = _this->m_Outgoing.Deque();
-			if (ppkt)
+			// sleep until some connections have data (or have been closed) or we're given packets
+			// to send - but don't wait around if we're in the middle of sending something large,
+			// and only until it's time to flush if there's a batch waiting
+			DWORD timeout = large.empty() ? flushtime : 0;
+
+			r->waiting = true;
+			if (!r->outgoing.Empty())
+				timeout = 0;
+
+			size_t readyct = r->poller.Wait(ready, POLL_BATCH_SIZE, timeout);
+
+			r->waiting = false;
+
+			for (size_t i = 0; i < readyct; i++)
 			{
-				// search the routing table for the channel given in the packet
-				TGUIDSetMap::iterator cit = _this->m_RoutingTable.find(ppkt->GetHeader()->m_Context);
-				if (cit != _this->m_RoutingTable.end())
-				{
-					// there are listeners on the given channel
+				SConnectionInfo *cinf = (SConnectionInfo *)ready[i].m_Context;
+				if (!cinf)
+					continue;
 
-					WSABUF buf[2];
-					buf[0].buf = (char *)ppkt->GetHeader();
-					buf[0].len = ppkt->GetHeaderLength();
-					buf[1].buf = (char *)ppkt->GetData();
-					buf[1].len = ppkt->GetDataLength();
+				bool open = !ready[i].m_Closed;
 
-					// send the packet to each listener
-					for (auto &git : cit->second.m_GUIDSet)
-					{
-						if (git == ppkt->GetSender())
-							continue;
+				// read whatever is still there before noticing that it's closed
+				if (ready[i].m_Readable)
+					open = _this->ReadPackets(*cinf);
 
-						// get the socket for the listener's GUID
-						auto &sit = _this->m_ConnectionMap.find(git);
-						if (sit != _this->m_ConnectionMap.end())
-						{
-							DWORD sct;
-							int sendret = WSASend(sit->second.sock, buf, 2, &sct, 0, nullptr, nullptr);
+				// the socket has room again for what's been waiting
+				if (open && ready[i].m_Writable)
+					_this->FlushBatch(*cinf);
 
-							if (sendret == SOCKET_ERROR)
-							{
-								switch (WSAGetLastError())
-								{
-									case WSAENOTCONN:
-									case WSAESHUTDOWN:
-									case WSAECONNABORTED:
-									case WSAECONNRESET:
-										break;
-								}
-							}
-						}
-					}
+				// only this reactor closes its connections, so it's still there
+				if (!open)
+					_this->CloseConnection(cinf);
+			}
+
+			// batch up everything that's waiting, setting aside packets too big to go out whole
+			CPacket *ppkt;
+			while ((ppkt = r->outgoing.Deque()) != nullptr)
+			{
+				if (_this->m_MaxChunkSize && (ppkt->GetDataLength() > _this->m_MaxChunkSize))
+				{
+					large.push_back(SLargeSend(ppkt, 0x80000000 | (_this->m_NextMessageID++ & 0x7FFFFFFF)));
+					continue;
 				}
 
+				WSABUF buf[2];
+				buf[0].buf = (char *)ppkt->GetHeader();
+				buf[0].len = ppkt->GetHeaderLength();
+				buf[1].buf = (char *)ppkt->GetData();
+				buf[1].len = ppkt->GetDataLength();
+
+				_this->SendToListeners(r, ppkt, buf, 2);
+
 				ppkt->Release();
 			}
-			else
+
+			// then one piece of each large packet, so that nothing else waits behind them for long
+			std::deque<SLargeSend>::iterator lit = large.begin();
+			while (lit != large.end())
 			{
-				Sleep(0);
+				SPacketHeader hdr;
+				SFragmentHeader fh;
+				WSABUF buf[3];
+				bool last = lit->NextChunk(_this->m_MaxChunkSize ? _this->m_MaxChunkSize : UINT32_MAX, &hdr, &fh, buf);
+
+				_this->SendToListeners(r, lit->m_Packet, buf, 3);
+
+				if (last)
+				{
+					lit->m_Packet->Release();
+					lit = large.erase(lit);
+				}
+				else
+				{
+					++lit;
+				}
 			}
+
+			// everything that was queued has been batched up, so now it goes out
+			flushtime = _this->FlushBatches(r);
+
+			// and batch handlers get what's been read for them, unless they're waiting for more
+			flushtime = std::min<DWORD>(flushtime, _this->m_Handlers.Flush(r->batches));
+
+			_this->HandleOverflows(r);
+
+			// what went out (or was dropped, or closed) may have made room for SendPacket calls
+			// that are waiting; the queues have shrunk before this looks, so none can be missed
+			if (_this->m_RoomWaiters)
+				_this->WakeRoomWaiters();
 		}
 
+		for (auto &it : large)
+			it.m_Packet->Release();
+
+		_this->FlushBatches(r, true);
+		_this->m_Handlers.Flush(r->batches, true);
+
 		return 0;
 	}
 };
@@ -0,0 +1,478 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "DispatchTable.h"
+#include <algorithm>
+
+
+// the smallest table is 2^this many slots, and a table has at least twice as many slots as entries
+#define DISPATCH_MIN_BITS			3
+
+// multipliers are odd multiples of this one; if none of this many gives every id a slot of its
+// own, the table gets bigger
+#define DISPATCH_MULTIPLIER			0x9E3779B1
+#define DISPATCH_TRIES				64
+
+extern CExecutor *g_ThreadPool;
+
+
+CDispatchTable::CDispatchTable(void *owner)
+{
+	m_Owner = owner;
+
+	STable *t = new STable;
+	Fill(t, DISPATCH_MIN_BITS, DISPATCH_MULTIPLIER);
+	t->m_Default = nullptr;
+
+	m_Table = t;
+
+	m_Epoch = 0;
+	m_Readers[0].m_Count = 0;
+	m_Readers[1].m_Count = 0;
+
+	m_Counters.m_Pooled = 0;
+	m_Counters.m_Ordered = 0;
+	m_Counters.m_Inlined = 0;
+	m_Counters.m_Batches = 0;
+}
+
+
+CDispatchTable::~CDispatchTable()
+{
+	// nobody can be reading any more, so everything goes
+	for (auto &r : m_Retired)
+	{
+		delete r.m_Table;
+		if (r.m_Entry)
+			Release(r.m_Entry);
+	}
+	m_Retired.clear();
+
+	const STable *t = m_Table;
+
+	for (auto e : t->m_Entries)
+		Release(e);
+
+	if (t->m_Default)
+		Release(t->m_Default);
+
+	delete t;
+}
+
+
+void CDispatchTable::AddPacketHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags)
+{
+	Add(id, false, HK_PACKET, func, userdata, flags);
+}
+
+
+void CDispatchTable::AddStreamHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags)
+{
+	Add(id, false, HK_STREAM, func, userdata, flags);
+}
+
+
+void CDispatchTable::AddBatchHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags, uint32_t max_count, uint32_t max_delay_us)
+{
+	Add(id, false, HK_BATCH, func, userdata, flags, max_count, max_delay_us);
+}
+
+
+void CDispatchTable::AddDefaultHandler(void *func, void *userdata, uint32_t flags)
+{
+	Add(0, true, HK_PACKET, func, userdata, flags);
+}
+
+
+bool CDispatchTable::GetIDs(std::vector<FOURCHARCODE> &ids)
+{
+	CReader r(*this);
+
+	const STable *t = m_Table.load(std::memory_order_acquire);
+
+	for (auto e : t->m_Entries)
+		ids.push_back(e->m_ID);
+
+	return (t->m_Default != nullptr);
+}
+
+
+bool CDispatchTable::Fill(STable *t, uint32_t bits, uint32_t multiplier)
+{
+	SSlot empty = { 0, nullptr };
+	t->m_Slots.assign((size_t)1 << bits, empty);
+	t->m_Multiplier = multiplier;
+	t->m_Shift = 32 - bits;
+
+	for (auto e : t->m_Entries)
+	{
+		SSlot &s = t->m_Slots[(uint32_t)(e->m_ID * multiplier) >> t->m_Shift];
+		if (s.m_Entry)
+			return false;
+
+		s.m_ID = e->m_ID;
+		s.m_Entry = e;
+	}
+
+	return true;
+}
+
+
+// which of the executor's lanes the group's tasks go in
+static inline CExecutor::ELane Lane(const SDispatchGroup &g)
+{
+	return (g.m_Flags & HF_HIGH_PRIORITY) ? CExecutor::EL_HIGH : CExecutor::EL_NORMAL;
+}
+
+
+// returns true if the group has handlers for the packet
+static inline bool Wants(const SDispatchGroup &g, bool piece)
+{
+	if (piece)
+		return !g.m_Stream.empty();
+
+	return !g.m_Packet.empty() || !g.m_Batch.empty() || (g.m_Whole && !g.m_Stream.empty());
+}
+
+
+void CDispatchTable::Dispatch(const SDispatchEntry *e, CPacket *ppkt, bool piece, CExecutor::TASK_CALLBACK func, SBatches &batches)
+{
+	size_t n = 0, tasks = 0;
+	for (const auto &g : e->m_Groups)
+	{
+		if (Wants(g, piece))
+		{
+			n++;
+			if (!(g.m_Flags & DISPATCH_BATCH))
+				tasks++;
+		}
+	}
+
+	if (!n)
+	{
+		ppkt->Release();
+		return;
+	}
+
+	// each task keeps the entry until it has run
+	if (tasks)
+		e->m_Refs.fetch_add(tasks, std::memory_order_relaxed);
+
+	for (const auto &g : e->m_Groups)
+	{
+		if (!Wants(g, piece))
+			continue;
+
+		// every group but the last gets a reference of its own; the last one gets the caller's
+		if (--n)
+			ppkt->IncRef();
+
+		if (g.m_Flags & DISPATCH_BATCH)
+		{
+			SBatch *b = nullptr;
+			for (auto it : batches.m_Open)
+			{
+				if (it->m_Group == &g)
+					b = it;
+			}
+
+			if (!b)
+			{
+				// and each batch, until it has been handed over and done with
+				e->m_Refs.fetch_add(1, std::memory_order_relaxed);
+
+				b = new SBatch();
+				b->m_Group = &g;
+				b->m_Started = std::chrono::steady_clock::now();
+				batches.m_Open.push_back(b);
+			}
+
+			b->m_Packets.push_back(ppkt);
+
+			if (g.m_MaxBatch && (b->m_Packets.size() >= g.m_MaxBatch))
+			{
+				batches.m_Open.erase(std::find(batches.m_Open.begin(), batches.m_Open.end(), b));
+				Hand(batches, b);
+			}
+		}
+		else if (g.m_Flags & HF_INLINE)
+		{
+			m_Counters.m_Inlined.fetch_add(1, std::memory_order_relaxed);
+			func((void *)&g, (void *)ppkt, 0);
+		}
+		else if (g.m_Flags & (HF_ORDER_BY_SENDER | HF_ORDER_BY_CONTEXT))
+		{
+			m_Counters.m_Ordered.fetch_add(1, std::memory_order_relaxed);
+			m_Strands.Post((g.m_Flags & HF_ORDER_BY_SENDER) ? ppkt->GetSender() : ppkt->GetContext(), func, (void *)&g, (void *)ppkt, Lane(g));
+		}
+		else
+		{
+			m_Counters.m_Pooled.fetch_add(1, std::memory_order_relaxed);
+			g_ThreadPool->RunTask(func, (void *)&g, (void *)ppkt, 1, false, Lane(g));
+		}
+	}
+}
+
+
+DWORD CDispatchTable::Flush(SBatches &batches, bool force)
+{
+	DWORD next = INFINITE;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	std::vector<SBatch *>::iterator it = batches.m_Open.begin();
+	while (it != batches.m_Open.end())
+	{
+		SBatch *b = *it;
+
+		uint64_t age = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - b->m_Started).count();
+		if (!force && (age < b->m_Group->m_BatchDelay))
+		{
+			next = std::min<DWORD>(next, (DWORD)((b->m_Group->m_BatchDelay - age + 999) / 1000));
+			++it;
+			continue;
+		}
+
+		it = batches.m_Open.erase(it);
+		Hand(batches, b);
+	}
+
+	return next;
+}
+
+
+void CDispatchTable::Hand(SBatches &batches, SBatch *b)
+{
+	const SDispatchGroup *g = b->m_Group;
+
+	m_Counters.m_Batches.fetch_add(1, std::memory_order_relaxed);
+
+	// a receiving thread gets each sender's packets in order, so keeping its batches in order is
+	// enough to keep them in order too
+	if (g->m_Flags & HF_INLINE)
+	{
+		m_Counters.m_Inlined.fetch_add(b->m_Packets.size(), std::memory_order_relaxed);
+		batches.m_Func((void *)g, (void *)b, 0);
+	}
+	else if (g->m_Flags & HF_ORDER_BY_SENDER)
+	{
+		m_Counters.m_Ordered.fetch_add(b->m_Packets.size(), std::memory_order_relaxed);
+		m_Strands.Post(batches.m_Key, batches.m_Func, (void *)g, (void *)b, Lane(*g));
+	}
+	else
+	{
+		m_Counters.m_Pooled.fetch_add(b->m_Packets.size(), std::memory_order_relaxed);
+		g_ThreadPool->RunTask(batches.m_Func, (void *)g, (void *)b, 1, false, Lane(*g));
+	}
+}
+
+
+void CDispatchTable::GetStats(SHandlerStats *stats) const
+{
+	stats->pooled = m_Counters.m_Pooled.load(std::memory_order_relaxed);
+	stats->ordered = m_Counters.m_Ordered.load(std::memory_order_relaxed);
+	stats->inlined = m_Counters.m_Inlined.load(std::memory_order_relaxed);
+	stats->batches = m_Counters.m_Batches.load(std::memory_order_relaxed);
+}
+
+
+void CDispatchTable::Add(FOURCHARCODE id, bool def, EHandlerKind kind, void *func, void *userdata, uint32_t flags, uint32_t max_count, uint32_t max_delay_us)
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	const STable *cur = m_Table;
+
+	const SDispatchEntry *old = cur->m_Default;
+	if (!def)
+	{
+		const SSlot &s = cur->m_Slots[(uint32_t)(id * cur->m_Multiplier) >> cur->m_Shift];
+		old = (s.m_Entry && (s.m_ID == id)) ? s.m_Entry : nullptr;
+	}
+
+	// a packet can only be in one order, and inline handlers are already in the order they're received
+	// (and never wait for a worker, so they have no priority either)
+	if (flags & HF_INLINE)
+		flags &= ~(HF_ORDER_BY_SENDER | HF_ORDER_BY_CONTEXT | HF_HIGH_PRIORITY);
+	else if (flags & HF_ORDER_BY_SENDER)
+		flags &= ~HF_ORDER_BY_CONTEXT;
+
+	// a batch can hold packets from any number of contexts, so its order is the order they were received in
+	if (kind == HK_BATCH)
+	{
+		if (flags & HF_ORDER_BY_CONTEXT)
+			flags = (flags & ~HF_ORDER_BY_CONTEXT) | HF_ORDER_BY_SENDER;
+
+		flags |= DISPATCH_BATCH;
+	}
+	else
+	{
+		flags &= ~DISPATCH_BATCH;
+		max_count = 0;
+		max_delay_us = 0;
+	}
+
+	// entries are never changed once published, so the handler goes into a copy
+	SDispatchEntry *e = new SDispatchEntry();
+	e->m_ID = id;
+	e->m_Refs = 1;
+	if (old)
+		e->m_Groups = old->m_Groups;
+
+	SDispatchGroup *g = nullptr;
+	for (auto &it : e->m_Groups)
+	{
+		if ((it.m_Flags == flags) && (it.m_MaxBatch == max_count) && (it.m_BatchDelay == max_delay_us))
+			g = &it;
+	}
+
+	if (!g)
+	{
+		e->m_Groups.push_back(SDispatchGroup());
+		g = &e->m_Groups.back();
+		g->m_Owner = m_Owner;
+		g->m_Flags = flags;
+		g->m_MaxBatch = max_count;
+		g->m_BatchDelay = max_delay_us;
+	}
+
+	SHandler h = { func, userdata };
+	switch (kind)
+	{
+		case HK_PACKET:
+			g->m_Packet.push_back(h);
+			break;
+
+		case HK_STREAM:
+			g->m_Stream.push_back(h);
+			break;
+
+		case HK_BATCH:
+			g->m_Batch.push_back(h);
+			break;
+	}
+
+	bool packet = false;
+	for (const auto &it : e->m_Groups)
+	{
+		if (!it.m_Packet.empty() || !it.m_Batch.empty())
+			packet = true;
+	}
+
+	e->m_Stream = false;
+	for (auto &it : e->m_Groups)
+	{
+		it.m_Entry = e;
+		it.m_Whole = !packet;
+		if (!it.m_Stream.empty())
+			e->m_Stream = true;
+	}
+
+	STable *t = new STable;
+	t->m_Default = def ? e : cur->m_Default;
+	t->m_Entries = cur->m_Entries;
+
+	if (!def)
+	{
+		if (old)
+			std::replace(t->m_Entries.begin(), t->m_Entries.end(), old, (const SDispatchEntry *)e);
+		else
+			t->m_Entries.push_back(e);
+	}
+
+	uint32_t bits = DISPATCH_MIN_BITS;
+	while (((size_t)1 << bits) < (t->m_Entries.size() * 2))
+		bits++;
+
+	// with all 32 bits, any odd multiplier gives every id its own slot, so this always ends
+	bool filled = false;
+	while (!filled)
+	{
+		for (uint32_t n = 0; (n < DISPATCH_TRIES) && !filled; n++)
+			filled = Fill(t, bits, DISPATCH_MULTIPLIER * ((n * 2) + 1));
+
+		if (!filled)
+			bits++;
+	}
+
+	// the table is complete before anyone can see it
+	m_Table.store(t, std::memory_order_release);
+
+	Retire(cur, old);
+
+	Reclaim();
+}
+
+
+void CDispatchTable::Done(const SDispatchGroup *g)
+{
+	Release(g->m_Entry);
+}
+
+
+void CDispatchTable::Release(const SDispatchEntry *e)
+{
+	if (e->m_Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete e;
+}
+
+
+void CDispatchTable::Retire(const STable *t, const SDispatchEntry *e)
+{
+	SRetired r;
+	r.m_Table = t;
+	r.m_Entry = e;
+	r.m_Epoch = m_Epoch;
+	m_Retired.push_back(r);
+}
+
+
+void CDispatchTable::Reclaim()
+{
+	uint64_t e = m_Epoch;
+
+	// readers from the epoch before this one share a counter with the next; once they're gone,
+	// the next one can start
+	if (!m_Readers[(e + 1) & 1].m_Count)
+		m_Epoch = ++e;
+
+	// an entry that's out of the table may still be in use by its tasks, which free it when they're done
+	while (!m_Retired.empty() && ((m_Retired.front().m_Epoch + 2) <= e))
+	{
+		delete m_Retired.front().m_Table;
+		if (m_Retired.front().m_Entry)
+			Release(m_Retired.front().m_Entry);
+
+		m_Retired.pop_front();
+	}
+}
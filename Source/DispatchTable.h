@@ -0,0 +1,278 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "Strands.h"
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+// kept in SDispatchGroup::m_Flags for a group of batch handlers, which are never grouped with any others
+#define DISPATCH_BATCH				0x80000000
+
+
+struct sDispatchEntry;
+
+// one registered callback; its owner knows what type of function it really is
+typedef struct sHandler
+{
+	void *m_Func;
+	void *m_UserData;
+} SHandler;
+
+// the handlers of one packet id that were registered with the same flags, which are run together
+// by one task; this is what a worker is handed along with the packet, so that it never has to look
+// anything up
+typedef struct sDispatchGroup
+{
+	void *m_Owner;						// whoever the handlers were registered with
+	struct sDispatchEntry *m_Entry;		// the entry it's part of
+	uint32_t m_Flags;					// EHandlerFlags
+
+	// whether the stream handlers are given packets that arrive whole, which they are if the id
+	// has no packet (or batch) handlers at all
+	bool m_Whole;
+
+	// for batch handlers, the most packets in a batch (0 for no limit) and how long, in microseconds,
+	// a batch waits for more after its first
+	uint32_t m_MaxBatch;
+	uint32_t m_BatchDelay;
+
+	// called in the order they were registered
+	std::vector<SHandler> m_Packet;
+	std::vector<SHandler> m_Stream;
+	std::vector<SHandler> m_Batch;
+} SDispatchGroup;
+
+// everything registered for one packet id; once published it never changes
+typedef struct sDispatchEntry
+{
+	FOURCHARCODE m_ID;
+
+	// whether any of its handlers are stream handlers
+	bool m_Stream;
+
+	std::vector<SDispatchGroup> m_Groups;
+
+	// one while it's in the table, and one for each of its groups that a task or an open batch
+	// still has; it's freed when the last goes
+	mutable std::atomic<size_t> m_Refs;
+} SDispatchEntry;
+
+// packets collected for one group of batch handlers; the task that hands them over owns it
+typedef struct sBatch
+{
+	const SDispatchGroup *m_Group;
+	std::vector<ICorePacket *> m_Packets;
+	std::chrono::steady_clock::time_point m_Started;
+} SBatch;
+
+// the batches one receiving thread is collecting
+typedef struct sBatches
+{
+	sBatches(size_t key, CExecutor::TASK_CALLBACK func) { m_Key = key; m_Func = func; }
+
+	// the strand that its ordered batches go through
+	size_t m_Key;
+
+	// run as func(group, batch) for each batch that's handed over
+	CExecutor::TASK_CALLBACK m_Func;
+
+	std::vector<SBatch *> m_Open;
+} SBatches;
+
+
+// CDispatchTable finds the handlers for a packet id with one multiply, one shift and one compare,
+// and runs them. Each registration builds a new, immutable table, picking a multiplier that gives
+// every registered id a slot of its own (a perfect hash), and swaps it in; readers never lock or wait.
+//
+// A replaced table is freed once no reader can still be looking at it, the same way the routing
+// table frees its snapshots. A replaced entry also has to wait for the tasks and batches that were
+// handed its groups, which it counts in m_Refs
+class CDispatchTable
+{
+public:
+	CDispatchTable(void *owner);
+	~CDispatchTable();
+
+	// a reader's view of the table; what it finds stays valid until it goes away, so keep it short-lived
+	class CReader
+	{
+	public:
+		CReader(CDispatchTable &table)
+			: m_Table(table)
+		{
+			m_Slot = (size_t)(m_Table.m_Epoch & 1);
+			m_Table.m_Readers[m_Slot].m_Count++;
+		}
+
+		~CReader()
+		{
+			m_Table.m_Readers[m_Slot].m_Count--;
+		}
+
+		// returns what's registered for id; if nothing is, the default entry, or nullptr if there are
+		// no default handlers either
+		const SDispatchEntry *Find(FOURCHARCODE id) const
+		{
+			const STable *t = m_Table.m_Table.load(std::memory_order_acquire);
+
+			const SSlot &s = t->m_Slots[(uint32_t)(id * t->m_Multiplier) >> t->m_Shift];
+
+			return (s.m_Entry && (s.m_ID == id)) ? s.m_Entry : t->m_Default;
+		}
+
+	protected:
+		CDispatchTable &m_Table;
+		size_t m_Slot;
+	};
+
+	// these may be called from any thread; a packet id may have any number of handlers
+	void AddPacketHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags);
+
+	void AddStreamHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags);
+
+	void AddBatchHandler(FOURCHARCODE id, void *func, void *userdata, uint32_t flags, uint32_t max_count, uint32_t max_delay_us);
+
+	// default handlers get packets that have no handlers of their own
+	void AddDefaultHandler(void *func, void *userdata, uint32_t flags);
+
+	// fills ids with every packet id that has handlers of its own; returns true if there are
+	// default handlers as well
+	bool GetIDs(std::vector<FOURCHARCODE> &ids);
+
+	// has func(group, ppkt) run for each of the entry's groups that has handlers for the packet
+	// (stream handlers, if it's a piece of a larger message), in the order the group asks for -
+	// or runs it right here, if the group is inline. Groups of batch handlers get it added to their
+	// batch in batches instead. e must have been found by a reader that's still around. Takes over
+	// the caller's reference
+	void Dispatch(const SDispatchEntry *e, CPacket *ppkt, bool piece, CExecutor::TASK_CALLBACK func, SBatches &batches);
+
+	// called by func, and by whatever a batch is handed to, once it's done with the group
+	static void Done(const SDispatchGroup *g);
+
+	// hands over the batches that have waited long enough (all of them, if forced); returns how
+	// many milliseconds until the next one is due, or INFINITE
+	DWORD Flush(SBatches &batches, bool force = false);
+
+	void GetStats(SHandlerStats *stats) const;
+
+protected:
+	typedef struct sSlot
+	{
+		FOURCHARCODE m_ID;
+		const SDispatchEntry *m_Entry;	// nullptr if the slot is empty
+	} SSlot;
+
+	typedef struct sTable
+	{
+		uint32_t m_Multiplier;
+		uint32_t m_Shift;
+
+		std::vector<SSlot> m_Slots;
+		const SDispatchEntry *m_Default;
+
+		// every entry in the table, for building the next one
+		std::vector<const SDispatchEntry *> m_Entries;
+	} STable;
+
+	// a table or an entry that has been replaced, and the epoch it was replaced in
+	typedef struct sRetired
+	{
+		const STable *m_Table;
+		const SDispatchEntry *m_Entry;
+		uint64_t m_Epoch;
+	} SRetired;
+
+	enum EHandlerKind
+	{
+		HK_PACKET = 0,
+		HK_STREAM,
+		HK_BATCH,
+
+		HK_NUMKINDS
+	};
+
+	// publishes a new table with the handler added to id's entry (or the default entry)
+	void Add(FOURCHARCODE id, bool def, EHandlerKind kind, void *func, void *userdata, uint32_t flags, uint32_t max_count = 0, uint32_t max_delay_us = 0);
+
+	// hands a batch over to its handlers, in the way they asked for
+	void Hand(SBatches &batches, SBatch *b);
+
+	// gives every entry in t a slot of its own in 2^bits slots, if the multiplier can
+	static bool Fill(STable *t, uint32_t bits, uint32_t multiplier);
+
+	// drops a reference to the entry, freeing it if that was the last
+	static void Release(const SDispatchEntry *e);
+
+	// the rest are only called by writers, holding m_WriteLock
+
+	// hands a table or an entry that has been replaced over to be freed once no reader can see it
+	void Retire(const STable *t, const SDispatchEntry *e);
+
+	// moves the epoch on if it can, and frees whatever it's now safe to
+	void Reclaim();
+
+	std::atomic<const STable *> m_Table;
+
+	void *m_Owner;
+
+	std::atomic<uint64_t> m_Epoch;
+
+	// how many readers are in even and odd epochs, each on its own cache line
+	struct alignas(64) SReaderCount
+	{
+		std::atomic<size_t> m_Count;
+	};
+	SReaderCount m_Readers[2];
+
+	std::deque<SRetired> m_Retired;
+
+	std::mutex m_WriteLock;
+
+	// for the groups that are ordered
+	CStrands m_Strands;
+
+	// written by every receiving thread, so kept away from what they only read
+	struct alignas(64) SCounters
+	{
+		std::atomic<uint64_t> m_Pooled;
+		std::atomic<uint64_t> m_Ordered;
+		std::atomic<uint64_t> m_Inlined;
+		std::atomic<uint64_t> m_Batches;
+	};
+	SCounters m_Counters;
+};
@@ -0,0 +1,299 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "Executor.h"
+#include <algorithm>
+
+
+// the worker that the current thread is, if it is one
+static thread_local void *t_Worker = nullptr;
+
+// what a thread that isn't a worker sleeps on while it waits for its tasks; made the first time
+// it's needed, and used again for every wait after that
+typedef struct sWaitEvent
+{
+	sWaitEvent() { m_Event = NULL; }
+	~sWaitEvent() { if (m_Event) CloseHandle(m_Event); }
+
+	HANDLE m_Event;
+} SWaitEvent;
+
+static thread_local SWaitEvent t_Wait;
+
+
+CExecutor *CExecutor::Create(UINT threads_per_core, INT core_count_adjustment)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+
+	INT cores = std::max<INT>((INT)si.dwNumberOfProcessors + core_count_adjustment, 1);
+
+	return new CExecutor((size_t)cores * std::max<UINT>(threads_per_core, 1));
+}
+
+
+CExecutor::CExecutor(size_t threads)
+{
+	m_Idle = 0;
+	m_Quit = false;
+	m_WakeSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+
+	m_Workers.reserve(threads);
+	for (size_t i = 0; i < threads; i++)
+	{
+		SWorker *w = new SWorker;
+		w->m_Owner = this;
+		w->m_Index = i;
+		w->m_Thread = NULL;
+		m_Workers.push_back(w);
+	}
+
+	// they may steal from each other as soon as they start, so they're all there first
+	for (auto w : m_Workers)
+		w->m_Thread = CreateThread(NULL, 0, WorkerThreadProc, w, 0, NULL);
+}
+
+
+CExecutor::~CExecutor()
+{
+	for (auto w : m_Workers)
+		delete w;
+
+	CloseHandle(m_WakeSemaphore);
+}
+
+
+void CExecutor::Release()
+{
+	m_Quit = true;
+
+	ReleaseSemaphore(m_WakeSemaphore, (LONG)m_Workers.size(), NULL);
+
+	for (auto w : m_Workers)
+	{
+		if (w->m_Thread)
+		{
+			WaitForSingleObject(w->m_Thread, INFINITE);
+			CloseHandle(w->m_Thread);
+		}
+	}
+
+	delete this;
+}
+
+
+bool CExecutor::RunTask(TASK_CALLBACK func, void *param0, void *param1, size_t numtimes, bool block, ELane lane)
+{
+	if (!func || !numtimes || (lane >= EL_NUMLANES))
+		return false;
+
+	std::atomic<size_t> remaining(numtimes);
+
+	// a worker keeps what it posts for itself, where the others can still steal it
+	SWorker *self = (SWorker *)t_Worker;
+	if (self && (self->m_Owner != this))
+		self = nullptr;
+
+	SQueue &q = self ? self->m_Queues[lane] : m_Shared[lane];
+
+	STask t;
+	t.m_Func = func;
+	t.m_Param0 = param0;
+	t.m_Param1 = param1;
+	t.m_Remaining = block ? &remaining : nullptr;
+
+	// any other thread that blocks just sleeps until the last of them is done; the event resets
+	// itself as the wait ends, so it's ready for the next one
+	t.m_Done = NULL;
+	if (block && !self)
+	{
+		if (!t_Wait.m_Event)
+			t_Wait.m_Event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		t.m_Done = t_Wait.m_Event;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(q.m_Lock);
+
+		for (size_t i = 0; i < numtimes; i++)
+		{
+			t.m_Number = i;
+			q.m_Tasks.push_back(t);
+		}
+	}
+
+	for (size_t i = 0, n = std::min<size_t>(numtimes, m_Workers.size()); i < n; i++)
+		Wake();
+
+	if (block)
+	{
+		if (self)
+		{
+			// rather than sit and wait, a worker helps - so that it can't stall the executor by
+			// waiting on work that only it could get to
+			while (remaining.load(std::memory_order_acquire))
+			{
+				STask other;
+				if (Next(self, other))
+					Run(other);
+				else
+					SwitchToThread();
+			}
+		}
+		else
+		{
+			// other threads don't pick up work that isn't theirs - it could be anything, and they
+			// may be in no state to run it (the reactor, for one)
+			WaitForSingleObject(t.m_Done, INFINITE);
+		}
+	}
+
+	return true;
+}
+
+
+bool CExecutor::Take(SQueue &q, STask &t, bool back)
+{
+	std::lock_guard<std::mutex> l(q.m_Lock);
+
+	if (q.m_Tasks.empty())
+		return false;
+
+	if (back)
+	{
+		t = q.m_Tasks.back();
+		q.m_Tasks.pop_back();
+	}
+	else
+	{
+		t = q.m_Tasks.front();
+		q.m_Tasks.pop_front();
+	}
+
+	return true;
+}
+
+
+bool CExecutor::Next(SWorker *w, STask &t)
+{
+	size_t count = m_Workers.size();
+
+	for (size_t lane = 0; lane < EL_NUMLANES; lane++)
+	{
+		if (w && Take(w->m_Queues[lane], t, false))
+			return true;
+
+		if (Take(m_Shared[lane], t, false))
+			return true;
+
+		// the others are tried starting with the next one along, so that thieves spread out
+		size_t start = w ? (w->m_Index + 1) : 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			SWorker *victim = m_Workers[(start + i) % count];
+			if ((victim != w) && Take(victim->m_Queues[lane], t, true))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+void CExecutor::Run(STask &t)
+{
+	t.m_Func(t.m_Param0, t.m_Param1, t.m_Number);
+
+	// whoever is waiting on the event may be gone as soon as it's set, so it's the last thing touched
+	if (t.m_Remaining && (t.m_Remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) && t.m_Done)
+		SetEvent(t.m_Done);
+}
+
+
+void CExecutor::Wake()
+{
+	// claim one of the sleepers, so that each is only woken once
+	size_t idle = m_Idle.load();
+	while (idle && !m_Idle.compare_exchange_weak(idle, idle - 1))
+		;
+
+	if (idle)
+		ReleaseSemaphore(m_WakeSemaphore, 1, NULL);
+}
+
+
+DWORD WINAPI CExecutor::WorkerThreadProc(LPVOID param)
+{
+	SWorker *w = (SWorker *)param;
+	CExecutor *_this = w->m_Owner;
+
+	t_Worker = w;
+
+	while (true)
+	{
+		STask t;
+		if (_this->Next(w, t))
+		{
+			Run(t);
+			continue;
+		}
+
+		// everything that was given to us is done by the time we quit
+		if (_this->m_Quit)
+			break;
+
+		// say we're going to sleep before looking one last time, so that anything posted after
+		// that look will wake us
+		_this->m_Idle++;
+
+		if (_this->Next(w, t))
+		{
+			// take back our count; if someone already took it to wake us, their wake is ours to use up
+			size_t idle = _this->m_Idle.load();
+			while (idle && !_this->m_Idle.compare_exchange_weak(idle, idle - 1))
+				;
+
+			if (!idle)
+				WaitForSingleObject(_this->m_WakeSemaphore, INFINITE);
+
+			Run(t);
+			continue;
+		}
+
+		WaitForSingleObject(_this->m_WakeSemaphore, INFINITE);
+	}
+
+	return 0;
+}
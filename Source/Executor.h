@@ -0,0 +1,135 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+
+// CExecutor runs tasks on a fixed set of worker threads, each of which has its own queue of work
+// for every lane. A worker takes from the front of its own queues first, and once those are empty,
+// from the shared ones that other threads post to, and then from the back of the other workers'
+// queues - so work that piles up on one thread is spread out over the rest without any of them
+// contending for one queue.
+//
+// Every lane a worker looks at is checked before any lower one, so that a task in the high lane
+// (control messages, say) never waits behind a flood of normal ones
+class CExecutor
+{
+public:
+	enum TASK_RETURN
+	{
+		TR_OK = 0,
+		TR_ERROR,
+	};
+
+	typedef TASK_RETURN (__cdecl *TASK_CALLBACK)(void *param0, void *param1, size_t task_number);
+
+	enum ELane
+	{
+		EL_HIGH = 0,
+		EL_NORMAL,
+
+		EL_NUMLANES
+	};
+
+	// starts (the number of cores + core_count_adjustment) * threads_per_core workers; at least one
+	static CExecutor *Create(UINT threads_per_core = 1, INT core_count_adjustment = 0);
+
+	// finishes everything that has been given to it, then stops the workers and frees the executor
+	void Release();
+
+	// runs func(param0, param1, n) for n from 0 to numtimes - 1. If block is set, waits for them all
+	// to finish; a worker helps with whatever work there is in the meantime, any other thread sleeps
+	bool RunTask(TASK_CALLBACK func, void *param0 = nullptr, void *param1 = nullptr, size_t numtimes = 1, bool block = false, ELane lane = EL_NORMAL);
+
+protected:
+	CExecutor(size_t threads);
+	~CExecutor();
+
+	typedef struct sTask
+	{
+		TASK_CALLBACK m_Func;
+		void *m_Param0;
+		void *m_Param1;
+		size_t m_Number;
+
+		// counted down once it has run, if someone is waiting for it
+		std::atomic<size_t> *m_Remaining;
+
+		// set by the last of them to finish, when it's a thread other than a worker that's waiting
+		HANDLE m_Done;
+	} STask;
+
+	typedef struct alignas(64) sQueue
+	{
+		std::mutex m_Lock;
+		std::deque<STask> m_Tasks;
+	} SQueue;
+
+	typedef struct sWorker
+	{
+		CExecutor *m_Owner;
+		size_t m_Index;
+		HANDLE m_Thread;
+
+		SQueue m_Queues[EL_NUMLANES];
+	} SWorker;
+
+	// finds the next task for the given worker (or a thread that isn't one, if nullptr); returns false
+	// if there isn't any work anywhere
+	bool Next(SWorker *w, STask &t);
+
+	static bool Take(SQueue &q, STask &t, bool back);
+
+	static void Run(STask &t);
+
+	// wakes a sleeping worker, if there is one
+	void Wake();
+
+	static DWORD WINAPI WorkerThreadProc(LPVOID param);
+
+	std::vector<SWorker *> m_Workers;
+
+	// what threads other than the workers post
+	SQueue m_Shared[EL_NUMLANES];
+
+	// how many workers are asleep (or about to be) that nobody has woken yet; each wake is one
+	// count of m_WakeSemaphore
+	std::atomic<size_t> m_Idle;
+	HANDLE m_WakeSemaphore;
+
+	std::atomic<bool> m_Quit;
+};
@@ -0,0 +1,218 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "Fragment.h"
+
+
+bool SLargeSend::NextChunk(uint32_t max_chunk_size, SPacketHeader *hdr, SFragmentHeader *fh, WSABUF *buf)
+{
+	uint32_t total = m_Packet->GetDataLength();
+	uint32_t len = std::min<uint32_t>(max_chunk_size, total - m_Offset);
+
+	// the piece travels with the original sender and context, but its own id and length
+	*hdr = *m_Packet->GetHeader();
+	hdr->m_ID = PACKETID_FRAGMENT;
+	hdr->m_DataLength = (uint32_t)sizeof(SFragmentHeader) + len;
+
+	fh->m_MessageID = m_MessageID;
+	fh->m_ID = m_Packet->GetID();
+	fh->m_TotalLength = total | (m_Packet->IsCompressed() ? PACKETFLAG_COMPRESSED : 0);
+	fh->m_Offset = m_Offset;
+
+	buf[0].buf = (char *)hdr;
+	buf[0].len = sizeof(SPacketHeader);
+	buf[1].buf = (char *)fh;
+	buf[1].len = sizeof(SFragmentHeader);
+	buf[2].buf = (char *)m_Packet->GetData() + m_Offset;
+	buf[2].len = len;
+
+	m_Offset += len;
+
+	return (m_Offset >= total);
+}
+
+
+CFragmentAssembler::~CFragmentAssembler()
+{
+	Clear();
+}
+
+
+bool CFragmentAssembler::Parse(CPacket *ppkt, SStreamChunk *chunk, bool *compressed)
+{
+	if (!ppkt || (ppkt->GetID() != PACKETID_FRAGMENT) || (ppkt->GetDataLength() < sizeof(SFragmentHeader)))
+		return false;
+
+	SFragmentHeader fh;
+	memcpy(&fh, ppkt->GetData(), sizeof(SFragmentHeader));
+
+	chunk->id = fh.m_ID;
+	chunk->sender = ppkt->GetSender();
+	chunk->context = ppkt->GetContext();
+	chunk->message = fh.m_MessageID;
+	chunk->total_length = fh.m_TotalLength & PACKETLENGTH_MASK;
+	chunk->offset = fh.m_Offset;
+	chunk->length = ppkt->GetDataLength() - (uint32_t)sizeof(SFragmentHeader);
+	chunk->data = ppkt->GetData() + sizeof(SFragmentHeader);
+
+	if (compressed)
+		*compressed = ((fh.m_TotalLength & PACKETFLAG_COMPRESSED) != 0);
+
+	// the piece has to fit inside the message
+	if ((chunk->offset > chunk->total_length) || (chunk->length > (chunk->total_length - chunk->offset)))
+		return false;
+
+	return true;
+}
+
+
+void CFragmentAssembler::Describe(CPacket *ppkt, SStreamChunk *chunk)
+{
+	chunk->id = ppkt->GetID();
+	chunk->sender = ppkt->GetSender();
+	chunk->context = ppkt->GetContext();
+	chunk->message = 0;
+	chunk->total_length = ppkt->GetDataLength();
+	chunk->offset = 0;
+	chunk->length = chunk->total_length;
+	chunk->data = ppkt->GetData();
+}
+
+
+CPacket *CFragmentAssembler::Add(CPacket *ppkt)
+{
+	SStreamChunk chunk;
+	bool compressed;
+	if (!Parse(ppkt, &chunk, &compressed))
+		return nullptr;
+
+	SMessageKey key;
+	key.m_Sender = chunk.sender;
+	key.m_MessageID = chunk.message;
+
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	TPartialMap::iterator it = m_Partial.find(key);
+	if (it == m_Partial.end())
+	{
+		// a message can only be started by its first piece, and only if there's room for it
+		if (chunk.offset || (chunk.total_length > FRAGMENT_MAX_MESSAGE_SIZE) ||
+			(chunk.total_length > (FRAGMENT_MAX_PARTIAL_BYTES - m_PartialBytes)))
+			return nullptr;
+
+		SPartialMessage pm;
+		pm.m_Packet = (CPacket *)ICorePacket::NewPacket(chunk.total_length);
+		if (!pm.m_Packet)
+			return nullptr;
+
+		pm.m_Packet->SetData(chunk.id, chunk.total_length, NULL);
+		pm.m_Packet->SetContext(chunk.context);
+		pm.m_Packet->SetSender(chunk.sender);
+		pm.m_Packet->SetCompressed(compressed);
+		pm.m_Length = chunk.total_length;
+		pm.m_Received = 0;
+
+		if (pm.m_Packet->GetDataLength() != pm.m_Length)
+		{
+			pm.m_Packet->Release();
+			return nullptr;
+		}
+
+		it = m_Partial.insert(TPartialMap::value_type(key, pm)).first;
+		m_PartialBytes += chunk.total_length;
+	}
+
+	SPartialMessage &pm = it->second;
+
+	if ((chunk.id != pm.m_Packet->GetID()) || (chunk.total_length != pm.m_Length) || (compressed != pm.m_Packet->IsCompressed()) ||
+		(chunk.offset != pm.m_Received) || (chunk.length > (pm.m_Length - pm.m_Received)))
+	{
+		Drop(it);
+		return nullptr;
+	}
+
+	if (chunk.length)
+		memcpy(pm.m_Packet->GetData() + pm.m_Received, chunk.data, chunk.length);
+
+	pm.m_Received += chunk.length;
+
+	if (pm.m_Received < pm.m_Length)
+		return nullptr;
+
+	CPacket *ret = pm.m_Packet;
+	m_PartialBytes -= pm.m_Length;
+	m_Partial.erase(it);
+
+	return ret;
+}
+
+
+CFragmentAssembler::TPartialMap::iterator CFragmentAssembler::Drop(TPartialMap::iterator it)
+{
+	m_PartialBytes -= it->second.m_Length;
+	it->second.m_Packet->Release();
+
+	return m_Partial.erase(it);
+}
+
+
+void CFragmentAssembler::Discard(GUID sender)
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	TPartialMap::iterator it = m_Partial.begin();
+	while (it != m_Partial.end())
+	{
+		if (it->first.m_Sender == sender)
+		{
+			it = Drop(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+
+void CFragmentAssembler::Clear()
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	for (auto &it : m_Partial)
+		it.second.m_Packet->Release();
+
+	m_Partial.clear();
+	m_PartialBytes = 0;
+}
@@ -0,0 +1,119 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include <map>
+#include <mutex>
+
+// the most a message sent in pieces may hold, and the most that the unfinished messages an
+// assembler is putting back together may hold between them; pieces of messages that would go over
+// either are thrown away, since the lengths come off the wire
+#define FRAGMENT_MAX_MESSAGE_SIZE		(256 * 1024 * 1024)
+#define FRAGMENT_MAX_PARTIAL_BYTES		(1024 * 1024 * 1024)
+
+// a large packet that is being sent out a piece at a time
+struct SLargeSend
+{
+	SLargeSend(CPacket *ppkt, uint32_t message_id) { m_Packet = ppkt; m_MessageID = message_id; m_Offset = 0; }
+
+	// fills out hdr, fh, and buf[0..2] to describe the next piece (of at most max_chunk_size bytes)
+	// and advances past it; returns true if that was the last piece
+	bool NextChunk(uint32_t max_chunk_size, SPacketHeader *hdr, SFragmentHeader *fh, WSABUF *buf);
+
+	CPacket *m_Packet;
+	uint32_t m_MessageID;
+	uint32_t m_Offset;
+};
+
+
+// CFragmentAssembler collects the pieces of large messages and puts them back together. A message's
+// pieces are sent in order, so each has to start where the last one ended; a piece that doesn't,
+// or that disagrees with the first about the message, means the message can't be trusted, and
+// what has arrived of it is thrown away
+class CFragmentAssembler
+{
+public:
+	CFragmentAssembler() { m_PartialBytes = 0; }
+	virtual ~CFragmentAssembler();
+
+	// reads the fragment header and data out of a PACKETID_FRAGMENT packet; returns false if it's malformed.
+	// compressed is set if the whole message is compressed, in which case the pieces can't be used on their own
+	static bool Parse(CPacket *ppkt, SStreamChunk *chunk, bool *compressed = nullptr);
+
+	// describes a whole packet as the only piece of its message
+	static void Describe(CPacket *ppkt, SStreamChunk *chunk);
+
+	// adds a piece to its message; when the last piece arrives, the completed packet is returned
+	// (holding one reference that belongs to the caller), otherwise nullptr. Does not take
+	// ownership of ppkt
+	CPacket *Add(CPacket *ppkt);
+
+	// throws away partial messages from the given sender (e.g. when it disconnects)
+	void Discard(GUID sender);
+
+	// throws away all partial messages
+	void Clear();
+
+protected:
+	struct SMessageKey
+	{
+		GUID m_Sender;
+		uint32_t m_MessageID;
+
+		bool operator <(const SMessageKey &other) const
+		{
+			int c = memcmp(&m_Sender, &other.m_Sender, sizeof(GUID));
+			return (c < 0) || ((c == 0) && (m_MessageID < other.m_MessageID));
+		}
+	};
+
+	struct SPartialMessage
+	{
+		CPacket *m_Packet;
+		uint32_t m_Length;
+		uint32_t m_Received;		// the message has arrived up to here
+	};
+
+	typedef std::map<SMessageKey, SPartialMessage> TPartialMap;
+
+	// releases a partial message and forgets it; the caller holds m_Lock
+	TPartialMap::iterator Drop(TPartialMap::iterator it);
+
+	TPartialMap m_Partial;
+
+	// the sum of the partial messages' lengths
+	uint64_t m_PartialBytes;
+
+	std::mutex m_Lock;
+};
@@ -0,0 +1,283 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "FrameReader.h"
+
+
+CFrameReader::CFrameReader()
+{
+	m_Block = nullptr;
+	m_Start = m_End = 0;
+	m_HaveHeader = false;
+	m_Large = nullptr;
+	m_LargeFilled = 0;
+}
+
+
+CFrameReader::~CFrameReader()
+{
+	Clear();
+}
+
+
+void CFrameReader::Clear()
+{
+	if (m_Block)
+		ReleaseBlock(nullptr, 0, m_Block);
+	m_Block = nullptr;
+
+	m_Start = m_End = 0;
+	m_HaveHeader = false;
+
+	if (m_Large)
+		m_Large->Release();
+	m_Large = nullptr;
+	m_LargeFilled = 0;
+}
+
+
+void __cdecl CFrameReader::ReleaseBlock(const BYTE *data, uint32_t datalen, LPVOID userdata)
+{
+	SBlock *b = (SBlock *)userdata;
+
+	if (--b->m_Refs == 0)
+		delete b;
+}
+
+
+void CFrameReader::MakeRoom()
+{
+	if (!m_Block)
+	{
+		m_Block = new SBlock;
+		m_Block->m_Refs = 1;
+	}
+
+	uint32_t left = m_End - m_Start;
+
+	// packets only ever point at what's before m_Start, so reading in after m_End is always safe
+	if ((FRAMEREADER_BLOCK_SIZE - m_End) >= (FRAMEREADER_BLOCK_SIZE / 4))
+	{
+		// nothing's waiting and nothing points into the block, so start over at the front
+		if (!left && (m_Block->m_Refs == 1))
+			m_Start = m_End = 0;
+
+		return;
+	}
+
+	if (m_Block->m_Refs == 1)
+	{
+		memmove(m_Block->m_Data, m_Block->m_Data + m_Start, left);
+	}
+	else
+	{
+		SBlock *b = new SBlock;
+		b->m_Refs = 1;
+		memcpy(b->m_Data, m_Block->m_Data + m_Start, left);
+
+		ReleaseBlock(nullptr, 0, m_Block);
+		m_Block = b;
+	}
+
+	m_Start = 0;
+	m_End = left;
+}
+
+
+bool CFrameReader::Read(SOCKET s)
+{
+	WSABUF buf;
+
+	if (m_Large)
+	{
+		buf.buf = (char *)m_Large->GetData() + m_LargeFilled;
+		buf.len = m_Large->GetDataLength() - m_LargeFilled;
+	}
+	else
+	{
+		MakeRoom();
+
+		buf.buf = (char *)m_Block->m_Data + m_End;
+		buf.len = FRAMEREADER_BLOCK_SIZE - m_End;
+	}
+
+	DWORD flags = 0;
+	DWORD rct = 0;
+
+	if (WSARecv(s, &buf, 1, &rct, &flags, NULL, NULL) == SOCKET_ERROR)
+		return (WSAGetLastError() == WSAEWOULDBLOCK);
+
+	// nothing there, and no error either, means the other end has gone away
+	if (!rct)
+		return false;
+
+	if (m_Large)
+		m_LargeFilled += rct;
+	else
+		m_End += rct;
+
+	return true;
+}
+
+
+CPacket *CFrameReader::NewPacket(const BYTE *data, uint32_t datalen, bool share)
+{
+	uint32_t len = m_Header.m_DataLength & PACKETLENGTH_MASK;
+
+	CPacket *ret = (CPacket *)mqme::ICorePacket::NewPacket(share ? 0 : len);
+	if (!ret)
+		return nullptr;
+
+	if (share)
+	{
+		m_Block->m_Refs++;
+		ret->SetExternalData(m_Header.m_ID, len, data, ReleaseBlock, m_Block);
+	}
+	else
+	{
+		ret->SetData(m_Header.m_ID, len, NULL);
+		if (datalen)
+			memcpy(ret->GetData(), data, datalen);
+	}
+
+	ret->SetContext(m_Header.m_Context);
+	ret->SetSender(m_Header.m_Sender);
+	ret->SetCompressed((m_Header.m_DataLength & PACKETFLAG_COMPRESSED) != 0);
+
+	return ret;
+}
+
+
+CPacket *CFrameReader::Next(CCompactHeaderDecoder *dec, bool &malformed)
+{
+	malformed = false;
+
+	CPacket *ret = nullptr;
+
+	if (m_Large)
+	{
+		if (m_LargeFilled < m_Large->GetDataLength())
+			return nullptr;
+
+		ret = m_Large;
+		m_Large = nullptr;
+		m_HaveHeader = false;
+
+		return ret;
+	}
+
+	if (!m_Block)
+		return nullptr;
+
+	const BYTE *p = m_Block->m_Data + m_Start;
+	uint32_t avail = m_End - m_Start;
+
+	if (!m_HaveHeader)
+	{
+		if (dec)
+		{
+			// a compact header's length comes first
+			if (!avail)
+				return nullptr;
+
+			uint32_t hlen = p[0];
+			if (hlen >= MAX_COMPACT_HEADER)
+			{
+				malformed = true;
+				return nullptr;
+			}
+
+			if (avail < (hlen + 1))
+				return nullptr;
+
+			memset(&m_Header, 0, sizeof(SPacketHeader));
+			if (!dec->Decode(p + 1, hlen, &m_Header))
+			{
+				malformed = true;
+				return nullptr;
+			}
+
+			m_Start += hlen + 1;
+		}
+		else
+		{
+			if (avail < sizeof(SPacketHeader))
+				return nullptr;
+
+			memcpy(&m_Header, p, sizeof(SPacketHeader));
+
+			m_Start += sizeof(SPacketHeader);
+		}
+
+		m_HaveHeader = true;
+
+		p = m_Block->m_Data + m_Start;
+		avail = m_End - m_Start;
+
+		uint32_t datalen = m_Header.m_DataLength & PACKETLENGTH_MASK;
+
+		// too big to ever fit in the block, so whatever's here already is the start of its own
+		// packet and the rest is read straight into it
+		if (datalen > FRAMEREADER_BLOCK_SIZE)
+		{
+			m_Large = NewPacket(p, std::min<uint32_t>(avail, datalen), false);
+			if (!m_Large)
+			{
+				malformed = true;
+				return nullptr;
+			}
+
+			m_LargeFilled = std::min<uint32_t>(avail, datalen);
+			m_Start += m_LargeFilled;
+
+			return Next(dec, malformed);
+		}
+	}
+
+	uint32_t datalen = m_Header.m_DataLength & PACKETLENGTH_MASK;
+	if (avail < datalen)
+		return nullptr;
+
+	ret = NewPacket(p, datalen, (datalen >= FRAMEREADER_SHARE_SIZE));
+	if (!ret)
+	{
+		malformed = true;
+		return nullptr;
+	}
+
+	m_Start += datalen;
+	m_HaveHeader = false;
+
+	return ret;
+}
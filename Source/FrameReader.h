@@ -0,0 +1,100 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "CompactHeader.h"
+#include <atomic>
+
+// how much is read from a socket at once; a packet whose data is bigger than this is read
+// straight into its own packet instead
+#define FRAMEREADER_BLOCK_SIZE		(64 * 1024)
+
+// packets with at least this much data keep pointing into the block they arrived in rather
+// than getting a copy; smaller ones are cheaper to copy than to pin a block for
+#define FRAMEREADER_SHARE_SIZE		1024
+
+
+// CFrameReader turns the bytes arriving on one connection into packets. Each Read takes as much
+// as the socket has (up to a block's worth) in one call, and Next then hands out every complete
+// packet in it; a packet that's only partly there is finished by later Reads
+class CFrameReader
+{
+public:
+	CFrameReader();
+	~CFrameReader();
+
+	// reads whatever the socket has waiting; returns false if the connection has been closed or
+	// is broken (a non-blocking socket with nothing to read is neither)
+	bool Read(SOCKET s);
+
+	// takes the next complete packet out of what's been read (holding one reference that belongs
+	// to the caller), or returns nullptr if there isn't one yet. dec is the connection's compact
+	// header decoder, if it has switched to them; since that can change from one packet to the
+	// next, it's given every time. malformed is set if the data can't be made sense of, after which
+	// the connection is no good
+	CPacket *Next(CCompactHeaderDecoder *dec, bool &malformed);
+
+	// throws away everything that's been read
+	void Clear();
+
+protected:
+	// the storage packets are read into; it's shared with the packets handed out of it, and
+	// goes away with the last of them
+	typedef struct sBlock
+	{
+		std::atomic<uint32_t> m_Refs;
+		BYTE m_Data[FRAMEREADER_BLOCK_SIZE];
+	} SBlock;
+
+	static void __cdecl ReleaseBlock(const BYTE *data, uint32_t datalen, LPVOID userdata);
+
+	// makes sure there's a good amount of room at the end of the block, moving what hasn't been
+	// parsed yet to the front - or to a new block, if packets still point into this one
+	void MakeRoom();
+
+	// builds a packet out of m_Header and datalen bytes at data
+	CPacket *NewPacket(const BYTE *data, uint32_t datalen, bool share);
+
+	SBlock *m_Block;
+	uint32_t m_Start;			// where parsing picks up
+	uint32_t m_End;				// where the next read goes
+
+	// the header of the packet whose data is still arriving
+	SPacketHeader m_Header;
+	bool m_HaveHeader;
+
+	// a packet too big for the block, which is being read into directly
+	CPacket *m_Large;
+	uint32_t m_LargeFilled;
+};
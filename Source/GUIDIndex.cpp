@@ -0,0 +1,296 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "GUIDIndex.h"
+#include <emmintrin.h>
+#include <intrin.h>
+
+
+// a control byte is either one of these, or the low seven bits of its key's hash
+#define CTRL_EMPTY		0x80
+#define CTRL_DELETED	0xFE
+
+
+struct CGUIDIndex::sTable
+{
+	size_t m_GroupMask;
+
+	// slots that hold a key or used to (both count against how full the table is)
+	size_t m_Used;
+
+	BYTE *m_Ctrl;
+	GUID *m_Keys;
+	uint32_t *m_Values;
+};
+
+
+// returns a bit for each of the group's control bytes that is b
+static inline uint32_t MatchGroup(const BYTE *ctrl, BYTE b)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)b)));
+}
+
+
+static inline bool SameGUID(const GUID &a, const GUID &b)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)&a);
+	__m128i y = _mm_loadu_si128((const __m128i *)&b);
+
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF);
+}
+
+
+CGUIDIndex::CGUIDIndex(size_t initial_size)
+{
+	size_t slots = GUIDINDEX_GROUP_SIZE;
+	while (slots < initial_size)
+		slots <<= 1;
+
+	m_Table = NewTable(slots);
+	m_Size = 0;
+}
+
+
+CGUIDIndex::~CGUIDIndex()
+{
+	FreeTable(m_Table);
+}
+
+
+size_t CGUIDIndex::Hash(const GUID &id)
+{
+	uint64_t a, b;
+	memcpy(&a, &id, sizeof(uint64_t));
+	memcpy(&b, (const BYTE *)&id + sizeof(uint64_t), sizeof(uint64_t));
+
+	uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ULL));
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+
+	return (size_t)h;
+}
+
+
+CGUIDIndex::STable *CGUIDIndex::NewTable(size_t slots)
+{
+	STable *t = new STable;
+	t->m_GroupMask = (slots / GUIDINDEX_GROUP_SIZE) - 1;
+	t->m_Used = 0;
+	t->m_Ctrl = new BYTE[slots];
+	t->m_Keys = new GUID[slots];
+	t->m_Values = new uint32_t[slots];
+
+	memset(t->m_Ctrl, CTRL_EMPTY, slots);
+
+	return t;
+}
+
+
+void CGUIDIndex::FreeTable(STable *t)
+{
+	if (!t)
+		return;
+
+	delete [] t->m_Ctrl;
+	delete [] t->m_Keys;
+	delete [] t->m_Values;
+	delete t;
+}
+
+
+size_t CGUIDIndex::Locate(const STable *t, const GUID &id, size_t hash)
+{
+	BYTE tag = (BYTE)(hash & 0x7F);
+	size_t g = (hash >> 7) & t->m_GroupMask;
+
+	for (size_t n = 0; n <= t->m_GroupMask; n++)
+	{
+		const BYTE *ctrl = t->m_Ctrl + (g * GUIDINDEX_GROUP_SIZE);
+
+		uint32_t match = MatchGroup(ctrl, tag);
+		uint32_t empty = MatchGroup(ctrl, CTRL_EMPTY);
+
+		// a control byte is only set once its slot is filled in
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		while (match)
+		{
+			unsigned long i;
+			_BitScanForward(&i, match);
+			match &= match - 1;
+
+			size_t s = (g * GUIDINDEX_GROUP_SIZE) + i;
+			if (SameGUID(t->m_Keys[s], id))
+				return s;
+		}
+
+		// an insert would have stopped here, so it isn't any further along
+		if (empty)
+			break;
+
+		g = (g + 1) & t->m_GroupMask;
+	}
+
+	return SIZE_MAX;
+}
+
+
+void CGUIDIndex::Place(STable *t, const GUID &id, uint32_t value, size_t hash)
+{
+	size_t g = (hash >> 7) & t->m_GroupMask;
+
+	while (true)
+	{
+		BYTE *ctrl = t->m_Ctrl + (g * GUIDINDEX_GROUP_SIZE);
+
+		// deleted slots aren't reused, since a reader could still be comparing the key that was there
+		uint32_t empty = MatchGroup(ctrl, CTRL_EMPTY);
+		if (empty)
+		{
+			unsigned long i;
+			_BitScanForward(&i, empty);
+
+			size_t s = (g * GUIDINDEX_GROUP_SIZE) + i;
+			t->m_Keys[s] = id;
+			t->m_Values[s] = value;
+
+			std::atomic_thread_fence(std::memory_order_release);
+
+			ctrl[i] = (BYTE)(hash & 0x7F);
+			t->m_Used++;
+
+			return;
+		}
+
+		g = (g + 1) & t->m_GroupMask;
+	}
+}
+
+
+uint32_t CGUIDIndex::Find(const GUID &id) const
+{
+	const STable *t = m_Table.load(std::memory_order_acquire);
+
+	size_t s = Locate(t, id, Hash(id));
+
+	return (s != SIZE_MAX) ? t->m_Values[s] : GUIDINDEX_NONE;
+}
+
+
+void CGUIDIndex::Insert(const GUID &id, uint32_t value, STable **retired)
+{
+	if (retired)
+		*retired = nullptr;
+
+	STable *t = m_Table;
+	size_t hash = Hash(id);
+
+	size_t s = Locate(t, id, hash);
+	if (s != SIZE_MAX)
+	{
+		t->m_Values[s] = value;
+		return;
+	}
+
+	size_t slots = (t->m_GroupMask + 1) * GUIDINDEX_GROUP_SIZE;
+
+	// kept at most 7/8 full, counting deleted slots; it only gets bigger if the keys themselves
+	// need the room, otherwise the rebuild just clears the deleted ones out
+	if (((t->m_Used + 1) * 8) > (slots * 7))
+	{
+		STable *n = NewTable((((m_Size + 1) * 2) > slots) ? (slots * 2) : slots);
+
+		for (size_t i = 0; i < slots; i++)
+		{
+			if (!(t->m_Ctrl[i] & CTRL_EMPTY))
+				Place(n, t->m_Keys[i], t->m_Values[i], Hash(t->m_Keys[i]));
+		}
+
+		// the new one is complete before anyone can see it
+		Place(n, id, value, hash);
+		m_Size++;
+
+		Replace(n, retired);
+
+		return;
+	}
+
+	Place(t, id, value, hash);
+	m_Size++;
+}
+
+
+bool CGUIDIndex::Erase(const GUID &id)
+{
+	STable *t = m_Table;
+
+	size_t s = Locate(t, id, Hash(id));
+	if (s == SIZE_MAX)
+		return false;
+
+	t->m_Ctrl[s] = CTRL_DELETED;
+	m_Size--;
+
+	return true;
+}
+
+
+void CGUIDIndex::Clear(STable **retired)
+{
+	if (retired)
+		*retired = nullptr;
+
+	STable *t = m_Table;
+	if (!t->m_Used)
+		return;
+
+	Replace(NewTable((t->m_GroupMask + 1) * GUIDINDEX_GROUP_SIZE), retired);
+	m_Size = 0;
+}
+
+
+void CGUIDIndex::Replace(STable *t, STable **retired)
+{
+	STable *old = m_Table;
+
+	m_Table.store(t, std::memory_order_release);
+
+	if (retired)
+		*retired = old;
+	else
+		FreeTable(old);
+}
@@ -0,0 +1,99 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include <atomic>
+
+// what Find returns for a GUID that isn't there
+#define GUIDINDEX_NONE				UINT32_MAX
+
+// slots are probed in groups of this many, one control byte each, which is what one SSE2 compare
+// covers; a table is always a power of two groups
+#define GUIDINDEX_GROUP_SIZE		16
+
+
+// CGUIDIndex maps GUIDs to 32-bit values (typically indices into an array) in one flat,
+// open-addressed table. Each slot has a control byte that holds seven bits of its key's hash,
+// so a probe looks at a whole group of slots with one 16-byte compare, and only touches the keys
+// whose bits match - which are compared with another.
+//
+// There may be one writer at a time, and any number of readers alongside it. A slot is filled in
+// before its control byte says so, and never reused for a different key until the table is rebuilt;
+// a rebuilt table replaces the old one, which the writer either frees right away or is handed to
+// free once no reader can still be looking at it
+class CGUIDIndex
+{
+public:
+	struct sTable;
+	typedef struct sTable STable;
+
+	CGUIDIndex(size_t initial_size = 1024);
+	~CGUIDIndex();
+
+	// returns the value stored for id, or GUIDINDEX_NONE
+	uint32_t Find(const GUID &id) const;
+
+	// stores value for id, replacing whatever was there. If the table has to be rebuilt to make
+	// room, the old one is put in retired for the caller to free (with FreeTable) when it's safe;
+	// if retired is nullptr, it's freed right away
+	void Insert(const GUID &id, uint32_t value, STable **retired = nullptr);
+
+	// returns false if id wasn't there
+	bool Erase(const GUID &id);
+
+	// empties the table; the old one is handled as it is by Insert
+	void Clear(STable **retired = nullptr);
+
+	size_t Size() const { return m_Size; }
+
+	static void FreeTable(STable *t);
+
+	static size_t Hash(const GUID &id);
+
+protected:
+	static STable *NewTable(size_t slots);
+
+	// returns the slot holding id, or SIZE_MAX
+	static size_t Locate(const STable *t, const GUID &id, size_t hash);
+
+	// fills in the first empty slot in id's probe sequence; there has to be one
+	static void Place(STable *t, const GUID &id, uint32_t value, size_t hash);
+
+	void Replace(STable *t, STable **retired);
+
+	std::atomic<STable *> m_Table;
+
+	// how many slots hold a key
+	size_t m_Size;
+};
@@ -33,12 +33,12 @@
 #include "stdafx.h"
 
 #include "Packet.h"
-#include "PacketQueue.h"
+#include "PacketPool.h"
 #include <malloc.h>
 
 using namespace mqme;
 
-extern CPacketQueue *g_IdlePackets;
+extern CPacketPool *g_PacketPool;
 
 GUID unkguid = { 0, 0, 0,{ 0, 0, 0, 0, 0, 0, 0, 0 } };
 
@@ -47,6 +47,9 @@ CPacket::CPacket(uint32_t initial_size)
 	m_RefCt = 0;
 	m_Data = NULL;
 	m_UserData = NULL;
+	m_ExtData = NULL;
+	m_ExtRelease = NULL;
+	m_ExtUserData = NULL;
 	m_AllocatedDataSize = initial_size;
 
 	uint32_t datalen = initial_size + sizeof(SPacketHeader);
@@ -63,6 +66,8 @@ CPacket::CPacket(uint32_t initial_size)
 
 CPacket::~CPacket()
 {
+	ReleaseExternalData();
+
 	if (m_Buffer)
 	{
 		free(m_Buffer);
@@ -73,18 +78,23 @@ CPacket::~CPacket()
 	}
 }
 
+void CPacket::AddRef()
+{
+	IncRef();
+}
+
 void CPacket::Release()
 {
 	// if somebody tries to multi-release a packet after it's in the idle queue, 
 	// don't re-add it to the idle queue - because it's already there! party foul!
-	bool isref = IsReferenced();
-	DecRef();
-
-	if (isref && !IsReferenced())
+	if (DecRef())
 	{
-		if (g_IdlePackets)
+		// everyone is done sending it, so the owner can have their buffer back
+		ReleaseExternalData();
+
+		if (g_PacketPool)
 		{
-			g_IdlePackets->Enque(this);
+			g_PacketPool->Enque(this);
 		}
 	}
 }
@@ -99,17 +109,35 @@ void *CPacket::GetUserData()
 	return m_UserData;
 }
 
-void CPacket::SetData(FOURCHARCODE id, uint32_t datalen, const BYTE *data)
+void CPacket::Grow(uint32_t datalen, uint32_t keep)
 {
+	// let the pool swap us into a size class that fits, rather than growing this buffer
+	if ((!m_Buffer || (m_AllocatedDataSize < datalen)) && g_PacketPool)
+	{
+		g_PacketPool->Resize(this, datalen, keep);
+	}
+
 	if (!m_Buffer || (m_Buffer && (m_AllocatedDataSize < datalen)))
 	{
+		bool fresh = (m_Buffer == NULL);
+
 		void *temp = realloc(m_Buffer, datalen + sizeof(SPacketHeader));
 		if (!temp)
 			throw;
 		m_Buffer = temp;
 		m_AllocatedDataSize = datalen;
 		m_Data = NULL;
+
+		if (fresh)
+			memset(m_Buffer, 0, sizeof(SPacketHeader));
 	}
+}
+
+void CPacket::SetData(FOURCHARCODE id, uint32_t datalen, const BYTE *data)
+{
+	ReleaseExternalData();
+
+	Grow(datalen, 0);
 
 	SPacketHeader *h = (SPacketHeader *)m_Buffer;
 	if (h)
@@ -133,6 +161,109 @@ void CPacket::SetData(FOURCHARCODE id, uint32_t datalen, const BYTE *data)
 }
 
 
+void CPacket::BeginData(FOURCHARCODE id, uint32_t reserve)
+{
+	SetData(id, reserve, NULL);
+
+	// nothing has been written yet
+	SPacketHeader *h = (SPacketHeader *)m_Buffer;
+	if (h)
+		h->m_DataLength = 0;
+}
+
+
+BYTE *CPacket::Reserve(uint32_t len)
+{
+	// appending to external data means it has to become ours first
+	if (m_ExtData)
+	{
+		uint32_t extlen = GetDataLength();
+		Grow(extlen, 0);
+		memcpy((BYTE *)m_Buffer + sizeof(SPacketHeader), m_ExtData, extlen);
+		ReleaseExternalData();
+
+		((SPacketHeader *)m_Buffer)->m_DataLength = extlen;
+	}
+
+	SPacketHeader *h = (SPacketHeader *)m_Buffer;
+	uint32_t used = h ? (h->m_DataLength & PACKETLENGTH_MASK) : 0;
+
+	// grow by at least half again, so that many small appends don't each move the data
+	if (!m_Buffer || ((m_AllocatedDataSize - used) < len))
+	{
+		size_t want = std::max<size_t>((size_t)used + len, m_AllocatedDataSize + (m_AllocatedDataSize / 2));
+		Grow((uint32_t)std::min<size_t>(want, UINT32_MAX), used);
+	}
+
+	m_Data = (BYTE *)m_Buffer + sizeof(SPacketHeader);
+
+	return m_Data + used;
+}
+
+
+void CPacket::Commit(uint32_t len)
+{
+	SPacketHeader *h = (SPacketHeader *)m_Buffer;
+	if (!h)
+		return;
+
+	h->m_DataLength = (uint32_t)std::min<size_t>((size_t)(h->m_DataLength & PACKETLENGTH_MASK) + len, m_AllocatedDataSize);
+	m_Data = (BYTE *)m_Buffer + sizeof(SPacketHeader);
+}
+
+
+void CPacket::Append(const BYTE *data, uint32_t len)
+{
+	BYTE *p = Reserve(len);
+	if (data && len)
+		memcpy(p, data, len);
+
+	Commit(len);
+}
+
+
+void CPacket::SetExternalData(FOURCHARCODE id, uint32_t datalen, const BYTE *data, EXTERNAL_DATA_RELEASE release, LPVOID userdata)
+{
+	ReleaseExternalData();
+
+	// the header still lives in our own storage
+	Grow(0, 0);
+
+	SPacketHeader *h = (SPacketHeader *)m_Buffer;
+	if (h)
+	{
+		h->m_ID = id;
+		h->m_DataLength = data ? datalen : 0;
+	}
+
+	m_ExtData = data;
+	m_ExtRelease = release;
+	m_ExtUserData = userdata;
+}
+
+
+void CPacket::ReleaseExternalData()
+{
+	if (!m_ExtData)
+		return;
+
+	const BYTE *data = m_ExtData;
+	uint32_t datalen = m_Buffer ? (((SPacketHeader *)m_Buffer)->m_DataLength & PACKETLENGTH_MASK) : 0;
+	EXTERNAL_DATA_RELEASE release = m_ExtRelease;
+	LPVOID userdata = m_ExtUserData;
+
+	m_ExtData = NULL;
+	m_ExtRelease = NULL;
+	m_ExtUserData = NULL;
+
+	if (m_Buffer)
+		((SPacketHeader *)m_Buffer)->m_DataLength = 0;
+
+	if (release)
+		release(data, datalen, userdata);
+}
+
+
 void CPacket::SetContext(GUID context)
 {
 	if (m_Buffer)
@@ -188,12 +319,34 @@ uint32_t CPacket::GetHeaderLength()
 
 uint32_t CPacket::GetDataLength()
 {
-	return (m_Buffer && m_Data) ? ((SPacketHeader *)m_Buffer)->m_DataLength : 0;
+	return (m_Buffer && (m_Data || m_ExtData)) ? (((SPacketHeader *)m_Buffer)->m_DataLength & PACKETLENGTH_MASK) : 0;
+}
+
+
+void CPacket::SetCompressed(bool compressed)
+{
+	SPacketHeader *h = (SPacketHeader *)m_Buffer;
+	if (!h)
+		return;
+
+	if (compressed)
+		h->m_DataLength |= PACKETFLAG_COMPRESSED;
+	else
+		h->m_DataLength &= PACKETLENGTH_MASK;
+}
+
+
+bool CPacket::IsCompressed()
+{
+	return m_Buffer && ((((SPacketHeader *)m_Buffer)->m_DataLength & PACKETFLAG_COMPRESSED) != 0);
 }
 
 
 BYTE *CPacket::GetData()
 {
+	if (m_ExtData)
+		return (m_Buffer && (((SPacketHeader *)m_Buffer)->m_DataLength > 0)) ? (BYTE *)m_ExtData : NULL;
+
 	return (m_Buffer && m_Data && (((SPacketHeader *)m_Buffer)->m_DataLength > 0)) ? m_Data : NULL;
 }
 
@@ -204,16 +357,46 @@ SPacketHeader *CPacket::GetHeader()
 }
 
 
+size_t CPacket::GetAllocatedSize()
+{
+	return m_Buffer ? m_AllocatedDataSize : 0;
+}
+
+
+void CPacket::SwapBuffer(CPacket *other, uint32_t keep)
+{
+	if (!other || (other == this))
+		return;
+
+	// the header belongs to the packet, not the storage, so it moves with us - as does
+	// any data the caller wants to keep
+	if (m_Buffer && other->m_Buffer)
+	{
+		keep = (uint32_t)std::min<size_t>(keep, std::min<size_t>(m_AllocatedDataSize, other->m_AllocatedDataSize));
+		memcpy(other->m_Buffer, m_Buffer, sizeof(SPacketHeader) + keep);
+	}
+
+	std::swap(m_Buffer, other->m_Buffer);
+	std::swap(m_Data, other->m_Data);
+	std::swap(m_AllocatedDataSize, other->m_AllocatedDataSize);
+}
+
+
 void CPacket::IncRef()
 {
-	m_RefCt++;
+	m_RefCt.fetch_add(1, std::memory_order_relaxed);
 }
 
 
-void CPacket::DecRef()
+bool CPacket::DecRef()
 {
-	if (m_RefCt)
-		m_RefCt--;
+	// never go below zero, and only one caller can see the count go from 1 to 0
+	uint32_t ct = m_RefCt.load(std::memory_order_relaxed);
+	while (ct && !m_RefCt.compare_exchange_weak(ct, ct - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+	{
+	}
+
+	return (ct == 1);
 }
 
 bool CPacket::IsReferenced()
@@ -33,9 +33,19 @@
 #pragma once
 
 #include <mqme.h>
+#include <atomic>
 
 using namespace mqme;
 
+// In order to make GUID-keyed sets and maps work, a Compare must be provided
+struct GUIDComparer
+{
+	bool operator()(const GUID &a, const GUID &b) const
+	{
+		return (memcmp(&a, &b, sizeof(GUID)) < 0) ? true : false;
+	}
+};
+
 #pragma pack(push, 1)
 
 struct SPacketHeader
@@ -46,8 +56,31 @@ struct SPacketHeader
 	uint32_t m_DataLength;
 };
 
+// large messages are sent as a series of PACKETID_FRAGMENT packets, each of which carries
+// this header in front of its piece of the original data
+struct SFragmentHeader
+{
+	uint32_t m_MessageID;		// unique per sender; shared by all pieces of one message
+	FOURCHARCODE m_ID;			// the id of the original packet
+	uint32_t m_TotalLength;		// the data length of the original packet
+	uint32_t m_Offset;			// where this piece goes in the original data
+};
+
 #pragma pack(pop)
 
+// reserved packet id ('\1FRG') for pieces of a large message
+#define PACKETID_FRAGMENT		0x01465247
+
+// reserved packet id ('\1INT') for a client's list of the packet ids it has handlers for; the data
+// is an array of FOURCHARCODEs, and the server sends the client only those from then on (or
+// everything again, if the array is empty)
+#define PACKETID_INTEREST		0x01494E54
+
+// the high bit of SPacketHeader::m_DataLength (and SFragmentHeader::m_TotalLength) marks data
+// that has been compressed (see Compression.h); the rest is the length
+#define PACKETFLAG_COMPRESSED	0x80000000
+#define PACKETLENGTH_MASK		0x7FFFFFFF
+
 
 class CPacket : public ICorePacket
 {
@@ -57,10 +90,22 @@ public:
 	CPacket(uint32_t initial_size);
 	virtual ~CPacket();
 
+	virtual void AddRef();
+
 	virtual void Release();
 
 	virtual void SetData(FOURCHARCODE id, uint32_t datalen, const BYTE *data);
 
+	virtual void BeginData(FOURCHARCODE id, uint32_t reserve = 0);
+
+	virtual BYTE *Reserve(uint32_t len);
+
+	virtual void Commit(uint32_t len);
+
+	virtual void Append(const BYTE *data, uint32_t len);
+
+	virtual void SetExternalData(FOURCHARCODE id, uint32_t datalen, const BYTE *data, EXTERNAL_DATA_RELEASE release, LPVOID userdata = nullptr);
+
 	virtual void SetContext(GUID context);
 
 	virtual GUID GetContext();
@@ -79,14 +124,34 @@ public:
 
 	uint32_t GetHeaderLength();
 
+	// the number of payload bytes this packet can hold without being resized
+	size_t GetAllocatedSize();
+
+	// marks the data as compressed (or not) in the header; setting new data clears it
+	void SetCompressed(bool compressed);
+	bool IsCompressed();
+
+	// exchanges storage with another packet, carrying the header and the first keep bytes
+	// of data along; used by the packet pool to move a packet into a larger size class
+	void SwapBuffer(CPacket *other, uint32_t keep = 0);
+
 	void SetUserData(void *user);
 	void *GetUserData();
 
 	void IncRef();
-	void DecRef();
+
+	// returns true if this call dropped the last reference
+	bool DecRef();
+
 	bool IsReferenced();
 
 protected:
+	// makes room for at least datalen bytes of data, preserving the first keep bytes
+	void Grow(uint32_t datalen, uint32_t keep);
+
+	// detaches any external data, handing it back to its owner
+	void ReleaseExternalData();
+
 	void *m_Buffer;
 
 	BYTE *m_Data;
@@ -94,5 +159,10 @@ protected:
 
 	void *m_UserData;
 
-	uint32_t m_RefCt;
+	// caller-owned data attached by SetExternalData; the header stays in m_Buffer
+	const BYTE *m_ExtData;
+	EXTERNAL_DATA_RELEASE m_ExtRelease;
+	LPVOID m_ExtUserData;
+
+	std::atomic<uint32_t> m_RefCt;
 };
@@ -0,0 +1,418 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "PacketPool.h"
+#include "Executor.h"
+
+extern CExecutor *g_ThreadPool;
+
+// guards the association between thread caches and pools; this is not a member of the pool
+// because threads may exit after the pool they were attached to has been destroyed
+static std::mutex s_ThreadCacheLock;
+
+static thread_local SPacketThreadCache t_ThreadCache;
+
+
+SPacketThreadCache::~SPacketThreadCache()
+{
+	std::lock_guard<std::mutex> l(s_ThreadCacheLock);
+
+	if (m_Pool)
+		m_Pool->DetachThreadCache(this);
+}
+
+
+CPacketPool::CPacketPool(size_t initial_packet_count, uint32_t initial_packet_size, size_t thread_cache_size)
+{
+	m_DefaultPacketSize = initial_packet_size;
+	m_ThreadCacheSize = thread_cache_size;
+
+	m_TotalCount = 0;
+	m_TotalBytes = 0;
+	m_IdleCount = 0;
+	m_IdleBytes = 0;
+	m_SharedCount = 0;
+	m_SharedBytes = 0;
+	m_PeakLiveCount = 0;
+	m_PeakLiveBytes = 0;
+
+	m_IdleCountHigh = m_IdleCountLow = 0;
+	m_IdleBytesHigh = m_IdleBytesLow = 0;
+	m_Trimming = false;
+
+	for (size_t i = 0; i < NUM_CLASSES; i++)
+		m_Class[i] = new CPacketQueue();
+
+	size_t default_class = ClassFor(m_DefaultPacketSize);
+	if (default_class == OVERSIZE_CLASS)
+		default_class = NUM_CLASSES - 1;
+
+	// only the default class is pre-populated; the others fill up as traffic demands
+	while (initial_packet_count)
+	{
+		CPacket *ppkt = CreatePacket(ClassSize(default_class));
+		m_IdleCount++;
+		m_IdleBytes += ppkt->GetAllocatedSize();
+		m_Class[default_class]->Enque(ppkt);
+		CountShared(default_class, 1);
+
+		initial_packet_count--;
+	}
+}
+
+
+CPacketPool::~CPacketPool()
+{
+	s_ThreadCacheLock.lock();
+
+	// anything still sitting in a thread's cache is ours to delete. Those threads have stopped
+	// using packets (the executor's workers have exited, detaching themselves on the way out), so
+	// their magazines can't change under us
+	for (auto cache : m_ThreadCaches)
+	{
+		for (size_t i = 0; i < NUM_CLASSES; i++)
+		{
+			for (auto ppkt : cache->m_Magazine[i])
+				DestroyPacket(ppkt);
+
+			cache->m_Magazine[i].clear();
+		}
+
+		cache->m_Pool = nullptr;
+	}
+
+	m_ThreadCaches.clear();
+
+	s_ThreadCacheLock.unlock();
+
+	for (size_t i = 0; i < NUM_CLASSES; i++)
+	{
+		CPacket *ppkt;
+		while ((ppkt = m_Class[i]->Deque()) != nullptr)
+			DestroyPacket(ppkt);
+
+		delete m_Class[i];
+		m_Class[i] = nullptr;
+	}
+}
+
+
+size_t CPacketPool::ClassFor(size_t size)
+{
+	size_t ret = 0;
+
+	while ((ret < NUM_CLASSES) && (size > ClassSize(ret)))
+		ret++;
+
+	return ret;
+}
+
+
+uint32_t CPacketPool::ClassSize(size_t size_class)
+{
+	return (uint32_t)1 << (MIN_CLASS_SHIFT + std::min<size_t>(size_class, NUM_CLASSES - 1));
+}
+
+
+CPacket *CPacketPool::Deque(uint32_t size_hint)
+{
+	if (!size_hint)
+		size_hint = m_DefaultPacketSize;
+
+	size_t c = ClassFor(size_hint);
+
+	CPacket *ret = nullptr;
+
+	// oversized packets are allocated to fit and deleted when they're released
+	if (c == OVERSIZE_CLASS)
+	{
+		ret = CreatePacket(size_hint);
+		UpdatePeaks();
+		return ret;
+	}
+
+	if (m_ThreadCacheSize && (c <= MAX_CACHED_CLASS))
+	{
+		std::vector<CPacket *> &mag = GetThreadCache()->m_Magazine[c];
+
+		// refill half a magazine from the shared free list in one go
+		if (mag.empty())
+		{
+			mag.resize(std::max<size_t>(m_ThreadCacheSize / 2, 1));
+			mag.resize(m_Class[c]->DequeBatch(mag.data(), mag.size()));
+			CountShared(c, -(int64_t)mag.size());
+		}
+
+		if (!mag.empty())
+		{
+			ret = mag.back();
+			mag.pop_back();
+		}
+	}
+
+	if (!ret)
+	{
+		ret = m_Class[c]->Deque();
+		if (ret)
+			CountShared(c, -1);
+	}
+
+	if (ret)
+	{
+		m_IdleCount--;
+		m_IdleBytes -= ret->GetAllocatedSize();
+	}
+	else
+	{
+		ret = CreatePacket(ClassSize(c));
+	}
+
+	UpdatePeaks();
+
+	return ret;
+}
+
+
+void CPacketPool::Enque(CPacket *ppkt)
+{
+	if (!ppkt)
+		return;
+
+	size_t c = ClassFor(ppkt->GetAllocatedSize());
+
+	// a packet only belongs in a class if it holds exactly that class's size; anything
+	// else (oversized or externally resized) is not kept around
+	if ((c == OVERSIZE_CLASS) || (ppkt->GetAllocatedSize() != ClassSize(c)))
+	{
+		DestroyPacket(ppkt);
+		return;
+	}
+
+	m_IdleCount++;
+	m_IdleBytes += ppkt->GetAllocatedSize();
+
+	if (m_ThreadCacheSize && (c <= MAX_CACHED_CLASS))
+	{
+		std::vector<CPacket *> &mag = GetThreadCache()->m_Magazine[c];
+
+		// the magazine is full, so spill the older half back to the shared free list
+		if (mag.size() >= m_ThreadCacheSize)
+		{
+			size_t spill = std::max<size_t>(m_ThreadCacheSize / 2, 1);
+			m_Class[c]->EnqueBatch(mag.data(), spill);
+			CountShared(c, (int64_t)spill);
+			mag.erase(mag.begin(), mag.begin() + spill);
+		}
+
+		mag.push_back(ppkt);
+	}
+	else
+	{
+		m_Class[c]->Enque(ppkt);
+		CountShared(c, 1);
+	}
+
+	// too much is sitting idle, so schedule a trim (unless one is already underway)
+	if ((m_IdleCountHigh && (m_SharedCount > m_IdleCountHigh)) || (m_IdleBytesHigh && (m_SharedBytes > m_IdleBytesHigh)))
+	{
+		if (!m_Trimming.exchange(true))
+		{
+			if (!g_ThreadPool || !g_ThreadPool->RunTask(TrimTask, (void *)this))
+				TrimTask((void *)this, nullptr, 0);
+		}
+	}
+}
+
+
+void CPacketPool::SetLimits(size_t idle_count_high, size_t idle_count_low, uint64_t idle_bytes_high, uint64_t idle_bytes_low)
+{
+	m_IdleCountLow = std::min<size_t>(idle_count_low, idle_count_high);
+	m_IdleCountHigh = idle_count_high;
+	m_IdleBytesLow = std::min<uint64_t>(idle_bytes_low, idle_bytes_high);
+	m_IdleBytesHigh = idle_bytes_high;
+}
+
+
+void CPacketPool::Trim()
+{
+	// free the largest idle buffers first, since they give back the most memory per packet
+	for (size_t c = NUM_CLASSES; c-- > 0; )
+	{
+		while (((m_IdleCountHigh && (m_SharedCount > m_IdleCountLow)) || (m_IdleBytesHigh && (m_SharedBytes > m_IdleBytesLow))))
+		{
+			CPacket *ppkt = m_Class[c]->Deque();
+			if (!ppkt)
+				break;
+
+			CountShared(c, -1);
+
+			m_IdleCount--;
+			m_IdleBytes -= ppkt->GetAllocatedSize();
+
+			DestroyPacket(ppkt);
+		}
+	}
+}
+
+
+void CPacketPool::GetStats(SPoolStats *stats)
+{
+	if (!stats)
+		return;
+
+	uint64_t total_count = m_TotalCount, total_bytes = m_TotalBytes;
+	uint64_t idle_count = m_IdleCount, idle_bytes = m_IdleBytes;
+
+	stats->idle_packets = idle_count;
+	stats->idle_bytes = idle_bytes;
+	stats->live_packets = (total_count > idle_count) ? (total_count - idle_count) : 0;
+	stats->live_bytes = (total_bytes > idle_bytes) ? (total_bytes - idle_bytes) : 0;
+	stats->peak_live_packets = m_PeakLiveCount;
+	stats->peak_live_bytes = m_PeakLiveBytes;
+}
+
+
+CExecutor::TASK_RETURN __cdecl CPacketPool::TrimTask(void *param0, void *param1, size_t task_number)
+{
+	CPacketPool *_this = (CPacketPool *)param0;
+
+	_this->Trim();
+	_this->m_Trimming = false;
+
+	return CExecutor::TR_OK;
+}
+
+
+CPacket *CPacketPool::CreatePacket(uint32_t size)
+{
+	CPacket *ret = new CPacket(size);
+
+	m_TotalCount++;
+	m_TotalBytes += ret->GetAllocatedSize();
+
+	return ret;
+}
+
+
+void CPacketPool::DestroyPacket(CPacket *ppkt)
+{
+	m_TotalCount--;
+	m_TotalBytes -= ppkt->GetAllocatedSize();
+
+	delete ppkt;
+}
+
+
+void CPacketPool::UpdatePeaks()
+{
+	uint64_t live_count = m_TotalCount - m_IdleCount;
+	uint64_t peak_count = m_PeakLiveCount;
+	while ((live_count > peak_count) && (live_count < (UINT64_MAX / 2)) && !m_PeakLiveCount.compare_exchange_weak(peak_count, live_count))
+	{
+	}
+
+	uint64_t live_bytes = m_TotalBytes - m_IdleBytes;
+	uint64_t peak_bytes = m_PeakLiveBytes;
+	while ((live_bytes > peak_bytes) && (live_bytes < (UINT64_MAX / 2)) && !m_PeakLiveBytes.compare_exchange_weak(peak_bytes, live_bytes))
+	{
+	}
+}
+
+
+void CPacketPool::CountShared(size_t c, int64_t count)
+{
+	// negative counts wrap around, which takes them away
+	m_SharedCount += (uint64_t)count;
+	m_SharedBytes += (uint64_t)count * ClassSize(c);
+}
+
+
+void CPacketPool::Resize(CPacket *ppkt, uint32_t datalen, uint32_t keep)
+{
+	if (!ppkt || (ppkt->GetAllocatedSize() >= datalen))
+		return;
+
+	// trade storage with a packet that is big enough, then recycle the old storage
+	CPacket *donor = Deque(datalen);
+	if (!donor)
+		return;
+
+	ppkt->SwapBuffer(donor, keep);
+
+	Enque(donor);
+}
+
+
+SPacketThreadCache *CPacketPool::GetThreadCache()
+{
+	SPacketThreadCache *ret = &t_ThreadCache;
+
+	// another thread only changes m_Pool when the pool is destroyed, which it can't be while
+	// this thread is still using it, so reading it without the lock is safe
+	if (ret->m_Pool != this)
+	{
+		std::lock_guard<std::mutex> l(s_ThreadCacheLock);
+
+		if (ret->m_Pool)
+			ret->m_Pool->DetachThreadCache(ret);
+
+		ret->m_Pool = this;
+		m_ThreadCaches.insert(ret);
+
+		for (size_t i = 0; i <= MAX_CACHED_CLASS; i++)
+			ret->m_Magazine[i].reserve(m_ThreadCacheSize);
+	}
+
+	return ret;
+}
+
+
+void CPacketPool::DetachThreadCache(SPacketThreadCache *cache)
+{
+	// the caller holds s_ThreadCacheLock
+	for (size_t i = 0; i < NUM_CLASSES; i++)
+	{
+		std::vector<CPacket *> &mag = cache->m_Magazine[i];
+		if (!mag.empty())
+		{
+			m_Class[i]->EnqueBatch(mag.data(), mag.size());
+			CountShared(i, (int64_t)mag.size());
+		}
+
+		mag.clear();
+	}
+
+	m_ThreadCaches.erase(cache);
+	cache->m_Pool = nullptr;
+}
@@ -0,0 +1,156 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "PacketQueue.h"
+#include "Executor.h"
+#include <atomic>
+#include <vector>
+#include <set>
+
+struct SPacketThreadCache;
+
+// CPacketPool keeps idle packets in power-of-two size classes, each with its own free list,
+// so that small and large payloads never compete for the same buffers
+class CPacketPool
+{
+	friend struct SPacketThreadCache;
+
+public:
+	enum
+	{
+		MIN_CLASS_SHIFT = 8,		// 256 bytes
+		MAX_CLASS_SHIFT = 24,		// 16 MB
+
+		NUM_CLASSES = (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT) + 1,
+
+		MAX_CACHED_CLASS_SHIFT = 16,	// 64 KB; larger packets always go to the shared free lists
+		MAX_CACHED_CLASS = MAX_CACHED_CLASS_SHIFT - MIN_CLASS_SHIFT,
+
+		OVERSIZE_CLASS = NUM_CLASSES	// packets larger than the biggest class are not pooled
+	};
+
+	// thread_cache_size is the number of packets per size class that each thread may hold
+	// before spilling half of them back to the shared free list; 0 disables the thread caches
+	CPacketPool(size_t initial_packet_count = 0, uint32_t initial_packet_size = 0, size_t thread_cache_size = 0);
+
+	// no other thread may be getting or releasing packets by the time the pool is destroyed;
+	// threads that used it may go on running, and whatever they still have cached is freed here
+	virtual ~CPacketPool();
+
+	// gets an idle packet that can hold at least size_hint bytes;
+	// if size_hint is 0, the default (initial) packet size is used
+	CPacket *Deque(uint32_t size_hint = 0);
+
+	// returns a packet to the free list of its size class
+	void Enque(CPacket *ppkt);
+
+	// moves the packet into a size class that can hold datalen bytes by trading storage with
+	// a packet from that class; the packet's previous storage goes back to its own class.
+	// The first keep bytes of data are carried over
+	void Resize(CPacket *ppkt, uint32_t datalen, uint32_t keep = 0);
+
+	// sets the idle watermarks; when the shared free lists' packet count or byte total goes above
+	// its high mark, a background trim frees idle packets (largest first) until both are back
+	// under their low marks. A high mark of 0 means no limit. What the threads hold in their own
+	// caches is bounded by thread_cache_size instead, and doesn't count
+	void SetLimits(size_t idle_count_high, size_t idle_count_low, uint64_t idle_bytes_high, uint64_t idle_bytes_low);
+
+	// frees idle packets from the shared free lists, largest first, until under the low watermarks
+	void Trim();
+
+	// fills out the current counts and byte totals
+	void GetStats(SPoolStats *stats);
+
+	// returns the size class that will hold the given number of bytes
+	static size_t ClassFor(size_t size);
+
+	// returns the number of payload bytes held by packets in the given size class
+	static uint32_t ClassSize(size_t size_class);
+
+protected:
+	// returns the calling thread's cache, attaching it to this pool if needed
+	SPacketThreadCache *GetThreadCache();
+
+	// returns everything in the cache to the shared free lists and forgets about it
+	void DetachThreadCache(SPacketThreadCache *cache);
+
+	static CExecutor::TASK_RETURN __cdecl TrimTask(void *param0, void *param1, size_t task_number);
+
+	// all packet allocation and deletion goes through these, so the totals stay right
+	CPacket *CreatePacket(uint32_t size);
+	void DestroyPacket(CPacket *ppkt);
+
+	void UpdatePeaks();
+
+	// keeps the shared free lists' totals right as count packets of class c go into them (or come
+	// out, if count is negative)
+	void CountShared(size_t c, int64_t count);
+
+	CPacketQueue *m_Class[NUM_CLASSES];
+
+	uint32_t m_DefaultPacketSize;
+
+	size_t m_ThreadCacheSize;
+
+	std::set<SPacketThreadCache *> m_ThreadCaches;
+
+	// every packet the pool has allocated, whether idle or in use
+	std::atomic<uint64_t> m_TotalCount, m_TotalBytes;
+
+	// packets sitting in the shared free lists or a thread's cache
+	std::atomic<uint64_t> m_IdleCount, m_IdleBytes;
+
+	// the part of those in the shared free lists; only these can be trimmed, so only these are
+	// held to the watermarks
+	std::atomic<uint64_t> m_SharedCount, m_SharedBytes;
+
+	std::atomic<uint64_t> m_PeakLiveCount, m_PeakLiveBytes;
+
+	size_t m_IdleCountHigh, m_IdleCountLow;
+	uint64_t m_IdleBytesHigh, m_IdleBytesLow;
+
+	std::atomic<bool> m_Trimming;
+};
+
+// a per-thread cache of idle packets ("magazine") for each size class; these sit in front of
+// the shared free lists so that most allocations and releases never touch a lock
+struct SPacketThreadCache
+{
+	SPacketThreadCache() { m_Pool = nullptr; }
+	~SPacketThreadCache();
+
+	CPacketPool *m_Pool;
+
+	std::vector<CPacket *> m_Magazine[CPacketPool::NUM_CLASSES];
+};
@@ -84,6 +84,30 @@ void CPacketQueue::Enque(CPacket *ppkt)
 }
 
 
+size_t CPacketQueue::DequeBatch(CPacket **ppkts, size_t count)
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	size_t ret = 0;
+	while ((ret < count) && !m_Queue.empty())
+	{
+		ppkts[ret++] = m_Queue.front();
+		m_Queue.pop();
+	}
+
+	return ret;
+}
+
+
+void CPacketQueue::EnqueBatch(CPacket **ppkts, size_t count)
+{
+	std::lock_guard<std::mutex> l(m_Lock);
+
+	for (size_t i = 0; i < count; i++)
+		m_Queue.push(ppkts[i]);
+}
+
+
 bool CPacketQueue::Empty()
 {
 	return m_Queue.empty();
@@ -45,6 +45,12 @@ public:
 	CPacket *Deque(bool create_if_empty = false);
 	void Enque(CPacket *ppkt);
 
+	// moves up to count packets into ppkts under a single lock; returns the number moved
+	size_t DequeBatch(CPacket **ppkts, size_t count);
+
+	// adds count packets under a single lock
+	void EnqueBatch(CPacket **ppkts, size_t count);
+
 	bool Empty();
 
 protected:
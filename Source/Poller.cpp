@@ -0,0 +1,245 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "Poller.h"
+
+
+CPoller::CPoller()
+{
+	m_Next = 0;
+
+	memset(&m_WakeAddr, 0, sizeof(sockaddr_in));
+	m_WakeAddr.sin_family = AF_INET;
+	m_WakeAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	m_WakeAddr.sin_port = 0;
+
+	m_WakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_WakeSocket != INVALID_SOCKET)
+	{
+		int addrlen = sizeof(sockaddr_in);
+		if ((bind(m_WakeSocket, (sockaddr *)&m_WakeAddr, sizeof(sockaddr_in)) == SOCKET_ERROR) ||
+			(getsockname(m_WakeSocket, (sockaddr *)&m_WakeAddr, &addrlen) == SOCKET_ERROR))
+		{
+			closesocket(m_WakeSocket);
+			m_WakeSocket = INVALID_SOCKET;
+		}
+		else
+		{
+			u_long nonblocking = 1;
+			ioctlsocket(m_WakeSocket, FIONBIO, &nonblocking);
+		}
+	}
+
+	WSAPOLLFD wfd;
+	wfd.fd = m_WakeSocket;
+	wfd.events = POLLRDNORM;
+	wfd.revents = 0;
+	m_Fds.push_back(wfd);
+	m_Contexts.push_back(nullptr);
+}
+
+
+CPoller::~CPoller()
+{
+	if (m_WakeSocket != INVALID_SOCKET)
+		closesocket(m_WakeSocket);
+}
+
+
+void CPoller::QueueChange(SOCKET s, void *context, EChangeType type)
+{
+	std::lock_guard<std::mutex> l(m_ChangeLock);
+
+	SChange c;
+	c.m_Socket = s;
+	c.m_Context = context;
+	c.m_Type = type;
+	m_Changes.push_back(c);
+}
+
+
+void CPoller::Add(SOCKET s, void *context)
+{
+	QueueChange(s, context, CT_ADD);
+
+	Wake();
+}
+
+
+void CPoller::Remove(SOCKET s)
+{
+	QueueChange(s, nullptr, CT_REMOVE);
+}
+
+
+void CPoller::WatchWrite(SOCKET s, bool watch)
+{
+	QueueChange(s, nullptr, watch ? CT_WATCHWRITE : CT_UNWATCHWRITE);
+}
+
+
+void CPoller::Wake()
+{
+	if (m_WakeSocket != INVALID_SOCKET)
+	{
+		char b = 0;
+		sendto(m_WakeSocket, &b, 1, 0, (sockaddr *)&m_WakeAddr, sizeof(sockaddr_in));
+	}
+}
+
+
+void CPoller::ApplyChanges()
+{
+	std::lock_guard<std::mutex> l(m_ChangeLock);
+
+	for (auto &c : m_Changes)
+	{
+		TIndexMap::iterator it = m_Index.find(c.m_Socket);
+
+		if (c.m_Type == CT_ADD)
+		{
+			if (it != m_Index.end())
+			{
+				m_Contexts[it->second] = c.m_Context;
+				continue;
+			}
+
+			WSAPOLLFD fd;
+			fd.fd = c.m_Socket;
+			fd.events = POLLRDNORM;
+			fd.revents = 0;
+
+			m_Index.insert(TIndexMap::value_type(c.m_Socket, m_Fds.size()));
+			m_Fds.push_back(fd);
+			m_Contexts.push_back(c.m_Context);
+		}
+		else if (it == m_Index.end())
+		{
+			continue;
+		}
+		else if (c.m_Type == CT_WATCHWRITE)
+		{
+			m_Fds[it->second].events |= POLLWRNORM;
+		}
+		else if (c.m_Type == CT_UNWATCHWRITE)
+		{
+			m_Fds[it->second].events &= ~POLLWRNORM;
+		}
+		else
+		{
+			// move the last socket into the hole
+			size_t i = it->second;
+			size_t last = m_Fds.size() - 1;
+
+			if (i != last)
+			{
+				m_Fds[i] = m_Fds[last];
+				m_Contexts[i] = m_Contexts[last];
+				m_Index[m_Fds[i].fd] = i;
+			}
+
+			m_Fds.pop_back();
+			m_Contexts.pop_back();
+			m_Index.erase(it);
+		}
+	}
+
+	m_Changes.clear();
+}
+
+
+size_t CPoller::Wait(SPollEvent *events, size_t max, DWORD timeout)
+{
+	ApplyChanges();
+
+	// WSAPoll doesn't like an invalid socket, so without a wake socket it only gets the real ones
+	WSAPOLLFD *fds = m_Fds.data();
+	size_t fdct = m_Fds.size();
+	if (m_WakeSocket == INVALID_SOCKET)
+	{
+		fds++;
+		fdct--;
+
+		// nothing could wake us, so don't wait forever
+		if (timeout == INFINITE)
+			timeout = 10;
+	}
+
+	if (!fdct)
+	{
+		Sleep(timeout == INFINITE ? 10 : timeout);
+		return 0;
+	}
+
+	int ready = WSAPoll(fds, (ULONG)fdct, (timeout == INFINITE) ? -1 : (int)timeout);
+	if (ready <= 0)
+		return 0;
+
+	// drain the wake socket, if that's what woke us
+	if ((m_WakeSocket != INVALID_SOCKET) && m_Fds[0].revents)
+	{
+		char b[64];
+		while (recvfrom(m_WakeSocket, b, sizeof(b), 0, NULL, NULL) > 0)
+		{
+		}
+	}
+
+	size_t ret = 0;
+	size_t ct = m_Fds.size() - 1;
+
+	size_t n = 0;
+	for (; (n < ct) && (ret < max); n++)
+	{
+		size_t i = 1 + ((m_Next + n) % ct);
+
+		short rev = m_Fds[i].revents;
+		if (!rev)
+			continue;
+
+		events[ret].m_Socket = m_Fds[i].fd;
+		events[ret].m_Context = m_Contexts[i];
+		events[ret].m_Readable = (rev & POLLRDNORM) ? true : false;
+		events[ret].m_Writable = (rev & POLLWRNORM) ? true : false;
+		events[ret].m_Closed = (rev & (POLLHUP | POLLERR | POLLNVAL)) ? true : false;
+		ret++;
+
+		m_Fds[i].revents = 0;
+	}
+
+	// next time, pick up where we left off
+	if (ct)
+		m_Next = (m_Next + n) % ct;
+
+	return ret;
+}
@@ -0,0 +1,116 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+
+// the most events CPoller::Wait reports at once; more than that are picked up by the next call
+#define POLL_BATCH_SIZE		256
+
+
+// what happened on one socket, as reported by CPoller::Wait
+typedef struct sPollEvent
+{
+	SOCKET m_Socket;
+	void *m_Context;		// whatever was given to CPoller::Add
+	bool m_Readable;		// there's data to read
+	bool m_Writable;		// there's room to write, if WatchWrite asked about it
+	bool m_Closed;			// the connection has been closed or has failed
+} SPollEvent;
+
+
+// CPoller waits on any number of sockets at once and reports only the ones that are ready, many
+// per wakeup. It's built on WSAPoll, which - unlike WSAWaitForMultipleEvents - isn't limited to
+// 64 handles and doesn't need an event per socket
+class CPoller
+{
+public:
+	CPoller();
+	~CPoller();
+
+	// starts or stops watching a socket; these may be called from any thread, and take effect
+	// by the time the next Wait starts
+	void Add(SOCKET s, void *context);
+	void Remove(SOCKET s);
+
+	// whether to also report the socket once it can be written to; only worth asking for
+	// while there's something that wouldn't fit, since otherwise it's almost always writable
+	void WatchWrite(SOCKET s, bool watch);
+
+	// makes a Wait in progress, or the next one, return right away
+	void Wake();
+
+	// waits up to timeout milliseconds (or INFINITE) for sockets to become ready and fills in
+	// at most max events; returns the number of events filled in
+	size_t Wait(SPollEvent *events, size_t max, DWORD timeout);
+
+protected:
+	void ApplyChanges();
+
+	// m_Fds[0] is always the wake socket, which has no context
+	std::vector<WSAPOLLFD> m_Fds;
+	std::vector<void *> m_Contexts;
+
+	typedef std::map<SOCKET, size_t> TIndexMap;
+	TIndexMap m_Index;
+
+	enum EChangeType
+	{
+		CT_ADD = 0,
+		CT_REMOVE,
+		CT_WATCHWRITE,
+		CT_UNWATCHWRITE
+	};
+
+	typedef struct sChange
+	{
+		SOCKET m_Socket;
+		void *m_Context;
+		EChangeType m_Type;
+	} SChange;
+
+	void QueueChange(SOCKET s, void *context, EChangeType type);
+
+	// changes from other threads, which the waiting thread applies
+	std::vector<SChange> m_Changes;
+	std::mutex m_ChangeLock;
+
+	// a loopback datagram socket that Wake sends a byte to
+	SOCKET m_WakeSocket;
+	sockaddr_in m_WakeAddr;
+
+	// where reporting starts, so that sockets late in the list aren't starved when more than max are ready
+	size_t m_Next;
+};
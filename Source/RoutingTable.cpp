@@ -0,0 +1,421 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "RoutingTable.h"
+#include <algorithm>
+
+
+sInterestFilter::sInterestFilter(bool allow, const FOURCHARCODE *ids, size_t count)
+{
+	m_Allow = allow;
+
+	if (ids && count)
+		m_IDs.assign(ids, ids + count);
+
+	std::sort(m_IDs.begin(), m_IDs.end());
+}
+
+
+bool sInterestFilter::Passes(FOURCHARCODE id) const
+{
+	return (std::binary_search(m_IDs.begin(), m_IDs.end(), id) == m_Allow);
+}
+
+
+CRoutingTable::CRoutingTable()
+{
+	for (auto &p : m_Pages)
+		p.store(nullptr);
+
+	m_NextHandle = 0;
+	m_Epoch = 0;
+	m_Readers[0].m_Count = 0;
+	m_Readers[1].m_Count = 0;
+}
+
+
+CRoutingTable::~CRoutingTable()
+{
+	// nobody can be reading any more, so everything goes
+	for (auto &r : m_Retired)
+		r.m_Func(r.m_Context, r.m_Value);
+	m_Retired.clear();
+
+	for (auto &p : m_Pages)
+	{
+		TSlot *page = p;
+		if (!page)
+			continue;
+
+		for (size_t i = 0; i < ROUTINGTABLE_PAGE_SIZE; i++)
+		{
+			const SMemberList *ml = page[i];
+			if (!ml)
+				continue;
+
+			for (auto &m : ml->m_Members)
+				delete m.m_Filter;
+
+			delete ml;
+		}
+
+		delete [] page;
+	}
+}
+
+
+void CRoutingTable::FreeMembers(void *context, uintptr_t value)
+{
+	delete (const SMemberList *)value;
+}
+
+
+void CRoutingTable::FreeFilter(void *context, uintptr_t value)
+{
+	delete (const SInterestFilter *)value;
+}
+
+
+void CRoutingTable::FreeTable(void *context, uintptr_t value)
+{
+	CGUIDIndex::FreeTable((CGUIDIndex::STable *)value);
+}
+
+
+void CRoutingTable::FreeHandle(void *context, uintptr_t value)
+{
+	((CRoutingTable *)context)->m_FreeHandles.push_back((uint32_t)value);
+}
+
+
+CRoutingTable::CReader::CReader(CRoutingTable &table) : m_Table(table)
+{
+	m_Slot = (size_t)(m_Table.m_Epoch & 1);
+	m_Table.m_Readers[m_Slot].m_Count++;
+}
+
+
+CRoutingTable::CReader::~CReader()
+{
+	m_Table.m_Readers[m_Slot].m_Count--;
+}
+
+
+const SMemberList *CRoutingTable::CReader::Find(const GUID &channel) const
+{
+	uint32_t h = m_Table.m_Index.Find(channel);
+	if (h == GUIDINDEX_NONE)
+		return nullptr;
+
+	// a handle's page is there before the handle is published, and the handle isn't given to
+	// another channel while anyone could still find it for this one
+	const TSlot *page = m_Table.m_Pages[h / ROUTINGTABLE_PAGE_SIZE].load(std::memory_order_acquire);
+
+	return page[h % ROUTINGTABLE_PAGE_SIZE].load(std::memory_order_acquire);
+}
+
+
+CRoutingTable::TSlot &CRoutingTable::Slot(uint32_t handle) const
+{
+	return m_Pages[handle / ROUTINGTABLE_PAGE_SIZE].load()[handle % ROUTINGTABLE_PAGE_SIZE];
+}
+
+
+uint32_t CRoutingTable::NewHandle()
+{
+	if (!m_FreeHandles.empty())
+	{
+		uint32_t h = m_FreeHandles.back();
+		m_FreeHandles.pop_back();
+		return h;
+	}
+
+	uint32_t h = m_NextHandle;
+
+	size_t page = h / ROUTINGTABLE_PAGE_SIZE;
+	if (page >= ROUTINGTABLE_MAX_PAGES)
+		return GUIDINDEX_NONE;
+
+	if (!m_Pages[page].load())
+	{
+		TSlot *p = new TSlot[ROUTINGTABLE_PAGE_SIZE];
+		for (size_t i = 0; i < ROUTINGTABLE_PAGE_SIZE; i++)
+			p[i].store(nullptr);
+
+		m_Pages[page].store(p, std::memory_order_release);
+	}
+
+	m_NextHandle++;
+
+	return h;
+}
+
+
+void sMemberList::ForReactor(uint32_t reactor, size_t *begin, size_t *end) const
+{
+	size_t lo = 0, hi = m_Members.size();
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (m_Members[mid].m_Reactor < reactor)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*begin = lo;
+
+	hi = m_Members.size();
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (m_Members[mid].m_Reactor <= reactor)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*end = lo;
+}
+
+
+static std::vector<SMember>::const_iterator FindMember(const SMemberList *ml, uint32_t index)
+{
+	std::vector<SMember>::const_iterator it = ml->m_Members.begin();
+	while ((it != ml->m_Members.end()) && (it->m_Index != index))
+		++it;
+
+	return it;
+}
+
+
+bool CRoutingTable::Add(const GUID &channel, const SMember &member)
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	uint32_t h = m_Index.Find(channel);
+	if (h != GUIDINDEX_NONE)
+	{
+		TSlot &slot = Slot(h);
+
+		const SMemberList *old = slot;
+		if (FindMember(old, member.m_Index) != old->m_Members.end())
+			return false;
+
+		// it goes after the others that its reactor owns
+		std::vector<SMember>::const_iterator pos = old->m_Members.begin();
+		while ((pos != old->m_Members.end()) && (pos->m_Reactor <= member.m_Reactor))
+			++pos;
+
+		SMemberList *ml = new SMemberList();
+		ml->m_Members.reserve(old->m_Members.size() + 1);
+		ml->m_Members.insert(ml->m_Members.end(), old->m_Members.begin(), pos);
+		ml->m_Members.push_back(member);
+		ml->m_Members.insert(ml->m_Members.end(), pos, old->m_Members.end());
+
+		slot.store(ml, std::memory_order_release);
+		Retire(FreeMembers, nullptr, (uintptr_t)old);
+	}
+	else
+	{
+		h = NewHandle();
+		if (h == GUIDINDEX_NONE)
+			return false;
+
+		SMemberList *ml = new SMemberList();
+		ml->m_Members.push_back(member);
+
+		// the members are there before the channel can be found
+		Slot(h).store(ml, std::memory_order_release);
+
+		CGUIDIndex::STable *retired;
+		m_Index.Insert(channel, h, &retired);
+		if (retired)
+			Retire(FreeTable, nullptr, (uintptr_t)retired);
+	}
+
+	Reclaim();
+
+	return true;
+}
+
+
+void CRoutingTable::Remove(const GUID &channel, uint32_t member_index)
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	uint32_t h = m_Index.Find(channel);
+	if (h == GUIDINDEX_NONE)
+		return;
+
+	TSlot &slot = Slot(h);
+
+	const SMemberList *old = slot;
+	std::vector<SMember>::const_iterator it = FindMember(old, member_index);
+	if (it == old->m_Members.end())
+		return;
+
+	if (old->m_Members.size() > 1)
+	{
+		if (it->m_Filter)
+			Retire(FreeFilter, nullptr, (uintptr_t)it->m_Filter);
+
+		SMemberList *ml = new SMemberList();
+		ml->m_Members.reserve(old->m_Members.size() - 1);
+		ml->m_Members.insert(ml->m_Members.end(), old->m_Members.begin(), it);
+		ml->m_Members.insert(ml->m_Members.end(), it + 1, old->m_Members.end());
+
+		slot.store(ml, std::memory_order_release);
+		Retire(FreeMembers, nullptr, (uintptr_t)old);
+	}
+	else
+	{
+		// that was the last member, so the channel goes
+		m_Index.Erase(channel);
+		Drop(h);
+	}
+
+	Reclaim();
+}
+
+
+bool CRoutingTable::SetFilter(const GUID &channel, uint32_t member_index, SInterestFilter *filter)
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	const SMemberList *old = nullptr;
+	std::vector<SMember>::const_iterator it;
+
+	uint32_t h = m_Index.Find(channel);
+	if (h != GUIDINDEX_NONE)
+	{
+		old = Slot(h);
+		it = FindMember(old, member_index);
+	}
+
+	if (!old || (it == old->m_Members.end()))
+	{
+		delete filter;
+		return false;
+	}
+
+	if (it->m_Filter)
+		Retire(FreeFilter, nullptr, (uintptr_t)it->m_Filter);
+
+	SMemberList *ml = new SMemberList(*old);
+	ml->m_Members[it - old->m_Members.begin()].m_Filter = filter;
+
+	Slot(h).store(ml, std::memory_order_release);
+	Retire(FreeMembers, nullptr, (uintptr_t)old);
+
+	Reclaim();
+
+	return true;
+}
+
+
+void CRoutingTable::Clear()
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	for (uint32_t h = 0; h < m_NextHandle; h++)
+	{
+		if (Slot(h).load())
+			Drop(h);
+	}
+
+	CGUIDIndex::STable *retired;
+	m_Index.Clear(&retired);
+	if (retired)
+		Retire(FreeTable, nullptr, (uintptr_t)retired);
+
+	Reclaim();
+}
+
+
+void CRoutingTable::Drop(uint32_t handle)
+{
+	TSlot &slot = Slot(handle);
+
+	const SMemberList *ml = slot;
+	for (auto &m : ml->m_Members)
+	{
+		if (m.m_Filter)
+			Retire(FreeFilter, nullptr, (uintptr_t)m.m_Filter);
+	}
+
+	Retire(FreeMembers, nullptr, (uintptr_t)ml);
+	slot.store(nullptr, std::memory_order_release);
+
+	// readers that already have the handle may still look at its slot
+	Retire(FreeHandle, this, handle);
+}
+
+
+void CRoutingTable::Defer(DEFER_FUNC func, void *context, uintptr_t value)
+{
+	std::lock_guard<std::mutex> l(m_WriteLock);
+
+	Retire(func, context, value);
+
+	Reclaim();
+}
+
+
+void CRoutingTable::Retire(DEFER_FUNC func, void *context, uintptr_t value)
+{
+	SRetired r;
+	r.m_Func = func;
+	r.m_Context = context;
+	r.m_Value = value;
+	r.m_Epoch = m_Epoch;
+	m_Retired.push_back(r);
+}
+
+
+void CRoutingTable::Reclaim()
+{
+	uint64_t e = m_Epoch;
+
+	// readers from the epoch before this one share a counter with the next; once they're gone,
+	// the next one can start
+	if (!m_Readers[(e + 1) & 1].m_Count)
+		m_Epoch = ++e;
+
+	while (!m_Retired.empty() && ((m_Retired.front().m_Epoch + 2) <= e))
+	{
+		m_Retired.front().m_Func(m_Retired.front().m_Context, m_Retired.front().m_Value);
+		m_Retired.pop_front();
+	}
+}
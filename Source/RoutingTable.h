@@ -0,0 +1,186 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "GUIDIndex.h"
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+
+// each channel gets a handle, which picks out its members from pages of this many slots; the
+// pages never move, so readers can index them without a lock
+#define ROUTINGTABLE_PAGE_SIZE		4096
+#define ROUTINGTABLE_MAX_PAGES		1024
+
+
+class CSendBatch;
+
+// which packets a listener wants; a fragment is judged by the id of the message it's part of
+typedef struct sInterestFilter
+{
+	sInterestFilter(bool allow, const FOURCHARCODE *ids, size_t count);
+
+	// returns true if packets with the given id should go to the listener
+	bool Passes(FOURCHARCODE id) const;
+
+	// if set, only these ids pass; otherwise, everything but these does
+	bool m_Allow;
+
+	// sorted
+	std::vector<FOURCHARCODE> m_IDs;
+} SInterestFilter;
+
+// what fan-out needs to know about one member of a channel, resolved when it joins, so that
+// sending to a channel is a walk over these with nothing to look up. The owner has to keep what
+// they point to around until no reader can still see them (see CRoutingTable::Defer)
+typedef struct sMember
+{
+	uint32_t m_Index;			// the connection's index; members are told apart by it
+	uint32_t m_Reactor;			// which I/O thread owns the connection
+	SOCKET m_Socket;
+	CSendBatch *m_Queue;		// where packets for it wait to go out
+	void *m_Context;			// the owner's record of the connection
+	const SInterestFilter *m_Filter;	// what it wants from this channel; nullptr if it hasn't said
+} SMember;
+
+// a channel's members as of some moment; once published it never changes, so readers can walk
+// it without a lock
+typedef struct sMemberList
+{
+	// kept in m_Reactor order, so that each I/O thread's members are together
+	std::vector<SMember> m_Members;
+
+	// finds [begin, end) of the members that the given reactor owns
+	void ForReactor(uint32_t reactor, size_t *begin, size_t *end) const;
+} SMemberList;
+
+
+// CRoutingTable maps channels to their members for many readers and few writers. Readers never
+// lock or wait: each channel's members are an immutable snapshot that writers replace, rather than
+// change, and the old snapshots are only freed once no reader can still be looking at them.
+//
+// Readers announce themselves in one of two counters, picked by the current epoch. Writers retire
+// what they replace under the epoch it was replaced in, and move the epoch on whenever nobody is
+// left in the previous one; anything retired two epochs ago can no longer be seen by anyone
+class CRoutingTable
+{
+public:
+	CRoutingTable();
+	~CRoutingTable();
+
+	// a reader's view of the table; whatever is found through it stays valid until it goes away,
+	// so keep it short-lived
+	class CReader
+	{
+	public:
+		CReader(CRoutingTable &table);
+		~CReader();
+
+		// returns the channel's members, or nullptr if it has none
+		const SMemberList *Find(const GUID &channel) const;
+
+	protected:
+		CRoutingTable &m_Table;
+		size_t m_Slot;
+	};
+
+	// these may be called from any thread; returns false if member was already in the channel
+	bool Add(const GUID &channel, const SMember &member);
+
+	void Remove(const GUID &channel, uint32_t member_index);
+
+	// replaces what the member wants from the channel (nullptr if it hasn't said); the table takes
+	// over the filter either way. Returns false if it isn't a member
+	bool SetFilter(const GUID &channel, uint32_t member_index, SInterestFilter *filter);
+
+	// empties every channel
+	void Clear();
+
+	typedef void (*DEFER_FUNC)(void *context, uintptr_t value);
+
+	// calls func once no reader that has started by now can still be using what it found, e.g. to
+	// hand out again a member index that has just been removed from every channel. func is called
+	// with the table's lock held, so it mustn't call back into the table
+	void Defer(DEFER_FUNC func, void *context, uintptr_t value);
+
+protected:
+	typedef std::atomic<const SMemberList *> TSlot;
+
+	typedef struct sRetired
+	{
+		DEFER_FUNC m_Func;
+		void *m_Context;
+		uintptr_t m_Value;
+		uint64_t m_Epoch;
+	} SRetired;
+
+	// the rest are only called by writers, holding m_WriteLock
+	TSlot &Slot(uint32_t handle) const;
+
+	uint32_t NewHandle();
+
+	// empties a channel whose handle is no longer in the index
+	void Drop(uint32_t handle);
+
+	// hands something that has been replaced over to be dealt with once no reader can see it
+	void Retire(DEFER_FUNC func, void *context, uintptr_t value);
+
+	// moves the epoch on if it can, and frees whatever it's now safe to
+	void Reclaim();
+
+	static void FreeMembers(void *context, uintptr_t value);
+	static void FreeFilter(void *context, uintptr_t value);
+	static void FreeTable(void *context, uintptr_t value);
+	static void FreeHandle(void *context, uintptr_t value);
+
+	// channel -> handle
+	CGUIDIndex m_Index;
+
+	std::atomic<TSlot *> m_Pages[ROUTINGTABLE_MAX_PAGES];
+	uint32_t m_NextHandle;
+	std::vector<uint32_t> m_FreeHandles;
+
+	std::atomic<uint64_t> m_Epoch;
+
+	// how many readers are in even and odd epochs, each on its own cache line
+	struct alignas(64) SReaderCount
+	{
+		std::atomic<size_t> m_Count;
+	};
+	SReaderCount m_Readers[2];
+
+	std::deque<SRetired> m_Retired;
+
+	std::mutex m_WriteLock;
+};
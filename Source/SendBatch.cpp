@@ -0,0 +1,290 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "SendBatch.h"
+
+
+CSendBatch::CSendBatch()
+{
+	m_Bytes = 0;
+	m_Packets = 0;
+	m_Slow = false;
+	m_MaxBytes = SENDBATCH_DEFAULT_BYTES;
+	m_MaxBuffers = SENDBATCH_DEFAULT_BUFFERS;
+	m_QueueBytes = 0;
+	m_QueuePackets = 0;
+}
+
+
+CSendBatch::~CSendBatch()
+{
+	Clear();
+}
+
+
+void CSendBatch::SetLimits(uint32_t max_bytes, uint32_t max_buffers)
+{
+	m_MaxBytes = max_bytes;
+	m_MaxBuffers = max_buffers;
+}
+
+
+void CSendBatch::SetQueueLimits(uint64_t max_bytes, size_t max_packets)
+{
+	m_QueueBytes = max_bytes;
+	m_QueuePackets = max_packets;
+}
+
+
+bool CSendBatch::Add(CPacket *ppkt, const WSABUF *buf, DWORD bufct, CCompactHeaderEncoder *enc)
+{
+	if (!bufct)
+		return false;
+
+	m_Queue.emplace_back();
+	SQueued &q = m_Queue.back();
+
+	q.m_Ext = NULL;
+	q.m_ExtLength = 0;
+	q.m_Held = NULL;
+	q.m_Sent = 0;
+	q.m_Queued = std::chrono::steady_clock::now();
+
+	const SPacketHeader *hdr = (const SPacketHeader *)buf[0].buf;
+
+	// the header always gets copied, since it's usually on the caller's stack
+	bool defined = false;
+	if (enc)
+	{
+		q.m_HeadLength = enc->Encode(hdr, q.m_Head, &defined);
+	}
+	else
+	{
+		q.m_HeadLength = buf[0].len;
+		memcpy(q.m_Head, buf[0].buf, buf[0].len);
+	}
+
+	for (DWORD i = 1; i < bufct; i++)
+	{
+		if (!buf[i].len)
+			continue;
+
+		if ((buf[i].len <= SENDBATCH_COPY_SIZE) && ((q.m_HeadLength + buf[i].len) <= SENDBATCH_HEAD_SIZE))
+		{
+			memcpy(q.m_Head + q.m_HeadLength, buf[i].buf, buf[i].len);
+			q.m_HeadLength += buf[i].len;
+		}
+		else
+		{
+			q.m_Ext = (const BYTE *)buf[i].buf;
+			q.m_ExtLength = buf[i].len;
+		}
+	}
+
+	if (q.m_Ext && ppkt)
+	{
+		ppkt->IncRef();
+		q.m_Held = ppkt;
+	}
+
+	// the other end can't do without pieces of large messages, header negotiation, or a header
+	// that defines a GUID the headers after it refer to
+	q.m_Droppable = !defined && (hdr->m_ID != PACKETID_FRAGMENT) && (hdr->m_ID != PACKETID_HEADERMODE);
+
+	m_Bytes += q.m_HeadLength + q.m_ExtLength;
+	m_Packets++;
+
+	return ((m_Bytes >= m_MaxBytes) || ((m_Packets * 2) >= m_MaxBuffers));
+}
+
+
+bool CSendBatch::Overflows(uint64_t len) const
+{
+	if (!m_Packets)
+		return false;
+
+	return (m_QueueBytes && ((m_Bytes + len) > m_QueueBytes)) || (m_QueuePackets && (m_Packets >= m_QueuePackets));
+}
+
+
+bool CSendBatch::DropOldest(uint64_t len)
+{
+	std::deque<SQueued>::iterator it = m_Queue.begin();
+	while ((it != m_Queue.end()) && Overflows(len))
+	{
+		if (it->m_Sent || !it->m_Droppable)
+		{
+			++it;
+			continue;
+		}
+
+		m_Bytes -= it->m_HeadLength + it->m_ExtLength;
+		Drop(*it);
+		it = m_Queue.erase(it);
+	}
+
+	return !Overflows(len);
+}
+
+
+int CSendBatch::Flush(SOCKET s)
+{
+	// each write is capped like a batch would be, but always takes at least one packet
+	size_t max_bufs = std::max<size_t>(m_MaxBuffers, 2);
+	uint64_t max_bytes = m_MaxBytes;
+
+	// room for a full head per buffer; a write stops taking packets once this is full, and the first
+	// packet always fits
+	if (m_Scratch.size() < (max_bufs * SENDBATCH_HEAD_SIZE))
+		m_Scratch.resize(max_bufs * SENDBATCH_HEAD_SIZE);
+
+	while (!m_Queue.empty())
+	{
+		m_Bufs.clear();
+		size_t used = 0;
+		uint64_t total = 0;
+
+		for (auto &q : m_Queue)
+		{
+			uint32_t ofs = q.m_Sent;
+
+			// runs of copied pieces share buffers, so the buffer count alone doesn't bound the scratch
+			uint32_t copy = (ofs < q.m_HeadLength) ? (q.m_HeadLength - ofs) : 0;
+			if (!m_Bufs.empty() && (((m_Bufs.size() + 2) > max_bufs) || (total >= max_bytes) || ((used + copy) > m_Scratch.size())))
+				break;
+
+			if (ofs < q.m_HeadLength)
+			{
+				uint32_t len = q.m_HeadLength - ofs;
+				BYTE *dst = m_Scratch.data() + used;
+				memcpy(dst, q.m_Head + ofs, len);
+
+				// runs of copied pieces are merged into one buffer
+				if (!m_Bufs.empty() && (((BYTE *)m_Bufs.back().buf + m_Bufs.back().len) == dst))
+				{
+					m_Bufs.back().len += len;
+				}
+				else
+				{
+					WSABUF b;
+					b.buf = (char *)dst;
+					b.len = len;
+					m_Bufs.push_back(b);
+				}
+
+				used += len;
+				total += len;
+				ofs = q.m_HeadLength;
+			}
+
+			if (q.m_ExtLength)
+			{
+				uint32_t extofs = ofs - q.m_HeadLength;
+
+				WSABUF b;
+				b.buf = (char *)q.m_Ext + extofs;
+				b.len = q.m_ExtLength - extofs;
+				m_Bufs.push_back(b);
+
+				total += b.len;
+			}
+		}
+
+		DWORD sct = 0;
+		if (WSASend(s, m_Bufs.data(), (DWORD)m_Bufs.size(), &sct, 0, NULL, NULL) == SOCKET_ERROR)
+			return (WSAGetLastError() == WSAEWOULDBLOCK) ? SENDBATCH_BLOCKED : SENDBATCH_FAILED;
+
+		// if the socket took less than it was given, the next write finds out whether it's full
+		Consume(sct);
+	}
+
+	m_Slow = false;
+
+	return SENDBATCH_SENT;
+}
+
+
+void CSendBatch::Consume(uint64_t len)
+{
+	m_Bytes -= len;
+
+	while (len && !m_Queue.empty())
+	{
+		SQueued &q = m_Queue.front();
+
+		uint32_t left = q.m_HeadLength + q.m_ExtLength - q.m_Sent;
+		if (len < left)
+		{
+			q.m_Sent += (uint32_t)len;
+			break;
+		}
+
+		len -= left;
+		Drop(q);
+		m_Queue.pop_front();
+	}
+}
+
+
+void CSendBatch::Drop(SQueued &q)
+{
+	if (q.m_Held)
+		q.m_Held->Release();
+
+	m_Packets--;
+}
+
+
+void CSendBatch::Clear()
+{
+	for (auto &q : m_Queue)
+	{
+		if (q.m_Held)
+			q.m_Held->Release();
+	}
+
+	m_Queue.clear();
+	m_Bytes = 0;
+	m_Packets = 0;
+	m_Slow = false;
+}
+
+
+uint64_t CSendBatch::Age() const
+{
+	if (Empty())
+		return 0;
+
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_Queue.front().m_Queued).count();
+}
@@ -0,0 +1,140 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "CompactHeader.h"
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+// pieces at most this big are copied in with the header, so that runs of small packets go out
+// as a few large buffers rather than many tiny ones
+#define SENDBATCH_COPY_SIZE		256
+
+// room for the largest header, a fragment header, and a copied piece
+#define SENDBATCH_HEAD_SIZE		(MAX_COMPACT_HEADER + sizeof(SFragmentHeader) + SENDBATCH_COPY_SIZE)
+
+#define SENDBATCH_DEFAULT_BYTES		(64 * 1024)
+#define SENDBATCH_DEFAULT_BUFFERS	64
+
+// what CSendBatch::Flush did
+#define SENDBATCH_SENT			0		// everything went out
+#define SENDBATCH_BLOCKED		1		// the socket said it would block (so FD_WRITE is signalled when it has room); the rest waits until then
+#define SENDBATCH_FAILED		-1		// the connection is broken
+
+
+// CSendBatch is the queue of packets going out to one socket. They're gathered so that they go out
+// with as few WSASend calls as possible, and whatever a non-blocking socket won't take yet (even
+// part of a packet) stays queued for the next Flush
+class CSendBatch
+{
+public:
+	CSendBatch();
+	~CSendBatch();
+
+	// the batch should be flushed once it holds max_bytes or max_buffers pieces, and no single write
+	// is bigger than that; 0 for either sends every packet on its own
+	void SetLimits(uint32_t max_bytes, uint32_t max_buffers);
+
+	// bounds what may be waiting to go out, as checked by Overflows; 0 for either means no bound
+	void SetQueueLimits(uint64_t max_bytes, size_t max_packets);
+
+	// adds a packet whose full header is in buf[0]; the header is swapped for a compact one if enc
+	// is given. Only the last piece may be too big to copy, in which case it must belong to ppkt,
+	// which is held until that piece has gone out. Returns true if it's time to flush
+	bool Add(CPacket *ppkt, const WSABUF *buf, DWORD bufct, CCompactHeaderEncoder *enc);
+
+	// whether a packet of len bytes would go over the queue's bounds (an empty queue takes anything).
+	// May be called from any thread
+	bool Overflows(uint64_t len) const;
+
+	// throws away whole packets, oldest first, that haven't started going out and that the other end
+	// can do without, until a packet of len bytes fits; returns false if that wasn't enough
+	bool DropOldest(uint64_t len);
+
+	// sends as much as the socket will take; returns one of the SENDBATCH_ results
+	int Flush(SOCKET s);
+
+	// lets go of everything without sending it
+	void Clear();
+
+	bool Empty() const { return m_Queue.empty(); }
+
+	// how long, in microseconds, the oldest packet in the batch has been waiting
+	uint64_t Age() const;
+
+	// notes that the queue has overflowed; returns true only the first time since it was last
+	// empty, so that a slow consumer is reported once rather than for every packet
+	bool MarkSlow() { return !m_Slow.exchange(true); }
+
+protected:
+	typedef struct sQueued
+	{
+		BYTE m_Head[SENDBATCH_HEAD_SIZE];	// the header and any pieces small enough to copy
+		uint32_t m_HeadLength;
+
+		const BYTE *m_Ext;					// the last piece, if it was too big to copy
+		uint32_t m_ExtLength;
+		CPacket *m_Held;					// the packet m_Ext points into
+
+		uint32_t m_Sent;					// how much of the packet has gone out
+		bool m_Droppable;
+
+		std::chrono::steady_clock::time_point m_Queued;
+	} SQueued;
+
+	// takes len sent bytes off the front of the queue
+	void Consume(uint64_t len);
+
+	void Drop(SQueued &q);
+
+	std::deque<SQueued> m_Queue;
+
+	// what the next WSASend is given; consecutive copied pieces are gathered into m_Scratch
+	std::vector<WSABUF> m_Bufs;
+	std::vector<BYTE> m_Scratch;
+
+	// what hasn't gone out yet
+	std::atomic<uint64_t> m_Bytes;
+	std::atomic<size_t> m_Packets;
+
+	std::atomic<bool> m_Slow;
+
+	uint32_t m_MaxBytes;
+	uint32_t m_MaxBuffers;
+
+	uint64_t m_QueueBytes;
+	size_t m_QueuePackets;
+};
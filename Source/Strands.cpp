@@ -0,0 +1,144 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#include "stdafx.h"
+
+#include "Strands.h"
+#include "GUIDIndex.h"
+
+extern CExecutor *g_ThreadPool;
+
+
+CStrands::CStrands()
+{
+	for (auto &s : m_Strands)
+		s.m_Running = false;
+}
+
+
+CStrands::~CStrands()
+{
+	for (auto &s : m_Strands)
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> l(s.m_Lock);
+				if (!s.m_Running)
+					break;
+			}
+
+			Sleep(1);
+		}
+	}
+}
+
+
+void CStrands::Post(const GUID &key, CExecutor::TASK_CALLBACK func, void *param0, void *param1, CExecutor::ELane lane)
+{
+	Post(CGUIDIndex::Hash(key), func, param0, param1, lane);
+}
+
+
+void CStrands::Post(size_t key, CExecutor::TASK_CALLBACK func, void *param0, void *param1, CExecutor::ELane lane)
+{
+	SStrand &s = m_Strands[key % STRANDS_COUNT];
+
+	STask t;
+	t.m_Func = func;
+	t.m_Param0 = param0;
+	t.m_Param1 = param1;
+	t.m_Lane = lane;
+
+	bool start;
+	{
+		std::lock_guard<std::mutex> l(s.m_Lock);
+
+		s.m_Tasks.push_back(t);
+
+		start = !s.m_Running;
+		s.m_Running = true;
+	}
+
+	if (start)
+		g_ThreadPool->RunTask(RunStrand, (void *)&s, nullptr, 1, false, lane);
+}
+
+
+CExecutor::TASK_RETURN __cdecl CStrands::RunStrand(void *param0, void *param1, size_t task_number)
+{
+	SStrand *s = (SStrand *)param0;
+
+	size_t n = 0;
+	while (true)
+	{
+		STask t;
+		{
+			std::lock_guard<std::mutex> l(s->m_Lock);
+
+			if (s->m_Tasks.empty())
+			{
+				s->m_Running = false;
+				break;
+			}
+
+			t = s->m_Tasks.front();
+			s->m_Tasks.pop_front();
+		}
+
+		t.m_Func(t.m_Param0, t.m_Param1, 0);
+
+		// other work gets a turn; the strand is still marked as running, so nothing can overtake
+		// what's left in it. It goes back in the lane of what's next, and if the pool won't take
+		// it, it just carries on here
+		if ((++n % STRANDS_BATCH) == 0)
+		{
+			CExecutor::ELane lane;
+			{
+				std::lock_guard<std::mutex> l(s->m_Lock);
+
+				if (s->m_Tasks.empty())
+				{
+					s->m_Running = false;
+					break;
+				}
+
+				lane = s->m_Tasks.front().m_Lane;
+			}
+
+			if (g_ThreadPool->RunTask(RunStrand, (void *)s, nullptr, 1, false, lane))
+				break;
+		}
+	}
+
+	return CExecutor::TR_OK;
+}
@@ -0,0 +1,89 @@
+/*
+	mqme Library Source File
+
+	Copyright  2009-2021, Keelan Stuart. All rights reserved.
+
+	mqme (pronounced "make me") is a Windows-only C++ API and library that facilitates easy
+	distribution of network	packets	with multiple connection end-points. One-to-many is just
+	as easy as one-to-one. Handling different types of incoming data is as simple as writing
+	a callback that	recognizes a four character code (the 'CODE' form is the easiest way
+	to use it).
+
+	mqme was written as a response to the (IMO) confusing popularity
+	of RabbitMQ, ActiveMQ, ZeroMQ, etc. RabbitMQ is written in Erlang and requires
+	multiple support installations and configuration files to function -- which, I think,
+	is bad for commercial products. ActiveMQ, to my knowledge, is similar. ZeroMQ forces
+	the user to conform to transactional patterns that are not conducive to parallel
+	processing of requests and does not allow comprehensive, complex, or numerous
+	subscriptions. In essence, it was my opinion that none of those packages was
+	"good enough" for me, making me write my own.
+
+	mqme is free software; you can redistribute it and/or modify it under
+	the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or
+	(at your option) any later version.
+
+	mqme is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+	See <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Packet.h"
+#include "Executor.h"
+#include <deque>
+#include <mutex>
+
+// how many strands a CStrands has; keys are spread over them by hash
+#define STRANDS_COUNT				256
+
+// how many tasks a strand runs before it gives its thread up to other work
+#define STRANDS_BATCH				32
+
+
+// CStrands runs tasks on the thread pool one at a time per key, in the order they were posted,
+// while tasks with different keys run in parallel. A strand is only ever on one worker at a time;
+// it takes its tasks in order until it runs out, and only then can it be picked up again.
+//
+// Keys share a fixed number of strands, so two keys may end up in the same one - which costs
+// some parallelism between them, but never ordering
+class CStrands
+{
+public:
+	CStrands();
+
+	// waits for every strand to finish what it has been given
+	~CStrands();
+
+	// runs func(param0, param1) after everything posted before it with the same key; the lane is
+	// the one the strand is run in if it isn't already
+	void Post(const GUID &key, CExecutor::TASK_CALLBACK func, void *param0, void *param1, CExecutor::ELane lane = CExecutor::EL_NORMAL);
+
+	// the same, for keys that are already small numbers that are spread out well
+	void Post(size_t key, CExecutor::TASK_CALLBACK func, void *param0, void *param1, CExecutor::ELane lane = CExecutor::EL_NORMAL);
+
+protected:
+	typedef struct sTask
+	{
+		CExecutor::TASK_CALLBACK m_Func;
+		void *m_Param0;
+		void *m_Param1;
+		CExecutor::ELane m_Lane;
+	} STask;
+
+	typedef struct alignas(64) sStrand
+	{
+		std::mutex m_Lock;
+		std::deque<STask> m_Tasks;
+
+		// whether it's queued or running on the pool
+		bool m_Running;
+	} SStrand;
+
+	static CExecutor::TASK_RETURN __cdecl RunStrand(void *param0, void *param1, size_t task_number);
+
+	SStrand m_Strands[STRANDS_COUNT];
+};
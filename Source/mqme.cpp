@@ -34,8 +34,8 @@
 
 #include <mqme.h>
 #include "Packet.h"
-#include "PacketQueue.h"
-#include <Pool.h>
+#include "PacketPool.h"
+#include "Executor.h"
 
 
 // Need to link with Ws2_32.lib
@@ -65,13 +65,13 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
 	return TRUE;
 }
 
-CPacketQueue *g_IdlePackets = NULL;
-pool::IThreadPool *g_ThreadPool = NULL;
+CPacketPool *g_PacketPool = NULL;
+CExecutor *g_ThreadPool = NULL;
 bool g_Initialized = false;
 
 bool operator <(const GUID &a, const GUID &b) { return (memcmp(&a, &b, sizeof(GUID)) <= 0) ? true : false; }
 
-bool mqme::Initialize(UINT initial_idle_packet_count, UINT initial_packet_size, UINT threads_per_core, INT core_count_adjustment)
+bool mqme::Initialize(UINT initial_idle_packet_count, UINT initial_packet_size, UINT threads_per_core, INT core_count_adjustment, UINT thread_packet_cache_size)
 {
 	if (g_Initialized)
 		return true;
@@ -80,10 +80,10 @@ bool mqme::Initialize(UINT initial_idle_packet_count, UINT initial_packet_size,
     if (0 != WSAStartup(MAKEWORD(2, 2), &wsaData))
         return false;
 
-	g_IdlePackets = new CPacketQueue(initial_idle_packet_count, initial_packet_size);
-	g_ThreadPool = pool::IThreadPool::Create(threads_per_core, core_count_adjustment);
+	g_PacketPool = new CPacketPool(initial_idle_packet_count, initial_packet_size, thread_packet_cache_size);
+	g_ThreadPool = CExecutor::Create(threads_per_core, core_count_adjustment);
 
-	g_Initialized = (g_IdlePackets != nullptr) && (g_ThreadPool != nullptr);
+	g_Initialized = (g_PacketPool != nullptr) && (g_ThreadPool != nullptr);
 
 	return g_Initialized;
 }
@@ -96,22 +96,44 @@ void mqme::Close()
 		g_Initialized = false;
 	}
 
-	if (g_IdlePackets)
-	{
-		delete g_IdlePackets;
-		g_IdlePackets = NULL;
-	}
-
+	// the workers may still be releasing packets, so stop them before the pool goes away
 	if (g_ThreadPool)
 	{
 		g_ThreadPool->Release();
 		g_ThreadPool = NULL;
 	}
+
+	if (g_PacketPool)
+	{
+		delete g_PacketPool;
+		g_PacketPool = NULL;
+	}
 }
 
-ICorePacket *ICorePacket::NewPacket()
+bool mqme::GetPoolStats(SPoolStats *stats)
 {
-	CPacket *pkt = g_IdlePackets ? g_IdlePackets->Deque(true) : NULL;
+	if (!g_PacketPool || !stats)
+		return false;
+
+	g_PacketPool->GetStats(stats);
+
+	return true;
+}
+
+void mqme::SetPoolLimits(size_t idle_packets_high, size_t idle_packets_low, uint64_t idle_bytes_high, uint64_t idle_bytes_low)
+{
+	if (g_PacketPool)
+		g_PacketPool->SetLimits(idle_packets_high, idle_packets_low, idle_bytes_high, idle_bytes_low);
+}
+
+ICorePacket *ICorePacket::NewPacket(uint32_t size_hint)
+{
+	CPacket *pkt = g_PacketPool ? g_PacketPool->Deque(size_hint) : NULL;
+	if (!pkt)
+		return NULL;
+
+	// the caller owns the first reference
+	pkt->IncRef();
 
 	GUID g = { 0 };
 	pkt->SetContext(g);
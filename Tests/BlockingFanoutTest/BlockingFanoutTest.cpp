@@ -0,0 +1,196 @@
+// BlockingFanoutTest.cpp : Checks that a server which splits its fan-out into pieces keeps going
+// when its handlers are stuck in SendPacket waiting for a slow consumer (OP_BLOCK).
+//
+// A publisher asks the server for packets faster than one of the subscribers takes them; that one
+// stops reading for a while, so its queue fills and every handler that's sending to the channel
+// waits for room. Meanwhile the I/O thread has packets to queue to more listeners than
+// SetParallelFanout allows in one piece. Once the subscriber reads again, every subscriber must end
+// up with every packet, in time.
+//
+
+#include "stdafx.h"
+#include <mqme.h>
+#include <atomic>
+#include <vector>
+
+#define PORT				12348
+#define SUBSCRIBERS			8
+#define REQUESTS			256
+#define PACKETS_PER_REQUEST	16
+#define PAYLOAD_SIZE		4096
+#define QUEUE_BYTES			(16 * 1024)
+#define PIECE_SIZE			2
+#define STALL_MS			1000
+#define DEADLINE_MS			30000
+
+static const GUID channel = { 0x2B7E4C19, 0x8D3A, 0x4F61, { 0xA5, 0x0C, 0x3E, 0x92, 0x71, 0xD4, 0x6B, 0x18 } };
+
+mqme::ICoreServer *pServer;
+
+// set once the slow subscriber may start reading again
+HANDLE hResume;
+
+std::atomic<uint64_t> received[SUBSCRIBERS];
+
+// each request has the server send the channel a run of packets, from a worker; those are the
+// sends that wait for room
+bool HandleRequest(mqme::ICoreServer *server, mqme::ICorePacket *packet, LPVOID userdata)
+{
+	BYTE payload[PAYLOAD_SIZE];
+	memset(payload, 0, sizeof(payload));
+
+	for (size_t i = 0; i < PACKETS_PER_REQUEST; i++)
+	{
+		mqme::ICorePacket *pp = mqme::ICorePacket::NewPacket(sizeof(payload));
+		if (!pp)
+			break;
+
+		pp->SetContext(channel);
+		pp->SetData('DATA', sizeof(payload), payload);
+		server->SendPacket(pp);
+	}
+
+	return true;
+}
+
+bool HandleData(mqme::ICoreClient *client, mqme::ICorePacket *packet, LPVOID userdata)
+{
+	size_t n = (size_t)userdata;
+
+	// the first subscriber stops reading at its first packet, until it's let go
+	if (!n && !received[n])
+		WaitForSingleObject(hResume, INFINITE);
+
+	received[n]++;
+
+	return true;
+}
+
+mqme::ICoreClient *Connect(size_t subscriber)
+{
+	mqme::ICoreClient *pClient = mqme::ICoreClient::NewClient();
+	if (!pClient)
+		return nullptr;
+
+	if (subscriber != SIZE_MAX)
+		pClient->RegisterPacketHandler('DATA', HandleData, (LPVOID)subscriber, mqme::HF_INLINE);
+
+	if (pClient->Connect(_T("127.0.0.1"), PORT))
+	{
+		for (size_t i = 0; (i < 500) && !pClient->IsConnected(); i++)
+			Sleep(10);
+
+		// the server may not have it indexed quite yet, so keep trying for a bit
+		for (size_t i = 0; (subscriber != SIZE_MAX) && (i < 500) && pClient->IsConnected(); i++)
+		{
+			if (pServer->AddListenerToChannel(channel, pClient->GetID()))
+				return pClient;
+
+			Sleep(10);
+		}
+
+		if ((subscriber == SIZE_MAX) && pClient->IsConnected())
+			return pClient;
+	}
+
+	pClient->Release();
+
+	return nullptr;
+}
+
+int main()
+{
+	if (!mqme::Initialize())
+		return 1;
+
+	hResume = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	pServer = mqme::ICoreServer::NewServer();
+	if (!pServer)
+		return 1;
+
+	pServer->SetOutboundLimits(QUEUE_BYTES, 0, mqme::ICoreServer::OP_BLOCK);
+	pServer->SetParallelFanout(PIECE_SIZE);
+	pServer->RegisterPacketHandler('REQU', HandleRequest);
+
+	if (!pServer->StartListening(PORT))
+	{
+		_tprintf(_T("FAILED: couldn't listen on port %u\n"), PORT);
+		return 1;
+	}
+
+	std::vector<mqme::ICoreClient *> subscribers;
+	for (size_t i = 0; i < SUBSCRIBERS; i++)
+	{
+		mqme::ICoreClient *pClient = Connect(i);
+		if (pClient)
+			subscribers.push_back(pClient);
+	}
+
+	mqme::ICoreClient *publisher = Connect(SIZE_MAX);
+
+	if ((subscribers.size() != SUBSCRIBERS) || !publisher)
+	{
+		_tprintf(_T("FAILED: couldn't connect all of the clients\n"));
+		return 1;
+	}
+
+	// the requests are for the server alone, so their context is blank
+	GUID serverguid = { 0 };
+	for (size_t i = 0; i < REQUESTS; i++)
+	{
+		mqme::ICorePacket *pp = mqme::ICorePacket::NewPacket(0);
+		if (!pp)
+			break;
+
+		pp->SetContext(serverguid);
+		pp->SetData('REQU', 0, nullptr);
+		publisher->SendPacket(pp);
+	}
+
+	// long enough for the slow subscriber's queue to fill and the handlers to start waiting
+	Sleep(STALL_MS);
+	SetEvent(hResume);
+
+	const uint64_t expected = REQUESTS * PACKETS_PER_REQUEST;
+
+	DWORD start = GetTickCount();
+	bool done = false;
+	while (!done && ((GetTickCount() - start) < DEADLINE_MS))
+	{
+		done = true;
+		for (size_t i = 0; i < SUBSCRIBERS; i++)
+			done = done && (received[i] == expected);
+
+		if (!done)
+			Sleep(10);
+	}
+
+	if (!done)
+	{
+		uint64_t total = 0;
+		for (size_t i = 0; i < SUBSCRIBERS; i++)
+			total += received[i];
+
+		_tprintf(_T("FAILED: %llu of %llu deliveries arrived\n"), (unsigned long long)total, (unsigned long long)(expected * SUBSCRIBERS));
+
+		// a server that's stuck can't be stopped, so it's left as it is
+		return 1;
+	}
+
+	_tprintf(_T("PASSED: all %llu packets reached all %u subscribers in %u ms\n"), (unsigned long long)expected,
+		(UINT)SUBSCRIBERS, (UINT)(GetTickCount() - start + STALL_MS));
+
+	publisher->Release();
+	for (auto s : subscribers)
+		s->Release();
+
+	pServer->StopListening();
+	pServer->Release();
+
+	mqme::Close();
+
+	CloseHandle(hResume);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+// CompressionTest.cpp : Round-trips the LZ codec over inputs that exercise each part of the stream
+// format, then feeds the decompressor truncated and garbage streams, which it has to turn away
+// without writing outside its buffer. Last, a compressed packet that claims to hold far more than
+// it could is checked to be rejected before anything is allocated for it.
+//
+
+#include "stdafx.h"
+#include "Compression.h"
+#include "PacketPool.h"
+
+// written past the end of every output buffer, so that an overrun shows
+#define GUARD_SIZE			64
+#define GUARD_BYTE			0xA5
+
+#define GARBAGE_ROUNDS		20000
+
+static uint32_t rngstate = 12345;
+
+static uint32_t Random()
+{
+	rngstate = (rngstate * 1103515245U) + 12345U;
+	return rngstate >> 8;
+}
+
+static std::vector<BYTE> MakeBuffer(uint32_t len)
+{
+	std::vector<BYTE> b(len + GUARD_SIZE, GUARD_BYTE);
+	return b;
+}
+
+static bool GuardIntact(const std::vector<BYTE> &b, uint32_t len)
+{
+	for (size_t i = len; i < b.size(); i++)
+	{
+		if (b[i] != GUARD_BYTE)
+			return false;
+	}
+
+	return true;
+}
+
+// the most that compressing len bytes can take, when none of it compresses
+static uint32_t WorstCase(uint32_t len)
+{
+	return len + (len / 255) + 16;
+}
+
+static bool RoundTrip(const TCHAR *name, const std::vector<BYTE> &src)
+{
+	uint32_t len = (uint32_t)src.size();
+
+	uint32_t cap = WorstCase(len);
+	std::vector<BYTE> comp = MakeBuffer(cap);
+	uint32_t clen = LZCompress(src.data(), len, comp.data(), cap);
+
+	bool ok = (clen > 0) && GuardIntact(comp, cap);
+
+	std::vector<BYTE> out = MakeBuffer(len);
+	ok = ok && LZDecompress(comp.data(), clen, out.data(), len) && GuardIntact(out, len) &&
+		!memcmp(out.data(), src.data(), len);
+
+	// the decompressor is told exactly how long the result is, so neither more nor less will do
+	if (ok && len)
+	{
+		std::vector<BYTE> shorter = MakeBuffer(len - 1);
+		ok = !LZDecompress(comp.data(), clen, shorter.data(), len - 1) && GuardIntact(shorter, len - 1);
+	}
+
+	std::vector<BYTE> longer = MakeBuffer(len + 1);
+	ok = ok && !LZDecompress(comp.data(), clen, longer.data(), len + 1) && GuardIntact(longer, len + 1);
+
+	// every truncation is either turned away or, if it only lost the empty last sequence, still exact
+	for (uint32_t i = 0; ok && (i < clen); i++)
+	{
+		std::vector<BYTE> part = MakeBuffer(len);
+		if (LZDecompress(comp.data(), i, part.data(), len))
+			ok = !memcmp(part.data(), src.data(), len);
+
+		ok = ok && GuardIntact(part, len);
+	}
+
+	_tprintf(_T("%s: %-28s %8u -> %8u bytes\n"), ok ? _T("PASSED") : _T("FAILED"), name, len, clen);
+
+	return ok;
+}
+
+// an output buffer that's too small must make the compressor give up rather than overrun it
+static bool CompressIntoTooLittle(const TCHAR *name, const std::vector<BYTE> &src, uint32_t cap)
+{
+	std::vector<BYTE> comp = MakeBuffer(cap);
+	uint32_t clen = LZCompress(src.data(), (uint32_t)src.size(), comp.data(), cap);
+
+	bool ok = !clen && GuardIntact(comp, cap);
+
+	_tprintf(_T("%s: %-28s gave up in %u bytes\n"), ok ? _T("PASSED") : _T("FAILED"), name, cap);
+
+	return ok;
+}
+
+static bool Garbage()
+{
+	bool ok = true;
+
+	for (uint32_t round = 0; ok && (round < GARBAGE_ROUNDS); round++)
+	{
+		std::vector<BYTE> src(Random() % 64);
+		for (auto &b : src)
+			b = (BYTE)Random();
+
+		uint32_t len = Random() % 4096;
+		std::vector<BYTE> out = MakeBuffer(len);
+		LZDecompress(src.data(), (uint32_t)src.size(), out.data(), len);
+
+		ok = GuardIntact(out, len);
+	}
+
+	// a match can't reach back before the start of the output
+	const BYTE early[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+	std::vector<BYTE> out = MakeBuffer(16);
+	ok = ok && !LZDecompress(early, sizeof(early), out.data(), 16) && GuardIntact(out, 16);
+
+	// and a zero offset isn't a match at all
+	const BYTE zero[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+	ok = ok && !LZDecompress(zero, sizeof(zero), out.data(), 16) && GuardIntact(out, 16);
+
+	// a length that runs off the end of the stream
+	const BYTE runaway[] = { 0xF0, 0xFF, 0xFF };
+	ok = ok && !LZDecompress(runaway, sizeof(runaway), out.data(), 16) && GuardIntact(out, 16);
+
+	_tprintf(_T("%s: garbage and malformed streams\n"), ok ? _T("PASSED") : _T("FAILED"));
+
+	return ok;
+}
+
+// a compressed packet whose length prefix is far more than its stream could decompress to
+static bool Bomb()
+{
+	CPacket *ppkt = (CPacket *)mqme::ICorePacket::NewPacket(16);
+	if (!ppkt)
+		return false;
+
+	BYTE data[5];
+	uint32_t claimed = PACKETLENGTH_MASK;
+	memcpy(data, &claimed, sizeof(uint32_t));
+	data[4] = 0;
+
+	ppkt->SetData('BOMB', sizeof(data), data);
+	ppkt->SetCompressed(true);
+
+	CPacket *ret = DecompressPacket(ppkt);
+
+	mqme::SPoolStats stats;
+	mqme::GetPoolStats(&stats);
+
+	bool ok = !ret && (stats.peak_live_bytes < (1024 * 1024));
+
+	_tprintf(_T("%s: a 5 byte packet claiming %u bytes, most ever in use %llu bytes\n"), ok ? _T("PASSED") : _T("FAILED"),
+		claimed, (unsigned long long)stats.peak_live_bytes);
+
+	if (ret)
+		ret->Release();
+
+	return ok;
+}
+
+// compressed packets that are honest about their length still come back whole
+static bool PacketRoundTrip()
+{
+	const uint32_t len = 64 * 1024;
+
+	CPacket *ppkt = (CPacket *)mqme::ICorePacket::NewPacket(len);
+	if (!ppkt)
+		return false;
+
+	ppkt->BeginData('TEXT', len);
+	BYTE *p = ppkt->Reserve(len);
+	for (uint32_t i = 0; i < len; i++)
+		p[i] = (BYTE)("the quick brown fox "[i % 20]);
+	ppkt->Commit(len);
+
+	CPacket *comp = CompressPacket(ppkt);
+	CPacket *ret = comp ? DecompressPacket(comp) : nullptr;
+
+	bool ok = ret && (ret->GetID() == 'TEXT') && (ret->GetDataLength() == len) && !memcmp(ret->GetData(), ppkt->GetData(), len);
+
+	_tprintf(_T("%s: a %u byte packet, compressed and back\n"), ok ? _T("PASSED") : _T("FAILED"), len);
+
+	if (ret)
+		ret->Release();
+
+	ppkt->Release();
+
+	return ok;
+}
+
+int main()
+{
+	if (!mqme::Initialize())
+		return 1;
+
+	bool passed = true;
+
+	std::vector<BYTE> empty;
+	passed &= RoundTrip(_T("empty"), empty);
+
+	std::vector<BYTE> tiny(3, 'x');
+	passed &= RoundTrip(_T("shorter than a match"), tiny);
+
+	std::vector<BYTE> noise(64 * 1024);
+	for (auto &b : noise)
+		b = (BYTE)Random();
+	passed &= RoundTrip(_T("incompressible"), noise);
+	passed &= CompressIntoTooLittle(_T("incompressible"), noise, (uint32_t)noise.size() - 1);
+
+	// a run of one byte is a match that overlaps itself, one byte back
+	std::vector<BYTE> zeros(100 * 1024, 0);
+	passed &= RoundTrip(_T("overlapping, offset 1"), zeros);
+
+	std::vector<BYTE> pattern(10 * 1024);
+	for (size_t i = 0; i < pattern.size(); i++)
+		pattern[i] = (BYTE)("abc"[i % 3]);
+	passed &= RoundTrip(_T("overlapping, offset 3"), pattern);
+
+	// literal runs long enough that their length needs more than one extra byte, between long matches
+	std::vector<BYTE> mixed;
+	for (size_t i = 0; i < 8; i++)
+	{
+		for (size_t j = 0; j < 600; j++)
+			mixed.push_back((BYTE)Random());
+
+		mixed.insert(mixed.end(), 700, (BYTE)i);
+	}
+	passed &= RoundTrip(_T("long literals and matches"), mixed);
+
+	// one marker repeated exactly as far back as an offset can reach, and another just out of reach;
+	// everything between is zeros, which leaves the markers as the only candidates for each other
+	std::vector<BYTE> far(0x30000, 0);
+	memcpy(&far[0], "WXYZ", 4);
+	memcpy(&far[0xFFFF], "WXYZ", 4);
+	memcpy(&far[0x18000], "QRST", 4);
+	memcpy(&far[0x28000], "QRST", 4);
+	passed &= RoundTrip(_T("distant matches"), far);
+
+	passed &= Garbage();
+	passed &= Bomb();
+	passed &= PacketRoundTrip();
+
+	mqme::Close();
+
+	_tprintf(_T("%s\n"), passed ? _T("PASSED") : _T("FAILED"));
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+// GUIDIndexTest.cpp : Checks CGUIDIndex's inserts, replacements and erases against what was put
+// in, that rebuilds (both to grow and to clear out deleted slots) keep every live key, and that
+// readers looking things up while the writer rebuilds never see a wrong value.
+//
+
+#include "stdafx.h"
+#include "GUIDIndex.h"
+
+#define KEY_COUNT			100000
+#define CHURN_ROUNDS		200000
+#define READER_THREADS		4
+#define STABLE_KEYS			1000
+#define CONCURRENT_MS		2000
+#define BURST_KEYS			5000
+
+static uint32_t rngstate = 12345;
+
+static uint32_t Random()
+{
+	rngstate = (rngstate * 1103515245U) + 12345U;
+	return rngstate >> 8;
+}
+
+// every key is different in its first four bytes, and looks random in the rest
+static GUID MakeKey(uint32_t n)
+{
+	GUID g;
+	g.Data1 = n;
+	g.Data2 = (unsigned short)Random();
+	g.Data3 = (unsigned short)Random();
+	for (size_t i = 0; i < 8; i++)
+		g.Data4[i] = (unsigned char)Random();
+
+	return g;
+}
+
+static bool Report(const TCHAR *name, bool ok)
+{
+	_tprintf(_T("%s: %s\n"), ok ? _T("PASSED") : _T("FAILED"), name);
+
+	return ok;
+}
+
+static bool InsertFindErase()
+{
+	CGUIDIndex index(16);
+	std::vector<GUID> keys;
+
+	bool ok = true;
+
+	for (uint32_t i = 0; i < KEY_COUNT; i++)
+	{
+		keys.push_back(MakeKey(i));
+		index.Insert(keys[i], i);
+	}
+
+	ok = ok && (index.Size() == KEY_COUNT);
+
+	for (uint32_t i = 0; ok && (i < KEY_COUNT); i++)
+		ok = (index.Find(keys[i]) == i);
+
+	// keys that were never put in aren't found
+	for (uint32_t i = KEY_COUNT; ok && (i < (KEY_COUNT * 2)); i++)
+		ok = (index.Find(MakeKey(i)) == GUIDINDEX_NONE);
+
+	ok = Report(_T("insert and find"), ok);
+
+	// inserting a key that's already there replaces its value
+	for (uint32_t i = 0; i < KEY_COUNT; i += 2)
+		index.Insert(keys[i], i + KEY_COUNT);
+
+	bool rok = (index.Size() == KEY_COUNT);
+	for (uint32_t i = 0; rok && (i < KEY_COUNT); i++)
+		rok = (index.Find(keys[i]) == ((i & 1) ? i : (i + KEY_COUNT)));
+
+	ok &= Report(_T("replace"), rok);
+
+	// erase every third key
+	bool eok = true;
+	size_t erased = 0;
+	for (uint32_t i = 0; eok && (i < KEY_COUNT); i += 3)
+	{
+		eok = index.Erase(keys[i]);
+		erased++;
+	}
+
+	eok = eok && (index.Size() == (KEY_COUNT - erased));
+
+	for (uint32_t i = 0; eok && (i < KEY_COUNT); i++)
+	{
+		uint32_t expected = (!(i % 3)) ? GUIDINDEX_NONE : ((i & 1) ? i : (i + KEY_COUNT));
+		eok = (index.Find(keys[i]) == expected);
+	}
+
+	// they can't be erased twice, and can be put back
+	for (uint32_t i = 0; eok && (i < KEY_COUNT); i += 3)
+		eok = !index.Erase(keys[i]);
+
+	for (uint32_t i = 0; i < KEY_COUNT; i += 3)
+		index.Insert(keys[i], i);
+
+	eok = eok && (index.Size() == KEY_COUNT);
+	for (uint32_t i = 0; eok && (i < KEY_COUNT); i += 3)
+		eok = (index.Find(keys[i]) == i);
+
+	ok &= Report(_T("erase and reinsert"), eok);
+
+	index.Clear();
+	bool cok = !index.Size();
+	for (uint32_t i = 0; cok && (i < KEY_COUNT); i++)
+		cok = (index.Find(keys[i]) == GUIDINDEX_NONE);
+
+	ok &= Report(_T("clear"), cok);
+
+	return ok;
+}
+
+// a small table with a few keys that stay, and a steady stream of others coming and going, fills
+// up with deleted slots; the rebuilds that clear them out must keep the ones that stayed
+static bool Tombstones()
+{
+	CGUIDIndex index(16);
+	std::vector<GUID> stay;
+
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		stay.push_back(MakeKey(i));
+		index.Insert(stay[i], i);
+	}
+
+	bool ok = true;
+	size_t rebuilds = 0;
+
+	for (uint32_t round = 0; ok && (round < CHURN_ROUNDS); round++)
+	{
+		GUID g = MakeKey(1000 + round);
+
+		CGUIDIndex::STable *retired;
+		index.Insert(g, round, &retired);
+		if (retired)
+		{
+			rebuilds++;
+			CGUIDIndex::FreeTable(retired);
+		}
+
+		ok = (index.Find(g) == round) && index.Erase(g) && (index.Find(g) == GUIDINDEX_NONE) && (index.Size() == stay.size());
+
+		for (uint32_t i = 0; ok && (i < stay.size()); i++)
+			ok = (index.Find(stay[i]) == i);
+	}
+
+	_tprintf(_T("%u rebuilds in %u rounds\n"), (UINT)rebuilds, (UINT)CHURN_ROUNDS);
+
+	// with only four keys, the table stays at 16 slots and is rebuilt every ten rounds; had it
+	// grown instead, the rebuilds would come further and further apart
+	return Report(_T("rebuilds clear out deleted slots"), ok && (rebuilds >= (CHURN_ROUNDS / 16)));
+}
+
+
+CGUIDIndex *shared;
+std::vector<GUID> stable;
+std::atomic<bool> stop;
+std::atomic<uint64_t> lookups, wrong;
+
+// how many times each reader has gone through all of the stable keys
+std::atomic<uint64_t> passes[READER_THREADS];
+
+DWORD WINAPI ReaderThreadProc(LPVOID param)
+{
+	std::atomic<uint64_t> *mypasses = &passes[(size_t)param];
+	uint64_t n = 0;
+
+	while (!stop)
+	{
+		for (uint32_t i = 0; i < STABLE_KEYS; i++)
+		{
+			if (shared->Find(stable[i]) != i)
+				wrong++;
+		}
+
+		n += STABLE_KEYS;
+		(*mypasses)++;
+	}
+
+	lookups += n;
+
+	return 0;
+}
+
+// one writer keeps growing, shrinking and rebuilding the table while readers look up keys that are
+// always there. An old table is only freed once every reader has started a new pass since it was
+// replaced, so that none can still be looking at it - which is what the routing table's reclamation
+// guarantees in the library
+static bool ReadersDuringRebuilds()
+{
+	shared = new CGUIDIndex(16);
+
+	for (uint32_t i = 0; i < STABLE_KEYS; i++)
+	{
+		stable.push_back(MakeKey(i));
+		shared->Insert(stable[i], i);
+	}
+
+	HANDLE readers[READER_THREADS];
+	for (size_t i = 0; i < READER_THREADS; i++)
+		readers[i] = CreateThread(NULL, 0, ReaderThreadProc, (LPVOID)i, 0, NULL);
+
+	std::vector<CGUIDIndex::STable *> retired;
+	std::vector<GUID> churn;
+	size_t rebuilds = 0;
+	uint32_t next = STABLE_KEYS;
+
+	DWORD start = GetTickCount();
+	while ((GetTickCount() - start) < CONCURRENT_MS)
+	{
+		// a burst of inserts that makes it grow, then erases that leave deleted slots behind
+		for (size_t i = 0; i < BURST_KEYS; i++)
+		{
+			churn.push_back(MakeKey(next));
+
+			CGUIDIndex::STable *t;
+			shared->Insert(churn.back(), next++, &t);
+			if (t)
+			{
+				retired.push_back(t);
+				rebuilds++;
+			}
+		}
+
+		for (auto &g : churn)
+			shared->Erase(g);
+
+		churn.clear();
+
+		// a pass that started before the tables were replaced has ended once the count has gone up twice
+		uint64_t seen[READER_THREADS];
+		for (size_t i = 0; i < READER_THREADS; i++)
+			seen[i] = passes[i];
+
+		for (size_t i = 0; i < READER_THREADS; i++)
+		{
+			while (passes[i] < (seen[i] + 2))
+				SwitchToThread();
+		}
+
+		for (auto t : retired)
+			CGUIDIndex::FreeTable(t);
+
+		retired.clear();
+	}
+
+	stop = true;
+	for (size_t i = 0; i < READER_THREADS; i++)
+	{
+		WaitForSingleObject(readers[i], INFINITE);
+		CloseHandle(readers[i]);
+	}
+
+	for (auto t : retired)
+		CGUIDIndex::FreeTable(t);
+
+	delete shared;
+
+	_tprintf(_T("%llu lookups during %u rebuilds\n"), (unsigned long long)lookups.load(), (UINT)rebuilds);
+
+	return Report(_T("readers during rebuilds"), !wrong && rebuilds && lookups);
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= InsertFindErase();
+	passed &= Tombstones();
+	passed &= ReadersDuringRebuilds();
+
+	_tprintf(_T("%s\n"), passed ? _T("PASSED") : _T("FAILED"));
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,422 @@
+// RoutingTableTest.cpp : Checks CRoutingTable's channels against what was put in, that what writers
+// replace or defer is only dealt with once no reader can still see it, and that a dropped channel's
+// handle is handed out again. Then readers walk channels while writers keep creating, changing and
+// dropping them, and must only ever see members that belong to the channel they looked up.
+//
+// Built with AddressSanitizer, a snapshot freed too early shows up as a use after free.
+//
+
+#include "stdafx.h"
+#include "RoutingTable.h"
+
+#define CHANNEL_COUNT		1000
+#define REACTORS			4
+#define STABLE_CHANNELS		16
+#define CHURN_CHANNELS		64
+#define WRITER_THREADS		2
+#define READER_THREADS		4
+#define CONCURRENT_MS		2000
+
+static GUID MakeChannel(uint32_t n)
+{
+	GUID g;
+	memset(&g, 0, sizeof(g));
+	g.Data1 = n;
+	g.Data4[7] = 0x5A;
+
+	return g;
+}
+
+// members remember which channel they were put in, so that a reader can tell if it's looking at
+// another channel's snapshot
+static SMember MakeMember(uint32_t index, uint32_t channel)
+{
+	SMember m;
+	m.m_Index = index;
+	m.m_Reactor = index % REACTORS;
+	m.m_Socket = (SOCKET)index;
+	m.m_Queue = nullptr;
+	m.m_Context = (void *)(uintptr_t)channel;
+	m.m_Filter = nullptr;
+
+	return m;
+}
+
+// lets the tests see how many handles have been made and how much is waiting to be freed
+class CTestTable : public CRoutingTable
+{
+public:
+	uint32_t HandlesMade() const { return m_NextHandle; }
+	size_t RetiredCount() const { return m_Retired.size(); }
+};
+
+static bool Report(const TCHAR *name, bool ok)
+{
+	_tprintf(_T("%s: %s\n"), ok ? _T("PASSED") : _T("FAILED"), name);
+
+	return ok;
+}
+
+// the members are in reactor order, and each reactor's run is where ForReactor says
+static bool Ordered(const SMemberList *ml)
+{
+	for (size_t i = 1; i < ml->m_Members.size(); i++)
+	{
+		if (ml->m_Members[i - 1].m_Reactor > ml->m_Members[i].m_Reactor)
+			return false;
+	}
+
+	size_t next = 0;
+	for (uint32_t r = 0; r < REACTORS; r++)
+	{
+		size_t b, e;
+		ml->ForReactor(r, &b, &e);
+		if (b != next)
+			return false;
+
+		for (size_t i = b; i < e; i++)
+		{
+			if (ml->m_Members[i].m_Reactor != r)
+				return false;
+		}
+
+		next = e;
+	}
+
+	return (next == ml->m_Members.size());
+}
+
+static bool AddRemove()
+{
+	CTestTable table;
+	CRoutingTable::CReader *r;
+
+	bool ok = true;
+
+	// channel n gets members 0..(n % 8)
+	for (uint32_t c = 0; c < CHANNEL_COUNT; c++)
+	{
+		for (uint32_t m = 0; m <= (c % 8); m++)
+			ok = ok && table.Add(MakeChannel(c), MakeMember(m, c));
+	}
+
+	// the same member can't join twice
+	ok = ok && !table.Add(MakeChannel(5), MakeMember(3, 5));
+
+	r = new CRoutingTable::CReader(table);
+	for (uint32_t c = 0; ok && (c < CHANNEL_COUNT); c++)
+	{
+		const SMemberList *ml = r->Find(MakeChannel(c));
+		ok = ml && (ml->m_Members.size() == ((c % 8) + 1)) && Ordered(ml);
+	}
+
+	ok = ok && !r->Find(MakeChannel(CHANNEL_COUNT));
+	delete r;
+
+	ok = Report(_T("add and find"), ok);
+
+	// take out the even members; channels left with none go away
+	for (uint32_t c = 0; c < CHANNEL_COUNT; c++)
+	{
+		for (uint32_t m = 0; m <= (c % 8); m += 2)
+			table.Remove(MakeChannel(c), m);
+	}
+
+	// removing what isn't there does nothing
+	table.Remove(MakeChannel(1), 0);
+	table.Remove(MakeChannel(CHANNEL_COUNT), 0);
+
+	bool rok = true;
+	r = new CRoutingTable::CReader(table);
+	for (uint32_t c = 0; rok && (c < CHANNEL_COUNT); c++)
+	{
+		const SMemberList *ml = r->Find(MakeChannel(c));
+		size_t left = ((c % 8) + 1) / 2;
+		if (!left)
+		{
+			rok = !ml;
+			continue;
+		}
+
+		rok = ml && (ml->m_Members.size() == left) && Ordered(ml);
+		for (size_t i = 0; rok && (i < ml->m_Members.size()); i++)
+			rok = (ml->m_Members[i].m_Index & 1);
+	}
+	delete r;
+
+	ok &= Report(_T("remove"), rok);
+
+	// a filter is only on the member it was set for, and setting one for a non-member is refused
+	FOURCHARCODE ids[] = { 'B', 'A' };
+	bool fok = table.SetFilter(MakeChannel(7), 3, new SInterestFilter(true, ids, 2)) &&
+		table.SetFilter(MakeChannel(7), 3, new SInterestFilter(false, ids, 2)) &&
+		!table.SetFilter(MakeChannel(7), 2, new SInterestFilter(true, ids, 2)) &&
+		!table.SetFilter(MakeChannel(CHANNEL_COUNT), 1, new SInterestFilter(true, ids, 2));
+
+	r = new CRoutingTable::CReader(table);
+	const SMemberList *ml = r->Find(MakeChannel(7));
+	for (size_t i = 0; fok && ml && (i < ml->m_Members.size()); i++)
+	{
+		const SInterestFilter *f = ml->m_Members[i].m_Filter;
+		if (ml->m_Members[i].m_Index == 3)
+			fok = f && !f->Passes('A') && !f->Passes('B') && f->Passes('C');
+		else
+			fok = !f;
+	}
+	fok = fok && ml;
+	delete r;
+
+	ok &= Report(_T("interest filters"), fok);
+
+	table.Clear();
+
+	bool cok = true;
+	r = new CRoutingTable::CReader(table);
+	for (uint32_t c = 0; cok && (c < CHANNEL_COUNT); c++)
+		cok = !r->Find(MakeChannel(c));
+	delete r;
+
+	// and what was cleared can be used again
+	cok = cok && table.Add(MakeChannel(1), MakeMember(1, 1));
+
+	ok &= Report(_T("clear"), cok);
+
+	return ok;
+}
+
+
+static void CountDeferred(void *context, uintptr_t value)
+{
+	(*(size_t *)context) += value;
+}
+
+// nothing retired or deferred is dealt with while a reader that started before it is still around;
+// once the readers are gone, the next few writes deal with all of it
+static bool Reclamation()
+{
+	CTestTable table;
+	size_t deferred = 0;
+
+	bool ok = table.Add(MakeChannel(0), MakeMember(0, 0));
+
+	CRoutingTable::CReader *r = new CRoutingTable::CReader(table);
+	const SMemberList *seen = r->Find(MakeChannel(0));
+
+	table.Defer(CountDeferred, &deferred, 1);
+
+	// plenty of writes, each replacing the snapshot the reader holds
+	for (uint32_t i = 1; i < 100; i++)
+	{
+		table.Add(MakeChannel(0), MakeMember(i, 0));
+		table.Remove(MakeChannel(0), i);
+	}
+
+	// what the reader found is still whole, and the deferred call hasn't been made
+	ok = ok && seen && (seen->m_Members.size() == 1) && (seen->m_Members[0].m_Index == 0) && !deferred;
+	ok = ok && (table.RetiredCount() >= 198);
+
+	// a second reader, which started later, doesn't hold anything back that the first didn't
+	CRoutingTable::CReader *r2 = new CRoutingTable::CReader(table);
+	delete r;
+
+	table.Add(MakeChannel(0), MakeMember(1, 0));
+	table.Remove(MakeChannel(0), 1);
+
+	delete r2;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		table.Add(MakeChannel(1), MakeMember(0, 1));
+		table.Remove(MakeChannel(1), 0);
+	}
+
+	// only what the last couple of writes retired is left
+	ok = ok && (deferred == 1) && (table.RetiredCount() <= 8);
+
+	return Report(_T("reclamation waits for readers"), ok);
+}
+
+// a channel that's dropped gives its handle back once no reader can be using it, so that channels
+// coming and going don't use up handles
+static bool HandleReuse()
+{
+	CTestTable table;
+
+	bool ok = true;
+	for (uint32_t round = 0; ok && (round < 100000); round++)
+	{
+		GUID g = MakeChannel(round);
+
+		ok = table.Add(g, MakeMember(round, round));
+		table.Remove(g, round);
+	}
+
+	uint32_t made = table.HandlesMade();
+
+	// the writes alone move the epoch on, so a handle comes back a couple of channels later
+	ok = ok && (made <= 4);
+
+	// while a reader is around, though, none can
+	CRoutingTable::CReader *r = new CRoutingTable::CReader(table);
+	for (uint32_t round = 0; ok && (round < 100); round++)
+	{
+		GUID g = MakeChannel(round);
+
+		ok = table.Add(g, MakeMember(round, round));
+		table.Remove(g, round);
+	}
+	delete r;
+
+	ok = ok && (table.HandlesMade() >= (made + 98));
+
+	_tprintf(_T("%u handles for 100000 channels, %u more with a reader holding them\n"), made, table.HandlesMade() - made);
+
+	return Report(_T("handles are reused"), ok);
+}
+
+
+CRoutingTable *shared;
+std::atomic<bool> stop;
+std::atomic<uint64_t> lookups, found, wrong;
+
+DWORD WINAPI ReaderThreadProc(LPVOID param)
+{
+	uint32_t state = (uint32_t)(uintptr_t)param + 1;
+	uint64_t n = 0, f = 0, w = 0;
+
+	while (!stop)
+	{
+		CRoutingTable::CReader r(*shared);
+
+		for (size_t i = 0; i < 64; i++)
+		{
+			state = (state * 1103515245U) + 12345U;
+			uint32_t c = (state >> 8) % (STABLE_CHANNELS + CHURN_CHANNELS);
+
+			const SMemberList *ml = r.Find(MakeChannel(c));
+			n++;
+			if (!ml)
+			{
+				// stable channels always have their first member
+				if (c < STABLE_CHANNELS)
+					w++;
+				continue;
+			}
+
+			f++;
+
+			if (!Ordered(ml))
+				w++;
+
+			for (auto &m : ml->m_Members)
+			{
+				if (m.m_Context != (void *)(uintptr_t)c)
+					w++;
+
+				// touches the filter, which would be freed memory if it went too early
+				if (m.m_Filter && (m.m_Filter->m_IDs.size() != 1))
+					w++;
+			}
+		}
+	}
+
+	lookups += n;
+	found += f;
+	wrong += w;
+
+	return 0;
+}
+
+std::atomic<uint64_t> writes;
+
+DWORD WINAPI WriterThreadProc(LPVOID param)
+{
+	uint32_t first = (uint32_t)(uintptr_t)param;
+	uint32_t state = first + 100;
+	uint64_t n = 0;
+
+	// each writer keeps to its own channels
+	while (!stop)
+	{
+		state = (state * 1103515245U) + 12345U;
+		uint32_t r = state >> 8;
+
+		uint32_t c = (r % (STABLE_CHANNELS + CHURN_CHANNELS)) & ~(uint32_t)(WRITER_THREADS - 1);
+		c += first;
+		if (c >= (STABLE_CHANNELS + CHURN_CHANNELS))
+			continue;
+
+		// member 0 of a stable channel never leaves
+		uint32_t m = (r >> 8) % 16;
+		if ((c < STABLE_CHANNELS) && !m)
+			m = 1;
+
+		switch ((r >> 16) % 3)
+		{
+		case 0:
+			shared->Add(MakeChannel(c), MakeMember(m, c));
+			break;
+
+		case 1:
+			shared->Remove(MakeChannel(c), m);
+			break;
+
+		case 2:
+			{
+				FOURCHARCODE id = 'DATA';
+				shared->SetFilter(MakeChannel(c), m, new SInterestFilter(true, &id, 1));
+			}
+			break;
+		}
+
+		n++;
+	}
+
+	writes += n;
+
+	return 0;
+}
+
+static bool ReadersDuringWrites()
+{
+	shared = new CRoutingTable();
+
+	for (uint32_t c = 0; c < STABLE_CHANNELS; c++)
+		shared->Add(MakeChannel(c), MakeMember(0, c));
+
+	HANDLE threads[READER_THREADS + WRITER_THREADS];
+	for (size_t i = 0; i < READER_THREADS; i++)
+		threads[i] = CreateThread(NULL, 0, ReaderThreadProc, (LPVOID)i, 0, NULL);
+	for (size_t i = 0; i < WRITER_THREADS; i++)
+		threads[READER_THREADS + i] = CreateThread(NULL, 0, WriterThreadProc, (LPVOID)i, 0, NULL);
+
+	Sleep(CONCURRENT_MS);
+
+	stop = true;
+	for (size_t i = 0; i < (READER_THREADS + WRITER_THREADS); i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+
+	delete shared;
+
+	_tprintf(_T("%llu lookups (%llu found) during %llu writes\n"), (unsigned long long)lookups.load(),
+		(unsigned long long)found.load(), (unsigned long long)writes.load());
+
+	return Report(_T("readers during writes"), !wrong && found && writes);
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= AddRemove();
+	passed &= Reclamation();
+	passed &= HandleReuse();
+	passed &= ReadersDuringWrites();
+
+	_tprintf(_T("%s\n"), passed ? _T("PASSED") : _T("FAILED"));
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+// SendBatchTest.cpp : Queues a few hundred small packets behind a socket that won't take any more,
+// then checks that every byte arrives, in order, once the other end starts reading again.
+//
+// Runs of small packets are copied together into one buffer per write, so a long queue of them
+// is the case where the copies could outgrow the batch's scratch space.
+//
+
+#include "stdafx.h"
+#include "SendBatch.h"
+#include "PacketPool.h"
+
+// the library's sources are built into this test, so it provides their globals
+CPacketPool *g_PacketPool = NULL;
+CExecutor *g_ThreadPool = NULL;
+
+#define BACKLOG_PACKETS		500
+
+// makes a connected pair of loopback sockets
+static bool MakePair(SOCKET *tx, SOCKET *rx)
+{
+	SOCKET l = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (l == INVALID_SOCKET)
+		return false;
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	int addrlen = sizeof(addr);
+	bool ret = (bind(l, (sockaddr *)&addr, sizeof(addr)) != SOCKET_ERROR) && (listen(l, 1) != SOCKET_ERROR) &&
+		(getsockname(l, (sockaddr *)&addr, &addrlen) != SOCKET_ERROR);
+
+	if (ret)
+	{
+		*tx = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		ret = (*tx != INVALID_SOCKET) && (connect(*tx, (sockaddr *)&addr, sizeof(addr)) != SOCKET_ERROR);
+	}
+
+	if (ret)
+	{
+		*rx = accept(l, NULL, NULL);
+		ret = (*rx != INVALID_SOCKET);
+	}
+
+	closesocket(l);
+
+	return ret;
+}
+
+// adds a packet of len bytes to the batch, and what it should look like on the wire to expected
+static void QueuePacket(CSendBatch &batch, uint32_t n, uint32_t len, std::vector<BYTE> &expected)
+{
+	SPacketHeader hdr;
+	memset(&hdr, 0, sizeof(SPacketHeader));
+	hdr.m_ID = 'TEST';
+	hdr.m_DataLength = len;
+
+	BYTE data[SENDBATCH_COPY_SIZE];
+	for (uint32_t i = 0; i < len; i++)
+		data[i] = (BYTE)(n + i);
+
+	WSABUF buf[2];
+	buf[0].buf = (char *)&hdr;
+	buf[0].len = sizeof(SPacketHeader);
+	buf[1].buf = (char *)data;
+	buf[1].len = len;
+
+	batch.Add(NULL, buf, 2, NULL);
+
+	expected.insert(expected.end(), (BYTE *)&hdr, (BYTE *)&hdr + sizeof(SPacketHeader));
+	expected.insert(expected.end(), data, data + len);
+}
+
+int main()
+{
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return 1;
+
+	SOCKET tx, rx;
+	if (!MakePair(&tx, &rx))
+	{
+		_tprintf(_T("FAILED: couldn't connect a pair of sockets\n"));
+		return 1;
+	}
+
+	// small socket buffers, so that the sender blocks quickly
+	int bufsize = 4096;
+	setsockopt(tx, SOL_SOCKET, SO_SNDBUF, (const char *)&bufsize, sizeof(int));
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, (const char *)&bufsize, sizeof(int));
+
+	u_long nonblocking = 1;
+	ioctlsocket(tx, FIONBIO, &nonblocking);
+	ioctlsocket(rx, FIONBIO, &nonblocking);
+
+	CSendBatch batch;
+	std::vector<BYTE> expected;
+	uint32_t n = 0;
+
+	// nobody's reading yet, so keep going until the socket won't take any more
+	int r;
+	do
+	{
+		QueuePacket(batch, n, (n % SENDBATCH_COPY_SIZE) + 1, expected);
+		n++;
+		r = batch.Flush(tx);
+	}
+	while (r == SENDBATCH_SENT);
+
+	if (r != SENDBATCH_BLOCKED)
+	{
+		_tprintf(_T("FAILED: the socket broke while filling it\n"));
+		return 1;
+	}
+
+	// now a backlog builds up behind it, as it would for a slow consumer
+	for (uint32_t i = 0; i < BACKLOG_PACKETS; i++, n++)
+		QueuePacket(batch, n, (n % SENDBATCH_COPY_SIZE) + 1, expected);
+
+	_tprintf(_T("%u packets queued, %u bytes\n"), n, (UINT)expected.size());
+
+	// read everything back, flushing whenever the socket has room
+	std::vector<BYTE> received;
+	std::vector<char> chunk(64 * 1024);
+	DWORD idle_since = GetTickCount();
+
+	while (received.size() < expected.size())
+	{
+		r = batch.Flush(tx);
+		if (r == SENDBATCH_FAILED)
+		{
+			_tprintf(_T("FAILED: the socket broke while flushing\n"));
+			return 1;
+		}
+
+		int got = recv(rx, chunk.data(), (int)chunk.size(), 0);
+		if (got > 0)
+		{
+			received.insert(received.end(), chunk.begin(), chunk.begin() + got);
+			idle_since = GetTickCount();
+		}
+		else if ((GetTickCount() - idle_since) > 5000)
+		{
+			break;
+		}
+		else
+		{
+			Sleep(1);
+		}
+	}
+
+	bool passed = batch.Empty() && (received == expected);
+
+#if defined(_DEBUG)
+	// an overrun of the scratch space shows up as heap corruption
+	passed = passed && _CrtCheckMemory();
+#endif
+
+	_tprintf(_T("%s: %u of %u bytes arrived intact\n"), passed ? _T("PASSED") : _T("FAILED"), (UINT)received.size(), (UINT)expected.size());
+
+	closesocket(tx);
+	closesocket(rx);
+
+	WSACleanup();
+
+	return passed ? 0 : 1;
+}